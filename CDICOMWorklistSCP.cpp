@@ -6,7 +6,317 @@
 #include "CDICOMWorklistSCP.h"
 #include <filesystem>
 #include <chrono>
+#include <algorithm>
 #include <sstream>
+#include <fstream>
+#include <cctype>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <future>
+#include <dcmtk/dcmdata/dcostrmb.h>
+#include <dcmtk/dcmdata/dcistrmb.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+// ===============================================================================================================
+// ================================================= Byte Helpers ================================================
+// ===============================================================================================================
+
+
+namespace
+{
+    // Magic number at the start of every delta log record ("WLD1"), keyed by item ID and stamped with the
+    // size and modification time of the dataset file it applies to.
+    const Uint32 DeltaRecordMagic = 0x31444C57;
+
+    // Size of a delta log record header: magic, payload length and payload checksum.
+    const size_t DeltaRecordHeaderSize = 16;
+
+    // Suffix of the temp file a dataset is written to before it replaces the previous version.
+    const std::string TempSuffix = ".tmp";
+
+    // Interval at which the template file is checked for changes while datasets are added.
+    const std::chrono::milliseconds TemplateCheckInterval(1000);
+
+    // Magic number and format version at the start of the index sidecar ("WLIX").
+    const Uint32 SidecarMagic = 0x58494C57;
+    const Uint32 SidecarVersion = 1;
+
+    // Size of the sidecar header: magic, version, record size, reserved, header checksum and padding.
+    const size_t SidecarHeaderSize = 32;
+
+    // Widths of the fixed-size fields of a sidecar record. Values that do not fit are not stored.
+    const size_t SidecarFileNameWidth = 128;
+    const size_t SidecarPatientIdWidth = 64;
+    const size_t SidecarAccessionWidth = 16;
+    const size_t SidecarDateWidth = 8;
+    const size_t SidecarStationWidth = 16;
+    const size_t SidecarModalityWidth = 16;
+    const size_t SidecarMaxSteps = 4;
+
+    // Size of a sidecar record: used flag (4), date count (2), station count (2), file size (8),
+    // file time (8), file name, patient ID, accession number, dates, stations, modality count (4),
+    // modalities and record checksum (8).
+    const size_t SidecarRecordSize = 4 + 2 + 2 + 8 + 8 + SidecarFileNameWidth + SidecarPatientIdWidth + SidecarAccessionWidth
+        + SidecarMaxSteps * SidecarDateWidth + SidecarMaxSteps * SidecarStationWidth
+        + 4 + SidecarMaxSteps * SidecarModalityWidth + 8;
+
+    // Appends an unsigned integer in little-endian byte order.
+    void putLE(std::vector<Uint8>& buffer, Uint64 value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            buffer.push_back(static_cast<Uint8>(value >> (8 * i)));
+        }
+    }
+
+    // Reads an unsigned integer stored in little-endian byte order.
+    Uint64 getLE(const Uint8* data, int bytes)
+    {
+        Uint64 value = 0;
+        for (int i = bytes - 1; i >= 0; i--)
+        {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    // 64-bit FNV-1a hash, used for element fingerprints and record checksums.
+    Uint64 fnv1a(const Uint8* data, size_t length)
+    {
+        Uint64 hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < length; i++)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // Appends a string as a zero-padded field of fixed width. The string must not be longer than the field.
+    void putFixed(std::vector<Uint8>& buffer, const std::string& value, size_t width)
+    {
+        buffer.insert(buffer.end(), value.begin(), value.end());
+        buffer.insert(buffer.end(), width - value.size(), 0);
+    }
+
+    // Reads a zero-padded string field of fixed width.
+    std::string getFixed(const Uint8* data, size_t width)
+    {
+        size_t length = 0;
+        while (length < width && data[length] != 0) length++;
+        return std::string(reinterpret_cast<const char*>(data), length);
+    }
+
+    // Retrieves size and modification time of a file, used to detect whether a sidecar record is still current.
+    bool fileStamp(const std::filesystem::path& file, Uint64& size, Uint64& time)
+    {
+        std::error_code ec;
+        size = static_cast<Uint64>(std::filesystem::file_size(file, ec));
+        if (ec) return false;
+        time = static_cast<Uint64>(std::filesystem::last_write_time(file, ec).time_since_epoch().count());
+        return !ec;
+    }
+
+    // Read-only memory mapping of a whole file.
+    class MappedFile
+    {
+    public:
+        ~MappedFile()
+        {
+            close();
+        }
+
+        // Maps the file; returns false if it does not exist, is empty or cannot be mapped.
+        bool open(const std::string& path)
+        {
+            close();
+#ifdef _WIN32
+            file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file_ == INVALID_HANDLE_VALUE) return false;
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+            {
+                close();
+                return false;
+            }
+
+            mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_ == nullptr)
+            {
+                close();
+                return false;
+            }
+
+            data_ = static_cast<const Uint8*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+            if (data_ == nullptr)
+            {
+                close();
+                return false;
+            }
+            size_ = static_cast<size_t>(size.QuadPart);
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+
+            struct stat info;
+            if (::fstat(fd, &info) != 0 || info.st_size == 0)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            void* data = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED) return false;
+
+            data_ = static_cast<const Uint8*>(data);
+            size_ = static_cast<size_t>(info.st_size);
+#endif
+            return true;
+        }
+
+        // Unmaps the file.
+        void close()
+        {
+#ifdef _WIN32
+            if (data_ != nullptr) UnmapViewOfFile(data_);
+            if (mapping_ != nullptr) CloseHandle(mapping_);
+            if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+            mapping_ = nullptr;
+            file_ = INVALID_HANDLE_VALUE;
+#else
+            if (data_ != nullptr) ::munmap(const_cast<Uint8*>(data_), size_);
+#endif
+            data_ = nullptr;
+            size_ = 0;
+        }
+
+        const Uint8* data() const { return data_; }
+        size_t size() const { return size_; }
+
+    private:
+        const Uint8* data_ = nullptr;
+        size_t size_ = 0;
+#ifdef _WIN32
+        HANDLE file_ = INVALID_HANDLE_VALUE;
+        HANDLE mapping_ = nullptr;
+#endif
+    };
+
+    // Opens and at once closes a connection to 'port' on the loopback interface, so that a listener blocked in
+    // accept on that port returns, sees that it was asked to stop and releases the port.
+    void wakeListener(Uint16 port)
+    {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+#ifdef _WIN32
+        SOCKET connection = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (connection == INVALID_SOCKET) return;
+        ::connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        ::closesocket(connection);
+#else
+        int connection = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (connection < 0) return;
+        ::connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        ::close(connection);
+#endif
+    }
+
+    // Combines group and element number of a DICOM object into a single key.
+    Uint32 tagKeyOf(const DcmObject& object)
+    {
+        return (static_cast<Uint32>(object.getGTag()) << 16) | object.getETag();
+    }
+
+    // Number of days between 1970-01-01 and the given date of the proleptic Gregorian calendar.
+    Sint64 daysFromCivil(Sint64 year, unsigned month, unsigned day)
+    {
+        year -= month <= 2;
+        const Sint64 era = (year >= 0 ? year : year - 399) / 400;
+        const unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+        const unsigned dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + static_cast<Sint64>(dayOfEra) - 719468;
+    }
+
+    // Converts a DICOM date (YYYYMMDD) and optional time (HH[MM[SS[.F]]]) into minutes since 1970-01-01.
+    // Returns -1 if the date is missing or malformed.
+    Sint64 minutesFromDateTime(const OFString& date, const OFString& time)
+    {
+        if (date.length() < 8) return -1;
+        for (size_t i = 0; i < 8; i++)
+        {
+            if (date[i] < '0' || date[i] > '9') return -1;
+        }
+
+        auto digits = [](const OFString& text, size_t pos)
+        {
+            if (text.length() < pos + 2) return 0;
+            if (text[pos] < '0' || text[pos] > '9' || text[pos + 1] < '0' || text[pos + 1] > '9') return 0;
+            return (text[pos] - '0') * 10 + (text[pos + 1] - '0');
+        };
+
+        Sint64 year = digits(date, 0) * 100 + digits(date, 2);
+        unsigned month = static_cast<unsigned>(digits(date, 4));
+        unsigned day = static_cast<unsigned>(digits(date, 6));
+        if (month < 1 || month > 12 || day < 1 || day > 31) return -1;
+
+        return daysFromCivil(year, month, day) * 1440 + digits(time, 0) * 60 + digits(time, 2);
+    }
+
+    // Current local time in minutes since 1970-01-01, on the same scale as minutesFromDateTime().
+    Sint64 localMinutesNow()
+    {
+        auto nowTimeT = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        std::tm local = *std::localtime(&nowTimeT);
+        return daysFromCivil(local.tm_year + 1900, static_cast<unsigned>(local.tm_mon + 1), static_cast<unsigned>(local.tm_mday)) * 1440
+            + local.tm_hour * 60 + local.tm_min;
+    }
+
+    // Restricts 'thread' to the CPU at position 'index' of 'cpus', taken round-robin, so consecutive threads
+    // of a pool spread over the list. Does nothing for an empty list or on platforms without thread affinity.
+    void pinThread(std::thread& thread, const std::vector<int>& cpus, size_t index)
+    {
+        if (cpus.empty()) return;
+        int cpu = cpus[index % cpus.size()];
+        if (cpu < 0) return;
+
+#if defined(_WIN32)
+        if (cpu < 64) SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+        if (cpu >= CPU_SETSIZE) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+        (void)thread;
+#endif
+    }
+}
 
 
 // ===============================================================================================================
@@ -14,17 +324,30 @@
 // ===============================================================================================================
 
 
+// Constructor for the DICOM Worklist SCP server with the default options (data folder "./worklist/", port 104).
+DICOMWorklistSCP::DICOMWorklistSCP()
+    : DICOMWorklistSCP(Options())
+{
+}
+
 // Constructor for the DICOM Worklist SCP server.
-// Initializes server status and ensures the worklist folder exists.
+// Applies the per-instance options, initializes server status and ensures the worklist folder exists.
 // Also triggers dataset loading from disk to prepare in-memory cache.
-DICOMWorklistSCP::DICOMWorklistSCP()
-    : serverStatus_{}
+DICOMWorklistSCP::DICOMWorklistSCP(const Options& options)
+    : serverStatus_{}, options_(options)
 {
+    auto settings = std::make_shared<Settings>();
+    settings->port_ = options_.port_;
+    settings->aeTitle_ = options_.aeTitle_;
+    settings_ = std::move(settings);
+
+    datasets_.configure(options_);
     if (!std::filesystem::exists(datasets_.dataFolder_))
     {
         std::filesystem::create_directories(datasets_.dataFolder_);
     }
 
+    datasets_.wheel_.current_ = localMinutesNow();
     loadAllDatasets();
 }
 
@@ -37,12 +360,15 @@ DICOMWorklistSCP::~DICOMWorklistSCP()
     {
         stop();
     }
+
+    stopRetention();
 }
 
 // ------------------------------------------------ Configuration ------------------------------------------------
 
 // Sets the path to a DICOM dataset template file.
 // This template will be cloned into new datasets when calling addDataset().
+// The file is parsed right away into the in-memory prototype.
 // Returns true if the specified file exists; false otherwise.
 // Thread-safe and updates server status.
 bool DICOMWorklistSCP::setTemplateFile(const std::string& fileName) 
@@ -50,44 +376,190 @@ bool DICOMWorklistSCP::setTemplateFile(const std::string& fileName)
     std::lock_guard<std::mutex> lock(mutex_);
     ScopedStatus scoped(serverStatus_, "Template file setting");
     templateFile_ = fileName;
+    templatePrototype_ = nullptr;
+    templatePrototype();
     return std::filesystem::exists(templateFile_);
 }
 
+// Returns the current runtime settings. The returned object never changes; setSettings() publishes a new one.
+// Lock-free, so it can be called from any thread at any rate.
+std::shared_ptr<const DICOMWorklistSCP::Settings> DICOMWorklistSCP::getSettings() const
+{
+    return std::atomic_load(&settings_);
+}
+
+// Replaces the runtime settings without restarting the SCP.
+// Associations in progress keep the settings they were requested under; the next association picks up the new ones
+// (the listener applies AE title, PDU size and timeouts before it negotiates it).
+// If the port changes while the SCP is running, a new listener is opened on the new port first and the previous
+// one stops after its current association, so no association is refused in between.
+// Returns false if the settings are invalid or the new port cannot be opened; the previous settings then stay in effect.
+// Thread-safe and updates server status.
+bool DICOMWorklistSCP::setSettings(const Settings& settings)
+{
+    if (!validSettings(settings)) return false;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return applySettings(settings);
+}
+
+// Changes some of the runtime settings: 'edit' is called on a copy of the current settings, which then replace
+// them as with setSettings(). Copy, edit and replacement happen under the lock, so concurrent updates of
+// different fields do not overwrite each other. 'edit' must not call back into the SCP.
+// Returns false if the edited settings are invalid or the new port cannot be opened.
+// Thread-safe and updates server status.
+bool DICOMWorklistSCP::updateSettings(const std::function<void(Settings&)>& edit)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Settings settings = *getSettings();
+    edit(settings);
+    if (!validSettings(settings)) return false;
+    return applySettings(settings);
+}
+
+// Returns whether 'settings' can be applied: a port, an AE title of at most 16 characters,
+// a PDU length of at least 4096 bytes and no negative match limit.
+bool DICOMWorklistSCP::validSettings(const Settings& settings)
+{
+    if (settings.port_ == 0 || settings.aeTitle_.empty() || settings.aeTitle_.size() > 16) return false;
+    if (settings.maxReceivePDULength_ < 4096 || settings.maxMatches_ < 0) return false;
+    for (const auto& [aeTitle, maxMatches] : settings.maxMatchesByAE_)
+    {
+        if (maxMatches < 0) return false;
+    }
+    return true;
+}
+
+// Publishes 'settings' and moves the listener to a new port if it changed (see setSettings()).
+// The previous listener is woken up after it was told to stop, so it releases its port right away
+// instead of holding it until one more association arrives.
+// Must be called with mutex_ held.
+bool DICOMWorklistSCP::applySettings(const Settings& settings)
+{
+    ScopedStatus scoped(serverStatus_, "Settings change");
+
+    auto next = std::make_shared<const Settings>(settings);
+    const Uint16 previousPort = getSettings()->port_;
+    if (!serverStatus_.isRunning_ || next->port_ == previousPort)
+    {
+        std::atomic_store(&settings_, next);
+        return true;
+    }
+
+    auto listener = std::make_shared<Listener>(*this);
+    if (!openListener(*listener, *next))
+    {
+        serverStatus_.error(StatusError::Configuration, "Failed to listen on port " + std::to_string(next->port_));
+        return false;
+    }
+
+    std::atomic_store(&settings_, next);
+    runListener([listener]() { listener->acceptAssociations(); });
+    if (listener_)
+    {
+        listener_->stopRequested_ = true;
+    }
+    else
+    {
+        stopRequested_ = true;
+    }
+    wakeListener(previousPort);
+    listener_ = std::move(listener);
+    return true;
+}
+
+// Returns the parsed template dataset, or nullptr if no template is set or it cannot be loaded.
+// The template file is parsed once into an immutable prototype that new datasets share until they are modified.
+// It is only parsed again when its size or modification time changed since; Items still sharing
+// the previous prototype keep it alive. The file is checked at most once per TemplateCheckInterval,
+// so adding datasets costs no file system call; an edited template takes effect within that interval.
+// Must be called with mutex_ held.
+DICOMWorklistSCP::DatasetPtr DICOMWorklistSCP::templatePrototype()
+{
+    if (templateFile_.empty()) return nullptr;
+
+    auto now = std::chrono::steady_clock::now();
+    if (templatePrototype_ && now - templateChecked_ < TemplateCheckInterval)
+    {
+        return templatePrototype_;
+    }
+    templateChecked_ = now;
+
+    Uint64 size = 0, time = 0;
+    if (!fileStamp(templateFile_, size, time))
+    {
+        templatePrototype_ = nullptr;
+        return nullptr;
+    }
+
+    if (templatePrototype_ && size == templateSize_ && time == templateTime_)
+    {
+        return templatePrototype_;
+    }
+
+    DcmFileFormat fileformat;
+    if (fileformat.loadFile(templateFile_.c_str()).bad())
+    {
+        templatePrototype_ = nullptr;
+        return nullptr;
+    }
+
+    templatePrototype_ = DatasetPtr(new SharedDataset(*fileformat.getDataset()));
+    templateSize_ = size;
+    templateTime_ = time;
+    return templatePrototype_;
+}
+
 // ---------------------------------------------- Dataset management ---------------------------------------------
 
 // Adds a new dataset to the internal worklist.
-// If a template file is set via setTemplateFile(), its contents will be cloned into the new dataset.
-// The newly added dataset is marked as dirty and assigned a unique index, returned via the output parameter.
+// If a template file is set via setTemplateFile(), the new dataset shares the cached template prototype
+// and is copied from it only when it is modified for the first time.
+// The newly added dataset is marked as dirty and assigned a unique handle, returned via the output parameter.
 // Thread-safe and updates SCP status for processing.
-bool DICOMWorklistSCP::addDataset(int* index)
+bool DICOMWorklistSCP::addDataset(Handle* handle)
 {
+    if (!handle) return false;
+
     std::lock_guard<std::mutex> lock(mutex_);
     ScopedStatus scoped(serverStatus_, "Adding a dataset");
 
-    auto newDataset = std::make_shared<DcmDataset>();
-    if (!templateFile_.empty())
-    {
-        DcmFileFormat fileformat;
-        if (fileformat.loadFile(templateFile_.c_str()).good())
-        {
-            *newDataset = *fileformat.getDataset();
-        }
-    }
+    datasets_.addCopies(templatePrototype(), 1, handle);
+    publishChanges();
+    return true;
+}
+
+// Adds 'count' new datasets to the internal worklist in one step, e.g. for the schedule of a whole day.
+// Every dataset shares the template prototype like in addDataset(). All datasets are published
+// under a single lock with a single generation increment, so C-FIND never sees part of the batch.
+// The assigned handles are written to 'handles', which must hold 'count' entries.
+// Returns false if the parameters are invalid.
+// Thread-safe and updates SCP status for processing.
+bool DICOMWorklistSCP::addDatasets(int count, Handle* handles)
+{
+    if (count <= 0 || !handles) return false;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Adding datasets");
 
-    *index = datasets_.add(newDataset);
+    datasets_.addCopies(templatePrototype(), count, handles);
+    publishChanges();
     return true;
 }
 
-// Deletes a dataset from the internal worklist by index.
-// Also removes the associated DICOM file from disk and frees the index for reuse.
+// Deletes a dataset from the internal worklist by handle.
+// Also removes the associated DICOM file from disk and invalidates the handle; its slot is reused under a new generation.
 // Returns true if deletion was successful.
 // Thread-safe and updates SCP status
-bool DICOMWorklistSCP::deleteDataset(int index)
+bool DICOMWorklistSCP::deleteDataset(Handle handle)
 {
     std::lock_guard<std::mutex> lock(mutex_);
     ScopedStatus scoped(serverStatus_, "Deleting a dataset");
 
-    return datasets_.remove(index);
+    if (!datasets_.remove(handle)) return false;
+
+    publishChanges();
+    return true;
 }
 
 // Retrieves the total number of datasets currently stored in the worklist.
@@ -104,20 +576,51 @@ bool DICOMWorklistSCP::getDatasetCount(int* count) const
     return true;
 }
 
-// Retrieves the dataset stored under the specified index from the internal worklist.
-// Returns a shared pointer to the DcmDataset if the index exists; otherwise, returns nullptr.
+// Retrieves the dataset stored under the specified handle from the internal worklist.
+// Returns a reference-counted pointer to the dataset if the handle is valid; otherwise, returns nullptr.
+// Datasets still sharing the template prototype are copied first, and compact items are materialized
+// as a dataset until the host releases the pointer; reading through getString() or a read guard avoids both.
 // The caller must check the returned pointer before usage.
 // Thread-safe and updates SCP status for tracking.
-std::shared_ptr<DcmDataset> DICOMWorklistSCP::getDataset(int index) const
+DICOMWorklistSCP::DatasetPtr DICOMWorklistSCP::getDataset(Handle handle)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Getting dataset");
+
+    // The host may modify the returned dataset, so an Item still sharing the template gets its own copy first
+    if (!datasets_.materialize(handle)) return nullptr;
+    return datasets_[handle]->dataset_;
+}
+
+// Retrieves the dataset stored under the specified handle like getDataset(), but as a plain pointer for hosts
+// that cannot hold a DatasetPtr, such as callers of the C interface. The Item is pinned: it is not packed into
+// compact form, so the pointer stays valid across edits, markDatasetDirty() and saves until releaseDataset()
+// is called or the dataset is deleted.
+// Returns nullptr if the handle is stale.
+// Thread-safe and updates SCP status for tracking.
+DcmDataset* DICOMWorklistSCP::pinDataset(Handle handle)
 {
     std::lock_guard<std::mutex> lock(mutex_);
     ScopedStatus scoped(serverStatus_, "Getting dataset");
-    auto item = datasets_[index];
-    return item ? item->dataset_ : nullptr;
+    return datasets_.pin(handle);
+}
+
+// Releases a dataset pointer obtained from pinDataset(); the pointer must not be used afterwards.
+// A compact item is packed again right away.
+// Returns false if the handle is stale.
+// Thread-safe and updates SCP status for tracking.
+bool DICOMWorklistSCP::releaseDataset(Handle handle)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Releasing dataset");
+    if (!datasets_.unpin(handle)) return false;
+
+    datasets_.packPending();
+    return true;
 }
 
 // Clears the entire dataset worklist, removing all loaded datasets from memory and deleting their associated DICOM files from disk.
-// Frees all indexes and resets the internal state.
+// Invalidates all handles and resets the internal state.
 // Returns true on successful completion.
 // Thread-safe and updates SCP status.
 // !! This operation is destructive and cannot be reversed.
@@ -126,533 +629,4402 @@ bool DICOMWorklistSCP::clearAllDatasets()
     std::lock_guard<std::mutex> lock(mutex_);
     ScopedStatus scoped(serverStatus_, "Clearing the list");
     datasets_.clear(serverStatus_);
+    publishChanges();
     return true;
 }
 
-// ---------------------------------------------- Lifecycle control ----------------------------------------------
-
-// Starts the DICOM Worklist SCP server instance.
-// Configures network parameters, transfer syntax, and presentation contexts needed for DICOM association negotiation.
-// Opens the listening port and spawns a background thread to accept incoming DICOM associations.
-// If the server is already running, returns true immediately.
-// Updates server status to reflect activity (via ScopedStatus) and sets running flag.
-// Returns true if listening started successfully; false otherwise.
-// Thread-safe thanks to locking via std::mutex.
-bool DICOMWorklistSCP::start()
+// Opens a tracked edit session for the dataset stored under the specified handle.
+// The session holds a private copy of the dataset which the host may modify freely without locking,
+// while C-FIND processing keeps reading the published dataset.
+// Returns nullptr if the handle is not valid.
+// Thread-safe and updates SCP status for tracking.
+std::unique_ptr<DICOMWorklistSCP::EditSession> DICOMWorklistSCP::beginEdit(Handle handle) const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ScopedStatus scoped(serverStatus_, "Starting");
-
-    if (serverStatus_.isRunning_)
+    auto session = std::make_unique<EditSession>();
     {
-        return true;
+        std::lock_guard<std::mutex> lock(mutex_);
+        ScopedStatus scoped(serverStatus_, "Opening edit session");
+        auto item = datasets_[handle];
+        if (!item) return nullptr;
+
+        // Compact items are decoded straight into the working copy
+        DcmDataset* dataset = datasets_.view(*item, session->dataset_);
+        if (!dataset) return nullptr;
+
+        session->handle_ = handle;
+        if (dataset != &session->dataset_) session->dataset_ = *dataset;
     }
 
-    setPort(104);
-    setAETitle("WORKLIST_SCP");
-    setMaxReceivePDULength(16384);
-    setConnectionTimeout(30);
-    setDIMSETimeout(30);
-    setACSETimeout(30);
+    DatasetCodec::fingerprintAll(session->dataset_, session->baseline_);
+    return session;
+}
 
-    OFList<OFString> syntaxes;
-    syntaxes.push_back(UID_LittleEndianImplicitTransferSyntax);
-    addPresentationContext(UID_FINDModalityWorklistInformationModel, syntaxes);
+// Publishes the changes of an edit session.
+// The elements modified, added or removed in the session are detected by comparing fingerprints
+// with the state at beginEdit(); only those elements are applied to the worklist item, so concurrent
+// sessions on other elements of the same item do not overwrite each other.
+// If anything changed, the item is marked dirty and the worklist generation is incremented.
+// A session without changes costs no lock round-trip, no dirty flag and no I/O.
+// The modification state is returned via the optional output parameter 'modified'.
+// Returns false if the session is invalid or its item was deleted in the meantime.
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::commitEdit(std::unique_ptr<EditSession> session, bool* modified)
+{
+    if (modified) *modified = false;
+    if (!session) return false;
 
+    std::vector<Uint32> changed, removed;
+    if (!diffEdit(*session, changed, removed)) return true;
 
-    // Begin listening for incoming DICOM associations using configured parameters
-    OFCondition status = openListenPort();
-    if (status.good())
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Committing edit session");
+    if (!datasets_.applyChanges(session->handle_, session->dataset_, changed, removed)) return false;
+
+    publishChanges();
+    if (modified) *modified = true;
+    return true;
+}
+
+// Discards an edit session without touching the worklist item.
+void DICOMWorklistSCP::cancelEdit(std::unique_ptr<EditSession> session)
+{
+    session.reset();
+}
+
+// Detects the top-level elements modified, added or removed in an edit session
+// by comparing their fingerprints with the state at beginEdit().
+// Returns true if anything changed.
+bool DICOMWorklistSCP::diffEdit(EditSession& session, std::vector<Uint32>& changed, std::vector<Uint32>& removed)
+{
+    std::unordered_map<Uint32, Uint64> current;
+    DatasetCodec::fingerprintAll(session.dataset_, current);
+
+    for (const auto& [tag, fingerprint] : current)
     {
-        std::thread([this]() 
-            {
-                acceptAssociations();
-            }).detach();
-        serverStatus_.isRunning_ = true;
-        scoped.changeStatus("Listening");
-        return true;
+        auto it = session.baseline_.find(tag);
+        if (it == session.baseline_.end() || it->second != fingerprint)
+        {
+            changed.push_back(tag);
+        }
     }
-    else
+
+    for (const auto& [tag, fingerprint] : session.baseline_)
     {
-        return false;
+        if (current.find(tag) == current.end())
+        {
+            removed.push_back(tag);
+        }
     }
+
+    return !changed.empty() || !removed.empty();
 }
 
-// Stops the DICOM Worklist SCP server gracefully.
-// If the server is not running, returns true immediately.
-// Otherwise, terminates listening by completing the current association.
-// Sets server status to "Idle" and marks the instance as inactive.
-// Thread-safe and designed to be safely called multiple times.
-bool DICOMWorklistSCP::stop()
+// Opens an empty batch. Mutations are collected via batchAddDatasets(), batchDeleteDataset()
+// and batchEditDataset() without touching the worklist, and applied by commitBatch().
+std::unique_ptr<DICOMWorklistSCP::Batch> DICOMWorklistSCP::beginBatch() const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ScopedStatus scoped(serverStatus_, "Stopping", "Idle");
-
-    if (!serverStatus_.isRunning_)
-        return true;
-
-    stopAfterCurrentAssociation();
+    return std::make_unique<Batch>();
+}
 
-    serverStatus_.isRunning_ = false;
+// Schedules 'count' new datasets cloned from the template to be added by the batch.
+// Their handles are assigned on commit. Returns false if 'count' is not positive.
+bool DICOMWorklistSCP::batchAddDatasets(Batch& batch, int count) const
+{
+    if (count <= 0) return false;
+    batch.addCount_ += count;
     return true;
 }
 
-// Retrieves the current status of the SCP server as a human-readable string.
-// The result includes running state, request count, and descriptive status.
-// The status string is written into the output parameter.
-// Thread-safe and suitable for external logging or monitoring tools.
-bool DICOMWorklistSCP::getStatus(std::string& status)
+// Schedules the dataset stored under the specified handle to be deleted by the batch.
+// The handle is validated on commit.
+bool DICOMWorklistSCP::batchDeleteDataset(Batch& batch, Handle handle) const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    status = serverStatus_.ToString();
+    batch.deletes_.push_back(handle);
     return true;
 }
 
-// ------------------------------------------------ Saving logic -------------------------------------------------
+// Opens an edit session for the dataset stored under the specified handle as part of the batch.
+// The host modifies the dataset_ of the returned session, which stays owned by the batch.
+// Datasets added by the same batch cannot be edited, as their handles are only assigned on commit.
+// Returns nullptr if the handle is not valid.
+DICOMWorklistSCP::EditSession* DICOMWorklistSCP::batchEditDataset(Batch& batch, Handle handle) const
+{
+    auto session = beginEdit(handle);
+    if (!session) return nullptr;
 
-// Marks the dataset associated with the given index as "dirty",
-// indicating that it has been modified and should be saved to disk.
-// Integrates with saveDirtyDatasets() to optimize file I/O.
+    batch.edits_.push_back(std::move(session));
+    return batch.edits_.back().get();
+}
+
+// Applies all mutations of a batch atomically: edits first, then deletes, then adds.
+// The edits are diffed before the lock is taken; everything else happens under a single lock acquisition,
+// so C-FIND sees either none or all of the batch. The batch is rejected as a whole, without any change,
+// if it is invalid or an edited or deleted dataset no longer exists.
+// All edited and added datasets are saved in one group commit; in delta mode their changes are appended
+// to the log with a single write. The changes and the save are published under a single new generation.
+// The handles of the added datasets are returned via the optional output parameter 'addedHandles'
+// whenever the batch was applied, also if saving failed.
 // Thread-safe and updates SCP processing status.
-bool DICOMWorklistSCP::markDatasetDirty(int index)
+DICOMWorklistSCP::CommitResult DICOMWorklistSCP::commitBatch(std::unique_ptr<Batch> batch, std::vector<Handle>* addedHandles)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ScopedStatus scoped(serverStatus_, "Marking dataset as dirty");
-    return datasets_.markDatasetDirty(index);
-}
+    if (addedHandles) addedHandles->clear();
+    if (!batch) return CommitResult::Rejected;
+
+    struct Change
+    {
+        EditSession* session_;
+        std::vector<Uint32> changed_;
+        std::vector<Uint32> removed_;
+    };
+
+    std::vector<Change> changes;
+    for (auto& session : batch->edits_)
+    {
+        Change change{ session.get(), {}, {} };
+        if (diffEdit(*session, change.changed_, change.removed_))
+        {
+            changes.push_back(std::move(change));
+        }
+    }
+
+    std::vector<Handle> deletes = batch->deletes_;
+    std::sort(deletes.begin(), deletes.end());
+    deletes.erase(std::unique(deletes.begin(), deletes.end()), deletes.end());
 
-// Saves all datasets in the worklist that are marked as "dirty" (i.e., modified but not yet saved).
-// This function avoids rewriting unchanged files and improves storage efficiency.
-// Internally calls Worklist::saveDirtyDatasetsInFile().
-// Thread-safe and updates server processing status.
-bool DICOMWorklistSCP::saveDirtyDatasets()
-{
     std::lock_guard<std::mutex> lock(mutex_);
-    ScopedStatus scoped(serverStatus_, "Saving dirty datasets");
-    return datasets_.saveDirtyDatasetsInFile(serverStatus_);
+    ScopedStatus scoped(serverStatus_, "Committing batch");
+
+    for (const auto& change : changes)
+    {
+        if (!datasets_[change.session_->handle_]) return CommitResult::Rejected;
+    }
+    for (Handle handle : deletes)
+    {
+        if (!datasets_[handle]) return CommitResult::Rejected;
+    }
+
+    if (changes.empty() && deletes.empty() && batch->addCount_ == 0) return CommitResult::Committed;
+
+    std::vector<Handle> touched;
+    for (const auto& change : changes)
+    {
+        datasets_.applyChanges(change.session_->handle_, change.session_->dataset_, change.changed_, change.removed_);
+        touched.push_back(change.session_->handle_);
+    }
+
+    for (Handle handle : deletes)
+    {
+        datasets_.remove(handle);
+    }
+
+    std::vector<Handle> added(batch->addCount_);
+    if (!added.empty())
+    {
+        datasets_.addCopies(templatePrototype(), batch->addCount_, added.data());
+        touched.insert(touched.end(), added.begin(), added.end());
+    }
+
+    if (addedHandles) addedHandles->swap(added);
+
+    bool saved = datasets_.saveDatasetsInFile(touched, serverStatus_);
+    publishChanges();
+    return saved ? CommitResult::Committed : CommitResult::SaveFailed;
 }
 
-// Saves the dataset at the specified index to disk.
-// Intended for precise control over individual dataset updates, avoiding bulk saves.
-// Internally delegates to Worklist::saveDatasetInFile().
-// Thread-safe and updates SCP processing status.
-bool DICOMWorklistSCP::saveDataset(int index)
+// Discards a batch without touching the worklist, including all of its edit sessions.
+void DICOMWorklistSCP::rollbackBatch(std::unique_ptr<Batch> batch)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ScopedStatus scoped(serverStatus_, "Saving a dataset by index");
-    return datasets_.saveDatasetInFile(index, serverStatus_);
+    batch.reset();
 }
 
-// Saves all datasets currently stored in the worklist to disk, regardless of their modification state.
-// This method ensures complete synchronization between memory and persistent storage.
-// All datasets, including unmodified ones, are overwritten, and their dirty flags reset.
-// Thread-safe and updates SCP processing status.
-bool DICOMWorklistSCP::saveAllDatasets()
+// Retrieves the current generation of the worklist via the output parameter 'generation'.
+// The generation is incremented whenever items are added, removed, cleared, marked dirty, edited or saved,
+// so hosts can detect changes by comparing two values.
+// Returns true if the parameter is valid; false otherwise.
+// Thread-safe.
+bool DICOMWorklistSCP::getGeneration(Uint64* generation) const
 {
+    if (!generation) return false;
     std::lock_guard<std::mutex> lock(mutex_);
-    ScopedStatus scoped(serverStatus_, "Saving all datasets");
-    return datasets_.saveAllDatasetsInFile(serverStatus_);
+    *generation = datasets_.generation_;
+    return true;
 }
 
-// Loads all datasets from the data folder into memory.
-// Each valid DICOM file is parsed, wrapped as an internal Item, and indexed in the worklist.
-// If any files fail to load, they are skipped and a warning is logged.
-// Thread-safe and updates server status during processing.
-bool DICOMWorklistSCP::loadAllDatasets()
+// Copies the change events published after generation 'since' into 'events', which holds 'capacity' entries,
+// oldest first. 'count' receives the number of copied events and 'generation' the generation they lead up to,
+// which is passed as 'since' to the next call. If the events do not fit, only complete generations are copied
+// and 'generation' is set accordingly, so the next call continues where this one stopped.
+// 'resync' is set if events after 'since' have already been overwritten in the ring (or 'since' stems from
+// another session); the host must then reload the whole list, e.g. with listDatasets(), and continue from 'generation'.
+// Returns false if the parameters are invalid. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::getChanges(Uint64 since, ChangeEvent* events, int capacity, int* count, Uint64* generation, bool* resync) const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ScopedStatus scoped(serverStatus_, "Loading all datasets from file");
+    if (!events || capacity <= 0 || !count || !generation || !resync) return false;
 
-    return datasets_.loadAllDatasets(serverStatus_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Getting changes");
+    datasets_.changesSince(since, events, capacity, *count, *generation, *resync);
+    return true;
 }
 
-    
-// ===============================================================================================================
-// ========================================== DICOMWorklistSCP::SCPStatus ========================================
-// ===============================================================================================================
+// Blocks until the generation of the worklist differs from 'since' or 'timeoutMs' milliseconds have passed;
+// a negative timeout waits without limit. The current generation is written to 'generation' if given.
+// Returns true if the generation changed, false on timeout.
+// Thread-safe; the lock is not held while waiting.
+bool DICOMWorklistSCP::waitForChanges(Uint64 since, int timeoutMs, Uint64* generation) const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto changed = [&]() { return datasets_.generation_ != since; };
 
+    bool result = true;
+    if (timeoutMs < 0)
+    {
+        changeWakeup_.wait(lock, changed);
+    }
+    else
+    {
+        result = changeWakeup_.wait_for(lock, std::chrono::milliseconds(timeoutMs), changed);
+    }
 
-// Constructs a new SCPStatus object to represent the servers runtime state.
-// Tracks whether the server is running, how many DIMSE requests were processed,
-// a human-readable status message, and a cumulative error log.
-// Used for diagnostics, logging, and external status querying.
-DICOMWorklistSCP::SCPStatus::SCPStatus(bool isRunning, int requestCount, std::string statusText, std::string lastErrors)
-{
-    isRunning_ = isRunning;
-    requestCount_ = requestCount;
-    statusText_ = statusText;
-    lastErrors_ = lastErrors;
+    if (generation) *generation = datasets_.generation_;
+    return result;
 }
 
-// Returns a formatted string summarizing the server status.
-// Includes whether the server is running, the total number of DIMSE requests,
-// current status text, and accumulated error messages.
-// Clears the error log after reporting, ensuring fresh status output on next call.
-// Useful for external monitoring tools, GUI status panels, or logging.
-std::string DICOMWorklistSCP::SCPStatus::ToString()
+// Publishes the change events recorded since the last call under a new generation
+// and wakes up all threads blocked in waitForChanges(). Does nothing if no events were recorded.
+// Compact items materialized for the published changes are packed again first.
+// Must be called with mutex_ held.
+void DICOMWorklistSCP::publishChanges()
 {
-    std::ostringstream ss;
-    ss 
-        << "Running: " << (isRunning_ ? "true" : "false")
-        << "\n Requests: " << requestCount_
-        << "\n State: " << statusText_
-        << "\n Last Errors: " << (lastErrors_.empty() ? "None" : lastErrors_);
-    lastErrors_ = "";
-    return ss.str();
+    datasets_.packPending();
+    if (!datasets_.changesPending_) return;
+
+    datasets_.changesPending_ = false;
+    datasets_.generation_++;
+    serverStatus_.generation_ = datasets_.generation_;
+    serverStatus_.datasetCount_ = datasets_.count();
+    serverStatus_.signal();
+    changeWakeup_.notify_all();
 }
 
-// Adds a new error message to the SCPs cumulative error log.
-// Each message is prefixed with a timestamp in local time (HH:MM:SS format).
-// Messages are stored and included in the next call to ToString(), then cleared.
-// Allows chronological tracking of multiple errors during runtime.
-void DICOMWorklistSCP::SCPStatus::error(const std::string& message)
+// ----------------------------------------------- Attribute access ----------------------------------------------
+
+// Resolves 'path' in the dataset at the given handle and calls 'read' with the item holding the addressed
+// attribute and its tag, all under the lock.
+// Returns false if the handle is stale, the path is malformed or leads through a missing sequence item,
+// or 'read' fails.
+template <typename Read>
+bool DICOMWorklistSCP::readAttribute(Handle handle, const char* path, const char* action, Read read) const
 {
-    auto now = std::chrono::system_clock::now();
-    auto nowTimeT = std::chrono::system_clock::to_time_t(now);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, action);
 
-    std::stringstream ss;
-    ss << std::put_time(std::localtime(&nowTimeT), "%H:%M:%S");
-    lastErrors_ += "\n\t" + ss.str() + " Error: " + message;
+    auto item = datasets_[handle];
+    if (!item) return false;
+
+    // A materialized item is read in place. Of a compact item, only the top-level element holding the attribute
+    // is decoded, into the scratch dataset of the instance
+    DcmDataset* dataset = item->dataset_.get();
+    if (!dataset)
+    {
+        readTags_.clear();
+        CompactItem::tagsOf(&path, 1, readTags_);
+        dataset = datasets_.view(*item, readScratch_, &readTags_);
+    }
+    if (!dataset) return false;
+
+    DcmItem* parent = nullptr;
+    DcmTagKey tag;
+    if (!AttributePath::resolve(*dataset, path, false, parent, tag)) return false;
+    return read(*parent, tag);
 }
 
+// Resolves 'path' like readAttribute(), creating missing sequences and items along it if 'create' is set,
+// and calls 'write' to modify the attribute. If 'write' succeeds, the Item is marked dirty, its query index
+// entries and expiry are refreshed and the generation is incremented, all under the same lock,
+// so C-FIND sees either the old or the new value.
+template <typename Write>
+bool DICOMWorklistSCP::writeAttribute(Handle handle, const char* path, bool create, const char* action, Write write)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, action);
 
-// ===============================================================================================================
-// ========================================= DICOMWorklistSCP::ScopedStatus ======================================
-// ===============================================================================================================
+    DcmDataset* dataset = datasets_.materialize(handle);
+    if (!dataset) return false;
 
+    DcmItem* parent = nullptr;
+    DcmTagKey tag;
+    if (!AttributePath::resolve(*dataset, path, create, parent, tag)) return false;
+    if (!write(*parent, tag)) return false;
 
-// Constructs a scoped status modifier for the SCP server.
-// Sets the status text to indicate ongoing processing (with optional action name),
-// and increments the request counter.
-// Stores the previous status text for automatic restoration on scope exit.
-// Designed for RAII-based status tracking during operations.
-DICOMWorklistSCP::ScopedStatus::ScopedStatus(
-    DICOMWorklistSCP::SCPStatus& status, 
-    const std::string& actionName, 
-    const std::string& finalStatusText)
-    : status_(status), previousStatusText_(status.statusText_), finalStatusText_(finalStatusText)
-{
-    status_.statusText_ = actionName == "" ? "Processing" : "Processing: " + actionName;
+    datasets_.markDatasetDirty(handle);
+    publishChanges();
+    return true;
 }
 
-// Updates the final status text that will be applied upon scope exit.
-// Useful for reflecting operation results or error conditions in the SCP status log.
-void DICOMWorklistSCP::ScopedStatus::changeStatus(const std::string& finalStatusText)
+// Copies the value of the string attribute at 'path' into 'buffer', which holds 'size' characters including
+// the terminating zero. Multiple values are returned separated by backslashes.
+// The value is copied straight from the dataset under the lock, without intermediate strings. A compact item
+// only has the element holding the attribute decoded, into a scratch dataset reused across calls.
+// 'length' receives the value length without the terminator, also if the buffer is too small,
+// so the caller can retry with a larger one.
+// Returns false if the attribute does not exist, is not a string, or does not fit into the buffer.
+// Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::getString(Handle handle, const char* path, char* buffer, size_t size, size_t* length) const
 {
-    finalStatusText_ = finalStatusText;
-}
+    if (!buffer && size > 0) return false;
 
-// Destructor that restores the SCP status text upon scope exit.
-// If a custom final status was provided via changeStatus(), it is applied.
-// Otherwise, the previous status text is restored.
-// Enables automatic and consistent status tracking through RAII.
-DICOMWorklistSCP::ScopedStatus::~ScopedStatus()
-{
-    status_.statusText_ = finalStatusText_ == "None" ? previousStatusText_ : finalStatusText_;
-}
+    return readAttribute(handle, path, "Getting attribute", [&](DcmItem& parent, const DcmTagKey& tag)
+    {
+        const char* value = AttributePath::stringValue(parent, tag);
+        if (!value) return false;
 
+        size_t valueLength = strlen(value);
+        if (length) *length = valueLength;
+        if (valueLength >= size) return false;
 
-// ===============================================================================================================
-// =========================================== DICOMWorklistSCP::Worklist ========================================
-// ===============================================================================================================
+        if (valueLength > 0) memcpy(buffer, value, valueLength);
+        buffer[valueLength] = '\0';
+        return true;
+    });
+}
 
+// Sets the attribute at 'path' to the given string value, creating it and any missing sequences
+// and items along the path. Multiple values are separated by backslashes.
+// The VR is taken from the data dictionary.
+// Returns true on success. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::setString(Handle handle, const char* path, const char* value)
+{
+    if (!value) return false;
 
-// ---------------------------------------------- Dataset management ---------------------------------------------
+    return writeAttribute(handle, path, true, "Setting attribute", [&](DcmItem& parent, const DcmTagKey& tag)
+    {
+        return parent.putAndInsertString(DcmTag(tag), value).good();
+    });
+}
 
-// Loads all DICOM dataset files from the configured data folder into memory.
-// Each valid file is parsed into a DcmDataset, wrapped into an Item object,
-// assigned a unique index, and inserted into the internal worklist map.
-// If loading fails for a file, an error message is reported via SCPStatus,
-// including the file name and timestamp.  
-// Returns true if at least one dataset was successfully loaded; false otherwise.
-bool DICOMWorklistSCP::Worklist::loadAllDatasets(SCPStatus& serverStatus)
+// Retrieves the first value of the integer attribute at 'path' (VR IS, SL, SS, UL or US) via 'value'.
+// Returns false if the attribute does not exist, is empty or has another VR.
+// Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::getInt(Handle handle, const char* path, Sint32* value) const
 {
-    using namespace std::filesystem;
-    int loadedCount = 0;
+    if (!value) return false;
 
-    for (const auto& entry : directory_iterator(dataFolder_))
+    return readAttribute(handle, path, "Getting attribute", [&](DcmItem& parent, const DcmTagKey& tag)
     {
-        if (!entry.is_regular_file()) continue;
+        long int result = 0;
+        if (parent.findAndGetLongInt(tag, result).bad()) return false;
+        *value = static_cast<Sint32>(result);
+        return true;
+    });
+}
 
-        std::string path = entry.path().string();
-        std::string fileName = entry.path().filename().string();
+// Sets the integer attribute at 'path', creating it and any missing sequences and items along the path.
+// The attribute must have VR IS, SL, SS, UL or US in the data dictionary, and the value must fit its range.
+// Returns true on success. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::setInt(Handle handle, const char* path, Sint32 value)
+{
+    DcmTagKey key;
+    if (!AttributePath::target(path, key)) return false;
 
-        std::shared_ptr<DcmDataset> dataset = std::make_shared<DcmDataset>();
-        OFCondition status = dataset->loadFile(path.c_str());
+    DcmEVR vr = DcmTag(key).getEVR();
+    bool fits = (vr == EVR_IS || vr == EVR_SL)
+        || (vr == EVR_UL && value >= 0)
+        || (vr == EVR_SS && value >= -32768 && value <= 32767)
+        || (vr == EVR_US && value >= 0 && value <= 65535);
+    if (!fits) return false;
 
-        if (status.good())
+    return writeAttribute(handle, path, true, "Setting attribute", [&](DcmItem& parent, const DcmTagKey& tag)
+    {
+        DcmTag dcmTag(tag);
+        switch (vr)
         {
-            Item* item = new Item(dataset, fileName, false);
-            int id = getFreeIndex();
-            indexMap_[id] = item;
-            loadedCount++;
-        }
-        else
+        case EVR_IS:
         {
-            serverStatus.error("[Worklist] Failed to load: " + fileName);
+            char text[16];
+            snprintf(text, sizeof(text), "%d", static_cast<int>(value));
+            return parent.putAndInsertString(dcmTag, text).good();
         }
-    }
-
-    return loadedCount > 0;
+        case EVR_SL:
+            return parent.putAndInsertSint32(dcmTag, value).good();
+        case EVR_UL:
+            return parent.putAndInsertUint32(dcmTag, static_cast<Uint32>(value)).good();
+        case EVR_SS:
+            return parent.putAndInsertSint16(dcmTag, static_cast<Sint16>(value)).good();
+        default:
+            return parent.putAndInsertUint16(dcmTag, static_cast<Uint16>(value)).good();
+        }
+    });
 }
 
-// Adds a new DICOM dataset to the worklist.
-// Wraps the dataset into an Item with a generated filename and marks it as dirty.
-// Assigns a unique index and stores the Item in the internal map.
-// Returns the assigned index of the newly added dataset.
-int DICOMWorklistSCP::Worklist::add(std::shared_ptr<DcmDataset> dataset)
+// Retrieves the date attribute at 'path' (format YYYYMMDD) split into year, month and day.
+// Returns false if the attribute does not exist or does not start with a valid date.
+// Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::getDate(Handle handle, const char* path, int* year, int* month, int* day) const
 {
-    Item* newItem = new Item(dataset, newFileName(), true);
-    int index = getFreeIndex();
-    indexMap_[index] = newItem;
-    return index;
-}
+    if (!year || !month || !day) return false;
 
-// Removes the dataset associated with the given index from the worklist.
-// If the dataset file exists on disk, it is deleted.
-// The Item object is deallocated, and its index is returned to the reusable pool.
-// Returns true if the index existed and was successfully removed; false otherwise.
-bool DICOMWorklistSCP::Worklist::remove(int index)
-{
-    auto it = indexMap_.find(index);
-    if (it != indexMap_.end())
+    return readAttribute(handle, path, "Getting attribute", [&](DcmItem& parent, const DcmTagKey& tag)
     {
-        Item* item = it->second;
-        if (item)
+        const char* value = nullptr;
+        if (parent.findAndGetString(tag, value).bad() || !value || strlen(value) < 8) return false;
+        for (int i = 0; i < 8; i++)
         {
-            std::string path = dataFolder_ + item->fileName_;
-            if (std::filesystem::exists(path))
-            {
-                std::filesystem::remove(path);
-            }
-
-            delete item;
+            if (value[i] < '0' || value[i] > '9') return false;
         }
 
-        indexMap_.erase(it);
-        freeIndexes_.insert(index);
-
+        auto number = [&](int pos, int digits)
+        {
+            int result = 0;
+            for (int i = pos; i < pos + digits; i++) result = result * 10 + (value[i] - '0');
+            return result;
+        };
+        *year = number(0, 4);
+        *month = number(4, 2);
+        *day = number(6, 2);
         return true;
-    }
-    return false;
+    });
 }
 
-// Returns the number of currently loaded datasets in the worklist.
-// Represents the size of the internal index map.
-// Useful for diagnostics, iteration, and external queries.
-int DICOMWorklistSCP::Worklist::count() const
+// Sets the date attribute (VR DA) at 'path', creating it and any missing sequences and items along the path.
+// Returns false if the attribute is not a date in the data dictionary or the date is out of range.
+// Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::setDate(Handle handle, const char* path, int year, int month, int day)
 {
-    return static_cast<int>(indexMap_.size());
+    DcmTagKey key;
+    if (!AttributePath::target(path, key) || DcmTag(key).getEVR() != EVR_DA) return false;
+    if (year < 0 || year > 9999 || month < 1 || month > 12 || day < 1 || day > 31) return false;
+
+    char text[16];
+    snprintf(text, sizeof(text), "%04d%02d%02d", year, month, day);
+
+    return writeAttribute(handle, path, true, "Setting attribute", [&](DcmItem& parent, const DcmTagKey& tag)
+    {
+        return parent.putAndInsertString(DcmTag(tag), text).good();
+    });
 }
 
-// Provides direct access to a worklist Item by index.
-// Returns a pointer to the Item if the index exists; nullptr otherwise.
-// Enables array-style lookup for simplified code usage.
-DICOMWorklistSCP::Worklist::Item* DICOMWorklistSCP::Worklist::operator[](int index) const
+// Retrieves the number of items of the sequence at 'path' via 'count'; a missing sequence has 0 items.
+// Returns false if the attribute exists but is not a sequence.
+// Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::getItemCount(Handle handle, const char* path, int* count) const
 {
-    auto it = indexMap_.find(index);
-    return (it != indexMap_.end()) ? it->second : nullptr;
+    if (!count) return false;
+
+    return readAttribute(handle, path, "Getting sequence", [&](DcmItem& parent, const DcmTagKey& tag)
+    {
+        *count = 0;
+        if (!parent.tagExists(tag)) return true;
+
+        DcmSequenceOfItems* sequence = nullptr;
+        if (parent.findAndGetSequence(tag, sequence).bad() || !sequence) return false;
+        *count = static_cast<int>(sequence->card());
+        return true;
+    });
 }
 
-// Clears the entire worklist, removing all loaded datasets from memory and disk.
-// For each Item, deletes the associated DICOM file if it exists. If deletion fails,
-// the error is reported via the provided SCPStatus object.
-// After cleanup, resets the internal index map and index reuse pool.
-void DICOMWorklistSCP::Worklist::clear(SCPStatus& serverStatus)
+// Appends an empty item to the sequence at 'path', creating the sequence and any missing sequences
+// and items along the path. The number of the new item is returned via 'index' if given;
+// its attributes are set with paths ending in "[index].gggg,eeee".
+// Returns true on success. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::addItem(Handle handle, const char* path, int* index)
 {
-    for (auto& [id, item] : indexMap_)
+    DcmTagKey key;
+    if (!AttributePath::target(path, key) || DcmTag(key).getEVR() != EVR_SQ) return false;
+
+    return writeAttribute(handle, path, true, "Adding sequence item", [&](DcmItem& parent, const DcmTagKey& tag)
     {
-        if (item)
+        DcmItem* added = nullptr;
+        DcmSequenceOfItems* sequence = nullptr;
+        if (parent.findOrCreateSequenceItem(DcmTag(tag), added, -2).bad()
+            || parent.findAndGetSequence(tag, sequence).bad() || !sequence)
         {
-            std::string path = dataFolder_ + item->fileName_;
-            if (std::filesystem::exists(path))
-            {
-                if (!std::filesystem::remove(path))
-                {
-                    serverStatus.error("Failed to remove file: " + item->fileName_);
-                }
-            }
-
-            delete item;
+            return false;
         }
-    }
 
-    indexMap_.clear();
-    freeIndexes_.clear();
+        if (index) *index = static_cast<int>(sequence->card()) - 1;
+        return true;
+    });
 }
 
-// ------------------------------------------------ Saving logic -------------------------------------------------
-
-// Marks the dataset at the given index as dirty, indicating it has been modified
-// and needs to be saved to disk.
-// Returns true if the index exists and the flag was successfully set; false otherwise.
-bool DICOMWorklistSCP::Worklist::markDatasetDirty(int index)
+// Deletes item number 'index' from the sequence at 'path'.
+// Returns false if the sequence or the item does not exist. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::deleteItem(Handle handle, const char* path, int index)
 {
-    Item* item = (*this)[index];
-    if (!item) return false;
+    if (index < 0) return false;
 
-    item->dirty_ = true;
-    return true;
+    return writeAttribute(handle, path, false, "Deleting sequence item", [&](DcmItem& parent, const DcmTagKey& tag)
+    {
+        return parent.findAndDeleteSequenceItem(tag, index).good();
+    });
 }
 
-// Saves the dataset associated with the given index to disk in explicit little-endian format.
-// If saving fails, an error message is reported via the provided SCPStatus object.
-// On success, the dataset is marked as not dirty.
-// Returns true if the save operation succeeded; false otherwise.
-bool DICOMWorklistSCP::Worklist::saveDatasetInFile(int index, SCPStatus& serverStatus)
+// ------------------------------------------------- Enumeration -------------------------------------------------
+
+// Visits all items of the worklist in one pass under a single lock.
+// For every item, 'visit' receives its handle and the string values of the attributes at 'paths'
+// (pathCount entries; "" for missing, empty or non-string attributes). The values point into the datasets
+// and are only valid during the call. Enumeration stops early when 'visit' returns false.
+// 'visit' runs under the lock and must not call back into the SCP.
+// The number of visited items is written to 'visited' if given.
+// Returns false if the parameters are invalid. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::enumerateDatasets(const char* const* paths, int pathCount, const std::function<bool(Handle, const char* const*)>& visit, int* visited) const
 {
-    Item* item = (*this)[index];
-    if (!item || !item->dataset_) return false;
+    if (pathCount < 0 || (pathCount > 0 && !paths) || !visit) return false;
 
-    std::string path = dataFolder_ + item->fileName_;
-    OFCondition status = item->dataset_->saveFile(path.c_str(), EXS_LittleEndianExplicit);
+    std::vector<const char*> values(pathCount);
+    int visitCount = 0;
 
-    if (status.good())
-    {
-        item->dirty_ = false;
-        return true;
-    }
-    else
-    {
-        serverStatus.error("Failed to save: " + item->fileName_);
-    }
-    return false;
-}
+    // Compact items are decoded one at a time, only the top-level elements the paths lead through
+    std::vector<Uint32> tags;
+    CompactItem::tagsOf(paths, pathCount, tags);
+    DcmDataset scratch;
 
-// Saves all datasets currently loaded in the worklist to disk using explicit little-endian encoding.
-// Each dataset is written to its assigned filename under the configured data folder.
-// If any save operation fails, an error message is reported via the provided SCPStatus object,
-// and the method returns false. Otherwise, returns true on complete success.
-bool DICOMWorklistSCP::Worklist::saveAllDatasetsInFile(SCPStatus& serverStatus)
-{
-    bool success = true;
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Enumerating datasets");
 
-    for (auto& [id, item] : indexMap_)
+    for (auto [handle, item] : datasets_)
     {
-        if (!item || !item->dataset_) continue;
+        DcmDataset* dataset = datasets_.view(*item, scratch, &tags);
+        if (!dataset) continue;
 
-        std::string path = dataFolder_ + item->fileName_;
-        OFCondition status = item->dataset_->saveFile(path.c_str(), EXS_LittleEndianExplicit);
-
-        if (status.good())
-        {
-            item->dirty_ = false;
-        }
-        else
+        for (int i = 0; i < pathCount; i++)
         {
-            serverStatus.error("Failed to save: " + item->fileName_);
-            success = false;
+            const char* value = AttributePath::stringValue(*dataset, paths[i]);
+            values[i] = value ? value : "";
         }
+
+        visitCount++;
+        if (!visit(handle, values.data())) break;
     }
 
-    return success;
+    if (visited) *visited = visitCount;
+    return true;
 }
 
-// Saves all dirty datasets (marked as modified) in the worklist to disk using explicit little-endian format.
-// Only Items with dirty_ == true are saved. If any save operation fails,
-// an error message is reported via the provided SCPStatus object,
-// and the method returns false. Otherwise, returns true on complete success.
-bool DICOMWorklistSCP::Worklist::saveDirtyDatasetsInFile(SCPStatus& serverStatus)
+// Copies the handles of all items into 'handles', which holds 'capacity' entries, in one pass under a single lock.
+// If 'paths' is given, the string values of the attributes at 'paths' are copied into 'values' as well,
+// pathCount fields of 'valueWidth' characters per item, zero-terminated and truncated to fit.
+// 'count' receives the total number of items, which may exceed 'capacity'; only the first 'capacity'
+// items are copied then. 'generation' receives the generation the copy reflects, so a host can skip
+// the next refresh if it has not changed.
+// Returns false if the parameters are invalid. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::listDatasets(Handle* handles, int capacity, int* count, const char* const* paths, int pathCount,
+    char* values, size_t valueWidth, Uint64* generation) const
 {
-    bool success = true;
+    if (!count || capacity < 0 || (capacity > 0 && !handles) || pathCount < 0) return false;
+    if (pathCount > 0 && (!paths || !values || valueWidth == 0)) return false;
 
-    for (auto& [id, item] : indexMap_)
-    {
-        if (!item || !item->dataset_ || !item->dirty_) continue;
+    std::vector<Uint32> tags;
+    CompactItem::tagsOf(paths, pathCount, tags);
+    DcmDataset scratch;
 
-        std::string path = dataFolder_ + item->fileName_;
-        OFCondition status = item->dataset_->saveFile(path.c_str(), EXS_LittleEndianExplicit);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Listing datasets");
 
-        if (status.good())
-        {
-            item->dirty_ = false;
-        }
-        else
+    int total = 0;
+    for (auto [handle, item] : datasets_)
+    {
+        if (!datasets_.present(*item)) continue;
+
+        if (total < capacity)
         {
-            serverStatus.error("Failed to save: " + item->fileName_);
-            success = false;
+            handles[total] = handle;
+            char* row = values + static_cast<size_t>(total) * pathCount * valueWidth;
+            DcmDataset* dataset = pathCount > 0 ? datasets_.view(*item, scratch, &tags) : nullptr;
+            for (int i = 0; i < pathCount; i++)
+            {
+                const char* value = dataset ? AttributePath::stringValue(*dataset, paths[i]) : nullptr;
+                size_t length = value ? std::min(strlen(value), valueWidth - 1) : 0;
+                char* field = row + i * valueWidth;
+                if (length > 0) memcpy(field, value, length);
+                field[length] = '\0';
+            }
         }
+        total++;
     }
 
-    return success;
+    *count = total;
+    if (generation) *generation = datasets_.generation_;
+    return true;
 }
 
-// ----------------------------------------------- DIMSE Handling ------------------------------------------------
+// --------------------------------------------------- Queries ---------------------------------------------------
 
-// Handles incoming DIMSE commands from the DICOM network association.
-// This method is invoked internally by the DcmSCP framework whenever a request is received.
-// Specifically detects C-FIND requests and sends a generic success response.
-// Serves as the primary entry point for DIMSE command processing (e.g., C-FIND Worklist queries).
-// To extend functionality, implement dataset matching, filtering, and dynamic responses here.
-// Returns OFCondition::good() if a valid response is sent; otherwise returns an error code.
-OFCondition DICOMWorklistSCP::handleIncomingCommand(
-    T_DIMSE_Message* incomingMsg,
-    const DcmPresentationContextInfo& presInfo)
+// Runs a C-FIND query against the worklist through the same query index and matcher that serve the modalities,
+// and streams every match to 'visit' together with the string values of the attributes at 'paths'
+// (see enumerateDatasets()). Items hidden by the retention policy never match.
+// Matching stops early when 'visit' returns false. 'visit' runs under the lock and must not call back into the SCP.
+// The number of visited matches is written to 'matches' if given.
+// Returns false if the parameters are invalid. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::findDatasets(DcmDataset& query, const char* const* paths, int pathCount, const std::function<bool(Handle, const char* const*)>& visit, int* matches) const
 {
-    serverStatus_.requestCount_++;
-    if (!incomingMsg)
-    {
-        return EC_IllegalCall;
-    }
+    if (pathCount < 0 || (pathCount > 0 && !paths) || !visit) return false;
 
-    if (incomingMsg->CommandField == DIMSE_C_FIND_RQ)
-    {
-        T_DIMSE_C_FindRQ& request = incomingMsg->msg.CFindRQ;
+    std::vector<const char*> values(pathCount);
+    std::vector<Uint32> tags;
+    CompactItem::tagsOf(paths, pathCount, tags);
 
-        T_DIMSE_Message response;
-        response.CommandField = DIMSE_C_FIND_RSP;
-        response.msg.CFindRSP.MessageIDBeingRespondedTo = request.MessageID;
-        response.msg.CFindRSP.DimseStatus = STATUS_Success;
-        response.msg.CFindRSP.DataSetType = DIMSE_DATASET_NULL;
-        strcpy(response.msg.CFindRSP.AffectedSOPClassUID, request.AffectedSOPClassUID);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Finding datasets");
 
-        return sendDIMSEMessage(
-            presInfo.presentationContextID,
-            &response,
-            nullptr,
-            nullptr,
-            nullptr);
-    }
+    int matched = datasets_.find(query, [&](Handle handle, const Worklist::Item&, DcmDataset& dataset)
+    {
+        for (int i = 0; i < pathCount; i++)
+        {
+            const char* value = AttributePath::stringValue(dataset, paths[i]);
+            values[i] = value ? value : "";
+        }
+        return visit(handle, values.data());
+    }, &tags);
 
-    return DcmSCP::handleIncomingCommand(incomingMsg, presInfo);
+    if (matches) *matches = matched;
+    return true;
 }
 
-// ------------------------------------------- Index & Naming Helpers --------------------------------------------
-
-// Generates a new unique filename for a DICOM dataset using the current local time.
-// The filename follows the format: <prefix>_YYYYMMDD_HHMMSS_<ms>.dcm
-// This ensures chronological ordering and prevents collisions.
-// Useful for saving new datasets without overwriting existing files.
-std::string DICOMWorklistSCP::Worklist::newFileName(const std::string& prefix)
+// Builds a query from 'keyCount' pairs of tag paths and match values and runs it like the overload taking a dataset.
+// Values follow the C-FIND matching rules: '*' and '?' wildcards, date ranges like "20240101-20240131"
+// and UID lists separated by backslashes. Keys inside a sequence, e.g. "0040,0100.0008,0060" for the modality
+// of the scheduled procedure step, are matched like the attributes of a C-FIND sequence item.
+// Returns false if a key path is malformed or the parameters are invalid. Thread-safe and updates SCP status.
+bool DICOMWorklistSCP::findDatasets(const char* const* keys, const char* const* keyValues, int keyCount, const char* const* paths, int pathCount,
+    const std::function<bool(Handle, const char* const*)>& visit, int* matches) const
 {
-    auto now = std::chrono::system_clock::now();
-    auto nowTimeT = std::chrono::system_clock::to_time_t(now);
-    auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+    if (keyCount < 0 || (keyCount > 0 && (!keys || !keyValues))) return false;
 
-    std::stringstream ss;
-    ss << prefix << "_";
-    ss << std::put_time(std::localtime(&nowTimeT), "%Y%m%d_%H%M%S");
-    ss << "_" << nowMs;
-    ss << ".dcm";
+    DcmDataset query;
+    for (int i = 0; i < keyCount; i++)
+    {
+        DcmItem* parent = nullptr;
+        DcmTagKey tag;
+        if (!keyValues[i] || !AttributePath::resolve(query, keys[i], true, parent, tag)) return false;
+        if (parent->putAndInsertString(DcmTag(tag), keyValues[i]).bad()) return false;
+    }
 
-    return ss.str();
+    return findDatasets(query, paths, pathCount, visit, matches);
 }
 
-// Returns an available index for a new worklist Item.
-// If there are recycled indices from previously removed Items, reuses the smallest one.
-// Otherwise, assigns the next index based on the current map size.
-// Ensures consistent and collision-free indexing within the worklist.
-int DICOMWorklistSCP::Worklist::getFreeIndex()
+// ----------------------------------------------- Zero-copy reads -----------------------------------------------
+
+// Opens a read guard over all worklist items as of the current generation (see ReadGuard).
+// Items changed since the previous guard get a new snapshot; unchanged items share theirs, as do items still
+// sharing the template prototype, and while nothing changed all guards share the same table, so opening a guard is cheap.
+// The lock is held only while the table is built, never while the guard is in use.
+// Changes made directly to a dataset from getDataset() are seen only after markDatasetDirty().
+// Thread-safe and updates SCP status.
+std::unique_ptr<DICOMWorklistSCP::ReadGuard> DICOMWorklistSCP::beginRead() const
+{
+    auto guard = std::make_unique<ReadGuard>();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Opening read guard");
+
+    if (!readTable_ || readTable_->generation_ != datasets_.generation_)
+    {
+        auto table = std::make_shared<SnapshotTable>();
+        table->generation_ = datasets_.generation_;
+        table->handles_.reserve(datasets_.count());
+        table->snapshots_.reserve(datasets_.count());
+
+        // Items still sharing the template prototype share one snapshot of it as well
+        std::shared_ptr<const Snapshot> prototypeSnapshot;
+        const SharedDataset* prototype = nullptr;
+        DcmDataset scratch;
+
+        for (auto [handle, item] : datasets_)
+        {
+            if (!datasets_.present(*item)) continue;
+            if (!item->snapshot_ && item->shared_)
+            {
+                if (item->dataset_.get() != prototype)
+                {
+                    prototype = item->dataset_.get();
+                    prototypeSnapshot = Snapshot::build(*item->dataset_);
+                }
+                item->snapshot_ = prototypeSnapshot;
+            }
+            if (!item->snapshot_)
+            {
+                DcmDataset* dataset = datasets_.view(*item, scratch);
+                if (!dataset) continue;
+                item->snapshot_ = Snapshot::build(*dataset);
+            }
+            table->handles_.push_back(handle);
+            table->snapshots_.push_back(item->snapshot_);
+        }
+        readTable_ = std::move(table);
+    }
+
+    guard->table_ = readTable_;
+    return guard;
+}
+
+// ---------------------------------------------- Lifecycle control ----------------------------------------------
+
+// Starts the DICOM Worklist SCP server instance.
+// Configures network parameters, transfer syntax, and presentation contexts needed for DICOM association negotiation.
+// Opens the listening port and spawns a background thread to accept incoming DICOM associations.
+// If the server is already running, returns true immediately.
+// Updates server status to reflect activity (via ScopedStatus) and sets running flag.
+// Returns true if listening started successfully; false otherwise.
+// Thread-safe thanks to locking via std::mutex.
+bool DICOMWorklistSCP::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Starting");
+
+    if (serverStatus_.isRunning_)
+    {
+        return true;
+    }
+
+    // Begin listening for incoming DICOM associations using the current settings
+    listener_.reset();
+    stopRequested_ = false;
+    if (openListener(*this, *getSettings()))
+    {
+        runListener([this]() 
+            {
+                acceptAssociations();
+            });
+        serverStatus_.isRunning_ = true;
+        scoped.changeStatus("Listening");
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+// Stops the DICOM Worklist SCP server gracefully.
+// If the server is not running, returns true immediately.
+// Otherwise, terminates listening by completing the current association.
+// Sets server status to "Idle" and marks the instance as inactive.
+// Returns once all listener threads have ended, so the listening ports are closed and no thread uses the instance anymore.
+// Thread-safe and designed to be safely called multiple times; must not be called from a listener thread.
+bool DICOMWorklistSCP::stop()
+{
+    std::vector<std::thread> listeners;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ScopedStatus scoped(serverStatus_, "Stopping", "Idle");
+
+        if (!serverStatus_.isRunning_)
+            return true;
+
+        if (listener_)
+        {
+            listener_->stopRequested_ = true;
+            listener_.reset();
+        }
+        else
+        {
+            stopRequested_ = true;
+        }
+        wakeListener(getSettings()->port_);
+
+        listeners.swap(listenerThreads_);
+        serverStatus_.isRunning_ = false;
+    }
+
+    // Joined without the lock, as a listener still serving an association takes it
+    for (std::thread& listener : listeners)
+    {
+        listener.join();
+    }
+    return true;
+}
+
+// Configures 'listener' with the port, network parameters and presentation context of 'settings'
+// and opens its listening port. Returns false if the port cannot be opened.
+bool DICOMWorklistSCP::openListener(DcmSCP& listener, const Settings& settings)
+{
+    listener.setPort(settings.port_);
+    configureListener(listener, settings);
+
+    OFList<OFString> syntaxes;
+    syntaxes.push_back(UID_LittleEndianImplicitTransferSyntax);
+    listener.clearPresentationContexts();
+    listener.addPresentationContext(UID_FINDModalityWorklistInformationModel, syntaxes);
+
+    return listener.openListenPort().good();
+}
+
+// Applies the AE title, maximum PDU length and timeouts of 'settings' to 'listener'.
+void DICOMWorklistSCP::configureListener(DcmSCP& listener, const Settings& settings)
+{
+    listener.setAETitle(settings.aeTitle_.c_str());
+    listener.setMaxReceivePDULength(settings.maxReceivePDULength_);
+    listener.setConnectionTimeout(settings.connectionTimeout_);
+    listener.setDIMSETimeout(settings.dimseTimeout_);
+    listener.setACSETimeout(settings.acseTimeout_);
+}
+
+// Runs 'accept' on a thread pinned according to the CPU affinity option; stop() joins it.
+// Must be called with mutex_ held.
+void DICOMWorklistSCP::runListener(std::function<void()> accept)
+{
+    listenerThreads_.emplace_back(std::move(accept));
+    pinThread(listenerThreads_.back(), options_.cpuAffinity_, 0);
+}
+
+// Retrieves the current status of the SCP server as a human-readable string.
+// The result includes running state, request count, and descriptive status.
+// The status string is written into the output parameter.
+// Thread-safe and suitable for external logging or monitoring tools.
+bool DICOMWorklistSCP::getStatus(std::string& status)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    status = serverStatus_.ToString();
+    return true;
+}
+
+// Fills 'info' with the current server status: running flag, request and association counters,
+// error counter and category, worklist size and generation, and load and save progress.
+// Reads only atomic counters; it neither takes the lock nor allocates, so it never waits for
+// a running operation and is cheap enough for frequent polling.
+bool DICOMWorklistSCP::getStatus(StatusInfo& info) const
+{
+    serverStatus_.fill(info);
+    return true;
+}
+
+// Blocks until the status differs from the snapshot in 'status' or 'timeoutMs' milliseconds have passed;
+// a negative timeout waits without limit. 'status' should come from getStatus(StatusInfo&) or a previous call.
+// The wait ends when the running flag or the base state changes, a new error is recorded, or the selected
+// counter reaches 'threshold' (a counter already at or above it ends the wait at once).
+// On return 'status' holds the current snapshot. Returns true if a condition was met, false on timeout.
+// Does not take the list lock, so it never delays DIMSE or API calls.
+bool DICOMWorklistSCP::waitForStatus(StatusInfo& status, int timeoutMs, StatusCounter counter, Uint64 threshold) const
+{
+    return serverStatus_.wait(status, timeoutMs, counter, threshold);
+}
+
+// ------------------------------------------------ Saving logic -------------------------------------------------
+
+// Marks the dataset associated with the given handle as "dirty",
+// indicating that it has been modified and should be saved to disk.
+// Integrates with saveDirtyDatasets() to optimize file I/O.
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::markDatasetDirty(Handle handle)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Marking dataset as dirty");
+    if (!datasets_.markDatasetDirty(handle)) return false;
+
+    publishChanges();
+    return true;
+}
+
+// Saves all datasets in the worklist that are marked as "dirty" (i.e., modified but not yet saved).
+// This function avoids rewriting unchanged files and improves storage efficiency.
+// Internally calls Worklist::saveDirtyDatasetsInFile().
+// Thread-safe and updates server processing status.
+bool DICOMWorklistSCP::saveDirtyDatasets()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Saving dirty datasets");
+    bool saved = datasets_.saveDirtyDatasetsInFile(serverStatus_);
+    publishChanges();
+    return saved;
+}
+
+// Saves the dataset at the specified handle to disk.
+// Intended for precise control over individual dataset updates, avoiding bulk saves.
+// Internally delegates to Worklist::saveDatasetInFile().
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::saveDataset(Handle handle)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Saving a dataset by handle");
+    bool saved = datasets_.saveDatasetInFile(handle, serverStatus_);
+    publishChanges();
+    return saved;
+}
+
+// Saves all datasets currently stored in the worklist to disk, regardless of their modification state.
+// This method ensures complete synchronization between memory and persistent storage.
+// All datasets, including unmodified ones, are overwritten, and their dirty flags reset.
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::saveAllDatasets()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Saving all datasets");
+    bool saved = datasets_.saveAllDatasetsInFile(serverStatus_);
+    publishChanges();
+    return saved;
+}
+
+// Selects how modified datasets are written by the saving functions.
+// PersistMode::Delta appends only the changed elements of a dataset to the delta log,
+// which makes small edits on large datasets cheap. PersistMode::Full rewrites the whole file.
+// Switching back to full mode folds the delta log into the dataset files first.
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::setPersistMode(PersistMode mode)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Changing persist mode");
+    return datasets_.setPersistMode(mode, serverStatus_);
+}
+
+// Folds all changes recorded in the delta log into the dataset files and removes the log.
+// Compaction also runs automatically when the log grows beyond its threshold and on startup.
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::compactDatasets()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Compacting delta log");
+    return datasets_.compact(serverStatus_);
+}
+
+// ------------------------------------------------- Item storage ------------------------------------------------
+
+// Selects how worklist items are held in memory. A compact item is a single encoded buffer with a small table
+// of tag offsets instead of a DcmDataset tree with one heap object per element, which takes a fraction of the memory.
+// Reads and C-FIND matching decode only the elements they need. getDataset() and the modifying functions
+// materialize the item as a dataset again; it is packed once the change is published and the host released
+// the dataset (for pinDataset(), by releaseDataset()). Items still sharing the template prototype stay as they are until their first modification.
+// Enabling packs all items at once; disabling materializes them all.
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::setCompactItems(bool enable)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, enable ? "Packing items" : "Unpacking items");
+    datasets_.setCompactItems(enable);
+    return true;
+}
+
+// -------------------------------------------------- Retention --------------------------------------------------
+
+// Configures how datasets are expired once their scheduled procedure step start lies more than
+// 'retentionMinutes' in the past. All items are rescheduled in the timing wheel with the new period.
+// RetentionPolicy::Archive requires an archive folder, which is created if necessary.
+// Any policy other than Keep starts a background thread that expires due datasets once per minute.
+// Returns false if the parameters are invalid or the archive folder cannot be created.
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::setRetentionPolicy(RetentionPolicy policy, int retentionMinutes, const std::string& archiveFolder)
+{
+    if (retentionMinutes < 0) return false;
+    if (policy == RetentionPolicy::Archive && archiveFolder.empty()) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ScopedStatus scoped(serverStatus_, "Setting retention policy");
+
+        if (policy == RetentionPolicy::Archive)
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(archiveFolder, ec);
+            if (!std::filesystem::is_directory(archiveFolder, ec))
+            {
+                serverStatus_.error(StatusError::Configuration, "Failed to create archive folder: " + archiveFolder);
+                return false;
+            }
+        }
+
+        datasets_.setRetention(policy, retentionMinutes, archiveFolder);
+    }
+
+    if (policy == RetentionPolicy::Keep)
+    {
+        stopRetention();
+    }
+    else
+    {
+        startRetention();
+    }
+    return true;
+}
+
+// Expires all datasets that became due since the last run, according to the retention policy.
+// Due items are collected from the timing wheel and evicted as one batch with a single generation bump.
+// The number of expired datasets is returned via the optional output parameter 'expiredCount'.
+// Called periodically by the retention thread; hosts may call it to expire immediately.
+// Thread-safe and updates SCP processing status.
+bool DICOMWorklistSCP::expireDatasets(int* expiredCount)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Expiring datasets");
+
+    int expired = datasets_.expire(localMinutesNow(), serverStatus_);
+    publishChanges();
+
+    if (expiredCount) *expiredCount = expired;
+    return true;
+}
+
+// Starts the retention thread unless it is already running or the instance leaves expiry to a registry
+// (see Options::retentionThread_).
+// The thread wakes up once per minute, the resolution of the timing wheel, and expires due datasets.
+void DICOMWorklistSCP::startRetention()
+{
+    if (!options_.retentionThread_) return;
+
+    std::lock_guard<std::mutex> lock(retentionMutex_);
+    if (retentionThread_.joinable()) return;
+
+    retentionStop_ = false;
+    retentionThread_ = std::thread([this]()
+        {
+            std::unique_lock<std::mutex> wait(retentionMutex_);
+            while (!retentionWakeup_.wait_for(wait, std::chrono::minutes(1), [this]() { return retentionStop_; }))
+            {
+                wait.unlock();
+                expireDatasets();
+                wait.lock();
+            }
+        });
+}
+
+// Signals the retention thread to finish and waits for it.
+// Safe to call when the thread is not running.
+void DICOMWorklistSCP::stopRetention()
+{
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(retentionMutex_);
+        retentionStop_ = true;
+        thread.swap(retentionThread_);
+    }
+    retentionWakeup_.notify_all();
+
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+// Loads all datasets from the data folder into memory.
+// Each valid DICOM file is parsed, wrapped as an internal Item, and indexed in the worklist.
+// If any files fail to load, they are skipped and a warning is logged.
+// Thread-safe and updates server status during processing.
+bool DICOMWorklistSCP::loadAllDatasets()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedStatus scoped(serverStatus_, "Loading all datasets from file");
+
+    bool loaded = datasets_.loadAllDatasets(serverStatus_);
+    datasets_.resetChanges();
+    serverStatus_.generation_ = datasets_.generation_;
+    serverStatus_.datasetCount_ = datasets_.count();
+    serverStatus_.signal();
+    return loaded;
+}
+
+    
+// ===============================================================================================================
+// ========================================== DICOMWorklistSCP::SCPStatus ========================================
+// ===============================================================================================================
+
+
+// Constructs a new SCPStatus object to represent the servers runtime state.
+// Tracks whether the server is running, how many DIMSE requests were processed,
+// the base server state, the operations in progress, and a cumulative error log.
+// Used for diagnostics, logging, and external status querying.
+DICOMWorklistSCP::SCPStatus::SCPStatus(bool isRunning, int requestCount, const char* stateText, std::string lastErrors)
+{
+    isRunning_ = isRunning;
+    requestCount_ = requestCount;
+    stateText_ = stateText;
+    lastErrors_ = lastErrors;
+    for (auto& operation : operations_)
+        operation = nullptr;
+}
+
+// Returns a formatted string summarizing the server status.
+// Includes whether the server is running, the total number of DIMSE requests,
+// the server state with the operations in progress, the startup recovery report, and accumulated error messages.
+// Clears the error log after reporting, ensuring fresh status output on next call.
+// Useful for external monitoring tools, GUI status panels, or logging.
+std::string DICOMWorklistSCP::SCPStatus::ToString()
+{
+    std::ostringstream ss;
+    ss 
+        << "Running: " << (isRunning_ ? "true" : "false")
+        << "\n Requests: " << requestCount_
+        << "\n Associations: active " << activeAssociations_ << ", total " << totalAssociations_
+        << "\n State: " << stateText_.load();
+
+    // Operations in progress, e.g. "Listening (Processing: Getting dataset, Saving all datasets)"
+    bool first = true;
+    for (const auto& slot : operations_)
+    {
+        const char* operation = slot.load();
+        if (!operation)
+            continue;
+        ss << (first ? " (Processing: " : ", ") << operation;
+        first = false;
+    }
+    if (!first)
+        ss << ")";
+
+    ss
+        << "\n Recovery: loaded " << recovery_.loaded_
+        << ", quarantined " << recovery_.quarantined_
+        << ", temp files recovered " << recovery_.tempRecovered_
+        << ", temp files discarded " << recovery_.tempDiscarded_
+        << ", delta records replayed " << recovery_.deltaReplayed_
+        << ", delta bytes discarded " << recovery_.deltaDiscardedBytes_
+        << "\n Last Errors: " << (lastErrors_.empty() ? "None" : lastErrors_);
+    lastErrors_ = "";
+    return ss.str();
+}
+
+// Adds a new error message to the SCPs cumulative error log.
+// Each message is prefixed with a timestamp in local time (HH:MM:SS format).
+// Messages are stored and included in the next call to ToString(), then cleared.
+// Allows chronological tracking of multiple errors during runtime.
+// The error counter and the category of the latest error are updated for getStatus(StatusInfo&).
+void DICOMWorklistSCP::SCPStatus::error(StatusError code, const std::string& message)
+{
+    errorCount_++;
+    lastError_ = code;
+
+    auto now = std::chrono::system_clock::now();
+    auto nowTimeT = std::chrono::system_clock::to_time_t(now);
+
+    std::stringstream ss;
+    ss << std::put_time(std::localtime(&nowTimeT), "%H:%M:%S");
+    lastErrors_ += "\n\t" + ss.str() + " Error: " + message;
+    signal();
+}
+
+// Copies the atomic status fields into a StatusInfo snapshot.
+// Each field is read on its own, so the snapshot is not guaranteed to be consistent across fields.
+// Neither locks nor allocates; safe to call from any thread.
+void DICOMWorklistSCP::SCPStatus::fill(StatusInfo& info) const
+{
+    info.running_ = isRunning_;
+    info.state_ = stateText_;
+    info.requestCount_ = requestCount_;
+    info.activeAssociations_ = activeAssociations_;
+    info.totalAssociations_ = totalAssociations_;
+    info.errorCount_ = errorCount_;
+    info.lastError_ = lastError_;
+    info.datasetCount_ = datasetCount_;
+    info.generation_ = generation_;
+    info.loadDone_ = loadDone_;
+    info.loadTotal_ = loadTotal_;
+    info.flushDone_ = flushDone_;
+    info.flushTotal_ = flushTotal_;
+}
+
+// Wakes up all threads blocked in wait() so they re-check their condition.
+// Called after every change of a field that wait() observes. Costs a single atomic load while nobody waits;
+// otherwise the wait mutex is taken briefly so a waiter cannot miss the change between its check and its sleep.
+void DICOMWorklistSCP::SCPStatus::signal()
+{
+    if (waiters_ == 0) return;
+    {
+        std::lock_guard<std::mutex> lock(waitMutex_);
+    }
+    wakeup_.notify_all();
+}
+
+// Blocks until the status differs from the snapshot in 'status' (see DICOMWorklistSCP::waitForStatus())
+// or the timeout expires, then refills 'status' with the current values.
+// Returns true if a condition was met, false on timeout.
+bool DICOMWorklistSCP::SCPStatus::wait(StatusInfo& status, int timeoutMs, StatusCounter counter, Uint64 threshold)
+{
+    const bool running = status.running_;
+    const char* state = status.state_;
+    const Uint64 errors = status.errorCount_;
+
+    auto reached = [&]()
+    {
+        fill(status);
+        if (status.running_ != running || !state || std::strcmp(status.state_, state) != 0 || status.errorCount_ != errors)
+            return true;
+
+        switch (counter)
+        {
+        case StatusCounter::Requests:           return status.requestCount_ >= threshold;
+        case StatusCounter::ActiveAssociations: return static_cast<Uint64>(status.activeAssociations_) >= threshold;
+        case StatusCounter::TotalAssociations:  return status.totalAssociations_ >= threshold;
+        case StatusCounter::Errors:             return status.errorCount_ >= threshold;
+        case StatusCounter::Datasets:           return static_cast<Uint64>(status.datasetCount_) >= threshold;
+        case StatusCounter::Generation:         return status.generation_ >= threshold;
+        default:                                return false;
+        }
+    };
+
+    std::unique_lock<std::mutex> lock(waitMutex_);
+    waiters_++;
+
+    bool result = true;
+    if (timeoutMs < 0)
+    {
+        wakeup_.wait(lock, reached);
+    }
+    else
+    {
+        result = wakeup_.wait_for(lock, std::chrono::milliseconds(timeoutMs), reached);
+    }
+
+    waiters_--;
+    return result;
+}
+
+
+// ===============================================================================================================
+// ========================================= DICOMWorklistSCP::ScopedStatus ======================================
+// ===============================================================================================================
+
+
+// Constructs a scoped status marker for the SCP server.
+// Claims a free slot of SCPStatus::operations_ with a compare-exchange and stores the action name there,
+// so concurrent operations are listed side by side by ToString().
+// Neither allocates nor takes mutex_, which keeps trivial read-only calls cheap.
+// If all slots are taken, the operation runs untracked.
+DICOMWorklistSCP::ScopedStatus::ScopedStatus(
+    DICOMWorklistSCP::SCPStatus& status, 
+    const char* actionName, 
+    const char* finalStateText)
+    : status_(status), slot_(-1), finalStateText_(finalStateText)
+{
+    for (int i = 0; i < SCPStatus::OperationSlots; i++)
+    {
+        const char* expected = nullptr;
+        if (status_.operations_[i].compare_exchange_strong(expected, actionName))
+        {
+            slot_ = i;
+            break;
+        }
+    }
+}
+
+// Updates the base server state that will be applied upon scope exit (e.g., "Listening" after a successful start).
+// Passing nullptr leaves the state unchanged.
+void DICOMWorklistSCP::ScopedStatus::changeStatus(const char* finalStateText)
+{
+    finalStateText_ = finalStateText;
+}
+
+// Destructor that releases the operation slot upon scope exit.
+// If a final state was provided via the constructor or changeStatus(), it becomes the new base state.
+// Enables automatic and consistent status tracking through RAII.
+DICOMWorklistSCP::ScopedStatus::~ScopedStatus()
+{
+    if (slot_ >= 0)
+        status_.operations_[slot_] = nullptr;
+    if (finalStateText_)
+    {
+        status_.stateText_ = finalStateText_;
+        status_.signal();
+    }
+}
+
+
+// ===============================================================================================================
+// ========================================= DICOMWorklistSCP::DatasetCodec ======================================
+// ===============================================================================================================
+
+
+// Encodes all elements of a dataset in explicit little-endian byte order with explicit lengths.
+// The resulting buffer can be restored with decode() and is used as payload of delta log records.
+// Returns true on success; false if the dataset could not be written.
+bool DICOMWorklistSCP::DatasetCodec::encode(DcmDataset& dataset, std::vector<Uint8>& buffer)
+{
+    buffer.resize(dataset.getLength(EXS_LittleEndianExplicit, EET_ExplicitLength));
+    if (buffer.empty()) return true;
+
+    DcmOutputBufferStream stream(buffer.data(), static_cast<offile_off_t>(buffer.size()));
+    dataset.transferInit();
+    OFCondition status = dataset.write(stream, EXS_LittleEndianExplicit, EET_ExplicitLength, nullptr);
+    dataset.transferEnd();
+    if (status.bad()) return false;
+
+    void* data = nullptr;
+    offile_off_t written = 0;
+    stream.flushBuffer(data, written);
+    buffer.resize(static_cast<size_t>(written));
+    return true;
+}
+
+// Parses elements encoded by encode() into the given dataset.
+// Returns true if the whole buffer was read successfully.
+bool DICOMWorklistSCP::DatasetCodec::decode(const Uint8* data, size_t length, DcmDataset& dataset)
+{
+    DcmInputBufferStream stream;
+    stream.setBuffer(data, static_cast<offile_off_t>(length));
+    stream.setEos();
+
+    dataset.transferInit();
+    OFCondition status = dataset.read(stream, EXS_LittleEndianExplicit);
+    dataset.transferEnd();
+    return status.good();
+}
+
+// Computes a fingerprint of a single element, including nested sequence items, from its encoded bytes.
+// Two elements with equal tag, VR and value always produce the same fingerprint.
+Uint64 DICOMWorklistSCP::DatasetCodec::fingerprint(DcmObject& element)
+{
+    thread_local std::vector<Uint8> buffer;
+    buffer.resize(element.calcElementLength(EXS_LittleEndianExplicit, EET_ExplicitLength));
+    if (buffer.empty()) return fnv1a(nullptr, 0);
+
+    DcmOutputBufferStream stream(buffer.data(), static_cast<offile_off_t>(buffer.size()));
+    element.transferInit();
+    element.write(stream, EXS_LittleEndianExplicit, EET_ExplicitLength, nullptr);
+    element.transferEnd();
+
+    void* data = nullptr;
+    offile_off_t written = 0;
+    stream.flushBuffer(data, written);
+    return fnv1a(buffer.data(), static_cast<size_t>(written));
+}
+
+// Computes the fingerprints of all top-level elements of a dataset, keyed by their tag.
+// Any previous content of the map is replaced.
+void DICOMWorklistSCP::DatasetCodec::fingerprintAll(DcmDataset& dataset, std::unordered_map<Uint32, Uint64>& fingerprints)
+{
+    fingerprints.clear();
+    fingerprints.reserve(dataset.card());
+    for (unsigned long i = 0; i < dataset.card(); i++)
+    {
+        DcmElement* element = dataset.getElement(i);
+        fingerprints[tagKeyOf(*element)] = fingerprint(*element);
+    }
+}
+
+
+// ===============================================================================================================
+// ========================================== DICOMWorklistSCP::Snapshot =========================================
+// ===============================================================================================================
+
+
+// Encodes the string attributes of 'dataset', including those inside sequence items, into a new snapshot.
+// Values are taken as stored (see AttributePath::stringValue()); attributes of other VRs are left out.
+std::shared_ptr<const DICOMWorklistSCP::Snapshot> DICOMWorklistSCP::Snapshot::build(DcmItem& dataset)
+{
+    auto snapshot = std::make_shared<Snapshot>();
+    std::vector<Uint32> path;
+    snapshot->add(dataset, path);
+
+    const Uint32* keys = snapshot->keys_.data();
+    std::sort(snapshot->entries_.begin(), snapshot->entries_.end(), [keys](const Entry& a, const Entry& b)
+    {
+        return std::lexicographical_compare(keys + a.key_, keys + a.key_ + a.keyLength_, keys + b.key_, keys + b.key_ + b.keyLength_);
+    });
+    return snapshot;
+}
+
+// Looks up the attribute with the given key words (see AttributePath::key()) by binary search in the offset table.
+// Returns a pointer to its zero-terminated value inside the snapshot and writes its length to 'length' if given,
+// or returns nullptr if the snapshot holds no such attribute.
+const char* DICOMWorklistSCP::Snapshot::find(const Uint32* key, int keyLength, size_t* length) const
+{
+    const Uint32* keys = keys_.data();
+    auto less = [keys](const Entry& entry, std::pair<const Uint32*, int> wanted)
+    {
+        return std::lexicographical_compare(keys + entry.key_, keys + entry.key_ + entry.keyLength_, wanted.first, wanted.first + wanted.second);
+    };
+
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), std::make_pair(key, keyLength), less);
+    if (it == entries_.end() || static_cast<int>(it->keyLength_) != keyLength
+        || !std::equal(key, key + keyLength, keys + it->key_)) return nullptr;
+
+    if (length) *length = it->valueLength_;
+    return text_.data() + it->value_;
+}
+
+// Appends entries for the string attributes of 'item' whose path starts with 'path',
+// descending into all items of its sequences. 'path' is restored before returning.
+void DICOMWorklistSCP::Snapshot::add(DcmItem& item, std::vector<Uint32>& path)
+{
+    for (unsigned long i = 0; i < item.card(); i++)
+    {
+        DcmElement* element = item.getElement(i);
+        path.push_back(tagKeyOf(*element));
+
+        if (element->ident() == EVR_SQ)
+        {
+            DcmSequenceOfItems* sequence = OFstatic_cast(DcmSequenceOfItems*, element);
+            for (unsigned long n = 0; n < sequence->card() && static_cast<int>(path.size()) + 2 <= MaxKeyLength; n++)
+            {
+                path.push_back(static_cast<Uint32>(n));
+                add(*sequence->getItem(n), path);
+                path.pop_back();
+            }
+        }
+        else
+        {
+            char* value = nullptr;
+            if (element->getString(value).good())
+            {
+                size_t valueLength = value ? std::strlen(value) : 0;
+                Entry entry = { static_cast<Uint32>(keys_.size()), static_cast<Uint32>(path.size()),
+                    static_cast<Uint32>(text_.size()), static_cast<Uint32>(valueLength) };
+                keys_.insert(keys_.end(), path.begin(), path.end());
+                text_.insert(text_.end(), value, value + valueLength);
+                text_.push_back('\0');
+                entries_.push_back(entry);
+            }
+        }
+
+        path.pop_back();
+    }
+}
+
+
+// ===============================================================================================================
+// ========================================= DICOMWorklistSCP::ReadGuard =========================================
+// ===============================================================================================================
+
+
+// Returns the number of items visible through the guard.
+int DICOMWorklistSCP::ReadGuard::count() const
+{
+    return table_ ? static_cast<int>(table_->handles_.size()) : 0;
+}
+
+// Returns the handle of the item at 'index' (0 to count() - 1), or 0 if the index is out of range.
+DICOMWorklistSCP::Handle DICOMWorklistSCP::ReadGuard::handle(int index) const
+{
+    return index >= 0 && index < count() ? table_->handles_[index] : 0;
+}
+
+// Returns the generation of the worklist the guard reflects (see getGeneration()).
+Uint64 DICOMWorklistSCP::ReadGuard::generation() const
+{
+    return table_ ? table_->generation_ : 0;
+}
+
+// Retrieves the string value of the attribute at 'path' of the item at 'index' without copying it.
+// The pointer stays valid until the guard is destroyed; the value's length is written to 'length' if given.
+// Returns nullptr if the index is out of range, the path is malformed, or the attribute does not exist or is not a string.
+const char* DICOMWorklistSCP::ReadGuard::value(int index, const char* path, size_t* length) const
+{
+    if (index < 0 || index >= count()) return nullptr;
+
+    Uint32 key[Snapshot::MaxKeyLength];
+    int keyLength = 0;
+    if (!AttributePath::key(path, key, Snapshot::MaxKeyLength, keyLength)) return nullptr;
+    return table_->snapshots_[index]->find(key, keyLength, length);
+}
+
+// Retrieves the string value of the attribute at 'path' of the item with the given handle, see value(int, ...).
+// The item is located by binary search, as the guard lists the items in slot order.
+// Returns nullptr as well if the handle is not part of the guard.
+const char* DICOMWorklistSCP::ReadGuard::value(Handle handle, const char* path, size_t* length) const
+{
+    if (!table_) return nullptr;
+
+    const auto& handles = table_->handles_;
+    auto it = std::lower_bound(handles.begin(), handles.end(), handle, [](Handle a, Handle b)
+    {
+        return static_cast<Uint32>(a) < static_cast<Uint32>(b);
+    });
+    if (it == handles.end() || *it != handle) return nullptr;
+    return value(static_cast<int>(it - handles.begin()), path, length);
+}
+
+
+// ===============================================================================================================
+// ======================================= DICOMWorklistSCP::AttributePath =======================================
+// ===============================================================================================================
+
+
+// Validates the syntax of a complete tag path and retrieves the tag of its last segment,
+// without touching any dataset. The last segment must not select an item.
+// Returns false if the path is malformed.
+bool DICOMWorklistSCP::AttributePath::target(const char* path, DcmTagKey& tag)
+{
+    if (!path) return false;
+
+    const char* cursor = path;
+    while (true)
+    {
+        long index = 0;
+        bool indexed = false;
+        cursor = parseSegment(cursor, tag, index, indexed);
+        if (!cursor) return false;
+        if (*cursor == '\0') return !indexed;
+        cursor++;
+    }
+}
+
+// Walks a tag path from 'root' through the sequence items named by all but its last segment.
+// On success, 'parent' receives the item holding the addressed attribute and 'tag' its tag.
+// With 'create' set, missing sequences and items are created on the way; otherwise a missing one fails the walk.
+// The whole path is validated first, so a malformed path never modifies the dataset.
+bool DICOMWorklistSCP::AttributePath::resolve(DcmItem& root, const char* path, bool create, DcmItem*& parent, DcmTagKey& tag)
+{
+    if (!target(path, tag)) return false;
+
+    parent = &root;
+    const char* cursor = path;
+    while (true)
+    {
+        DcmTagKey key;
+        long index = 0;
+        bool indexed = false;
+        cursor = parseSegment(cursor, key, index, indexed);
+        if (*cursor == '\0') return true;
+        cursor++;
+
+        DcmItem* next = nullptr;
+        OFCondition status = create
+            ? parent->findOrCreateSequenceItem(DcmTag(key), next, index)
+            : parent->findAndGetSequenceItem(key, next, index);
+        if (status.bad() || !next) return false;
+        parent = next;
+    }
+}
+
+// Retrieves the string value of the attribute 'tag' in 'parent' without copying it.
+// Returns "" for an empty attribute and nullptr if it does not exist or is not a string.
+const char* DICOMWorklistSCP::AttributePath::stringValue(DcmItem& parent, const DcmTagKey& tag)
+{
+    DcmElement* element = nullptr;
+    char* value = nullptr;
+    if (parent.findAndGetElement(tag, element).bad() || !element || element->getString(value).bad()) return nullptr;
+    return value ? value : "";
+}
+
+// Retrieves the string value of the attribute at 'path' below 'root' without copying it.
+// Returns nullptr if the path is malformed, leads through a missing sequence item,
+// or the attribute does not exist or is not a string.
+const char* DICOMWorklistSCP::AttributePath::stringValue(DcmItem& root, const char* path)
+{
+    DcmItem* parent = nullptr;
+    DcmTagKey tag;
+    if (!resolve(root, path, false, parent, tag)) return nullptr;
+    return stringValue(*parent, tag);
+}
+
+// Converts a tag path into the key words of Snapshot: the tag of each segment as (group << 16) | element,
+// followed by its item number (0 if not given) for all but the last segment.
+// Returns false if the path is malformed or needs more than 'capacity' words.
+bool DICOMWorklistSCP::AttributePath::key(const char* path, Uint32* words, int capacity, int& length)
+{
+    if (!path) return false;
+
+    length = 0;
+    const char* cursor = path;
+    while (true)
+    {
+        DcmTagKey tag;
+        long index = 0;
+        bool indexed = false;
+        cursor = parseSegment(cursor, tag, index, indexed);
+        if (!cursor || length >= capacity) return false;
+        words[length++] = (static_cast<Uint32>(tag.getGroup()) << 16) | tag.getElement();
+        if (*cursor == '\0') return !indexed;
+        if (length >= capacity || index < 0) return false;
+        words[length++] = static_cast<Uint32>(index);
+        cursor++;
+    }
+}
+
+// Parses one path segment: an optional '(', group and element as four hex digits each separated by ',',
+// an optional ')' and an optional item number in brackets.
+// Returns the position of the following '.' or the end of the path, or nullptr if the segment is malformed.
+const char* DICOMWorklistSCP::AttributePath::parseSegment(const char* cursor, DcmTagKey& tag, long& index, bool& indexed)
+{
+    auto hex = [&cursor](Uint16& value)
+    {
+        value = 0;
+        for (int i = 0; i < 4; i++, cursor++)
+        {
+            char c = static_cast<char>(std::tolower(static_cast<unsigned char>(*cursor)));
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (digit < 0) return false;
+            value = static_cast<Uint16>((value << 4) | digit);
+        }
+        return true;
+    };
+
+    bool parenthesized = *cursor == '(';
+    if (parenthesized) cursor++;
+
+    Uint16 group = 0, element = 0;
+    if (!hex(group) || *cursor++ != ',' || !hex(element)) return nullptr;
+    if (parenthesized && *cursor++ != ')') return nullptr;
+    tag = DcmTagKey(group, element);
+
+    index = 0;
+    indexed = *cursor == '[';
+    if (indexed)
+    {
+        cursor++;
+        if (*cursor < '0' || *cursor > '9') return nullptr;
+        while (*cursor >= '0' && *cursor <= '9')
+        {
+            index = index * 10 + (*cursor++ - '0');
+            if (index > 0xFFFFFF) return nullptr;
+        }
+        if (*cursor++ != ']') return nullptr;
+    }
+
+    return *cursor == '.' || *cursor == '\0' ? cursor : nullptr;
+}
+
+
+// ===============================================================================================================
+// ======================================== DICOMWorklistSCP::CompactItem ========================================
+// ===============================================================================================================
+
+
+// Packs all elements of a dataset into 'item': the tag table followed by the elements encoded by DatasetCodec::encode().
+// The offset of every element is taken from its encoded length, so the table matches the encoding exactly.
+// Returns false if the dataset could not be encoded; 'item' is left unchanged then.
+bool DICOMWorklistSCP::CompactItem::pack(DcmDataset& dataset, CompactItem& item)
+{
+    thread_local std::vector<Uint8> encoded;
+    if (!DatasetCodec::encode(dataset, encoded)) return false;
+
+    const Uint32 count = static_cast<Uint32>(dataset.card());
+    const size_t tableSize = static_cast<size_t>(count) * 8;
+    std::unique_ptr<Uint8[]> data(new Uint8[tableSize + encoded.size()]);
+
+    Uint32 offset = 0;
+    for (Uint32 i = 0; i < count; i++)
+    {
+        DcmElement* element = dataset.getElement(i);
+        const Uint32 entry[2] = { tagKeyOf(*element), offset };
+        memcpy(data.get() + i * 8, entry, sizeof(entry));
+        offset += element->calcElementLength(EXS_LittleEndianExplicit, EET_ExplicitLength);
+    }
+    if (offset != encoded.size()) return false;
+
+    if (!encoded.empty()) memcpy(data.get() + tableSize, encoded.data(), encoded.size());
+    item.data_ = std::move(data);
+    item.size_ = static_cast<Uint32>(tableSize + encoded.size());
+    item.count_ = count;
+    return true;
+}
+
+// Decodes the packed elements into 'dataset'. If 'tags' is given, only the top-level elements whose tags it lists
+// are decoded; 'tags' must be sorted (see tagsOf()). Returns false if the item is empty or could not be decoded.
+bool DICOMWorklistSCP::CompactItem::unpack(DcmDataset& dataset, const std::vector<Uint32>* tags) const
+{
+    if (!data_) return false;
+
+    const size_t tableSize = static_cast<size_t>(count_) * 8;
+    const Uint8* elements = data_.get() + tableSize;
+    const size_t length = size_ - tableSize;
+    if (!tags) return length == 0 || DatasetCodec::decode(elements, length, dataset);
+
+    // Table and tags are both in tag order, so the selected elements are collected in one merge pass
+    thread_local std::vector<Uint8> selected;
+    selected.clear();
+    auto wanted = tags->begin();
+    for (Uint32 i = 0; i < count_ && wanted != tags->end(); i++)
+    {
+        Uint32 entry[2];
+        memcpy(entry, data_.get() + i * 8, sizeof(entry));
+        while (wanted != tags->end() && *wanted < entry[0]) ++wanted;
+        if (wanted == tags->end() || *wanted != entry[0]) continue;
+
+        Uint32 next = static_cast<Uint32>(length);
+        if (i + 1 < count_) memcpy(&next, data_.get() + (i + 1) * 8 + 4, sizeof(next));
+        selected.insert(selected.end(), elements + entry[1], elements + next);
+    }
+
+    return selected.empty() || DatasetCodec::decode(selected.data(), selected.size(), dataset);
+}
+
+// Adds the tags of the top-level elements of a C-FIND query to 'tags', together with SpecificCharacterSet,
+// which the responses take over from the item. 'tags' is left sorted and free of duplicates.
+void DICOMWorklistSCP::CompactItem::tagsOf(DcmItem& query, std::vector<Uint32>& tags)
+{
+    tags.push_back((static_cast<Uint32>(DCM_SpecificCharacterSet.getGroup()) << 16) | DCM_SpecificCharacterSet.getElement());
+    for (unsigned long i = 0; i < query.card(); i++)
+    {
+        tags.push_back(tagKeyOf(*query.getElement(i)));
+    }
+
+    std::sort(tags.begin(), tags.end());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+}
+
+// Adds the tags of the top-level elements that the given tag paths lead through to 'tags'.
+// Malformed paths address nothing and are skipped. 'tags' is left sorted and free of duplicates.
+void DICOMWorklistSCP::CompactItem::tagsOf(const char* const* paths, int pathCount, std::vector<Uint32>& tags)
+{
+    Uint32 words[64];
+    int length = 0;
+    for (int i = 0; i < pathCount; i++)
+    {
+        if (AttributePath::key(paths[i], words, 64, length)) tags.push_back(words[0]);
+    }
+
+    std::sort(tags.begin(), tags.end());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+}
+
+
+// ===============================================================================================================
+// =========================================== DICOMWorklistSCP::Worklist ========================================
+// ===============================================================================================================
+
+
+// Applies the storage settings of the instance: data folder, file prefix, persist mode and item layout.
+// Must be called before the first load. A prefix other than the default is also put in front of the names of
+// the delta log and the index sidecar, so instances sharing a folder never touch each other's files.
+void DICOMWorklistSCP::Worklist::configure(const Options& options)
+{
+    dataFolder_ = options.dataFolder_.empty() ? "./" : options.dataFolder_;
+    if (dataFolder_.back() != '/' && dataFolder_.back() != '\\') dataFolder_ += '/';
+
+    if (!options.filePrefix_.empty() && options.filePrefix_ != filePrefix_)
+    {
+        filePrefix_ = options.filePrefix_;
+        deltaLogName_ = filePrefix_ + deltaLogName_;
+        sidecarName_ = filePrefix_ + sidecarName_;
+    }
+
+    persistMode_ = options.persistMode_;
+    compactItems_ = options.compactItems_;
+}
+
+// ---------------------------------------------- Dataset management ---------------------------------------------
+
+// Loads all DICOM dataset files from the configured data folder into memory.
+// Each valid file is parsed into a DcmDataset, wrapped into an Item object,
+// and stored in a slot of the internal slot map.
+// Files that cannot be parsed or hold no elements are moved into the quarantine folder,
+// so later startups do not parse them again; each one is reported via SCPStatus.
+// Temp files left by interrupted saves are discarded if the previous file version still exists,
+// or promoted to the dataset file if they are the only copy.
+// Files named by earlier versions are renamed to the name derived from a newly assigned ID.
+// Changes left in the delta log by a previous run are replayed and folded into the files.
+// The key attributes for the query index are taken from the memory-mapped index sidecar for every file
+// whose size and modification time still match its record, and extracted from the dataset otherwise.
+// The outcome is summarized in the recovery report of SCPStatus.
+// Returns true if at least one dataset was successfully loaded; false otherwise.
+bool DICOMWorklistSCP::Worklist::loadAllDatasets(SCPStatus& serverStatus)
+{
+    using namespace std::filesystem;
+    RecoveryReport& report = serverStatus.recovery_;
+    report = RecoveryReport();
+
+    std::vector<path> files;
+    std::vector<path> tempFiles;
+    for (const auto& entry : directory_iterator(dataFolder_))
+    {
+        if (!entry.is_regular_file()) continue;
+        if (entry.path().filename().string() == deltaLogName_) continue;
+        if (entry.path().filename().string() == sidecarName_) continue;
+        if (entry.path().filename().string().compare(0, filePrefix_.size(), filePrefix_) != 0) continue;
+
+        if (entry.path().extension().string() == TempSuffix)
+        {
+            tempFiles.push_back(entry.path());
+        }
+        else
+        {
+            files.push_back(entry.path());
+        }
+    }
+
+    for (const auto& tempFile : tempFiles)
+    {
+        path target = tempFile;
+        target.replace_extension();
+
+        std::error_code ec;
+        if (std::filesystem::exists(target, ec))
+        {
+            // The save was interrupted before the rename, so the previous version is still complete
+            std::filesystem::remove(tempFile, ec);
+            report.tempDiscarded_++;
+            continue;
+        }
+
+        // The first save of a new dataset was interrupted; its temp file is validated like any dataset file
+        std::filesystem::rename(tempFile, target, ec);
+        if (ec)
+        {
+            quarantine(tempFile, serverStatus);
+            continue;
+        }
+        files.push_back(target);
+        report.tempRecovered_++;
+    }
+
+    std::unordered_map<std::string, SidecarRecord> records;
+    bool sidecarValid = readSidecar(records);
+
+    serverStatus.loadDone_ = 0;
+    serverStatus.loadTotal_ = static_cast<int>(files.size());
+
+    // Files named by earlier versions, which get an ID once the IDs of all other files are known
+    std::vector<std::pair<Handle, std::string>> legacyFiles;
+
+    for (const auto& file : files)
+    {
+        std::string fileName = file.filename().string();
+
+        DatasetPtr dataset(new SharedDataset());
+        OFCondition status = dataset->loadFile(file.string().c_str());
+
+        if (status.good() && dataset->card() > 0)
+        {
+            Uint64 id = 0;
+            bool legacy = !idOfFileName(fileName, id);
+            Handle handle = allocate(dataset, id, false);
+            Item* item = (*this)[handle];
+            report.loaded_++;
+
+            if (legacy)
+            {
+                legacyFiles.emplace_back(handle, fileName);
+            }
+            else if (id >= nextId_)
+            {
+                nextId_ = id + 1;
+            }
+
+            bool stamped = fileStamp(file, item->fileSize_, item->fileTime_);
+            if (!stamped) item->fileSize_ = item->fileTime_ = 0;
+            auto record = records.find(fileName);
+            if (record != records.end() && record->second.hasKeys_ && stamped
+                && record->second.fileSize_ == item->fileSize_ && record->second.fileTime_ == item->fileTime_)
+            {
+                item->keys_ = record->second.keys_;
+                item->sidecarSlot_ = record->second.slot_;
+            }
+            else
+            {
+                ItemKeys::extract(*dataset, values_, item->keys_);
+            }
+
+            // Packed right away, so loading holds only one dataset tree at a time
+            if (compactItems_)
+            {
+                dataset = nullptr;
+                pack(*item);
+            }
+        }
+        else
+        {
+            std::string reason = status.good() ? "no elements" : status.text();
+            serverStatus.error(StatusError::Load, "[Worklist] Failed to load: " + fileName + " (" + reason + ")");
+            quarantine(file, serverStatus);
+        }
+        serverStatus.loadDone_++;
+    }
+
+    for (const auto& [handle, fileName] : legacyFiles)
+    {
+        Item* item = (*this)[handle];
+        item->id_ = nextId_++;
+
+        if (!migrateLegacyFile(*item, fileName, serverStatus))
+        {
+            release(handle);
+            report.loaded_--;
+        }
+    }
+
+    openSidecar(sidecarValid, records);
+
+    if (exists(dataFolder_ + deltaLogName_))
+    {
+        replayDeltaLog(serverStatus);
+        compact(serverStatus);
+    }
+
+    for (auto [id, item] : *this)
+    {
+        index_.insert(id, item->keys_, values_);
+        scheduleExpiry(id);
+    }
+
+    if (persistMode_ == PersistMode::Delta)
+    {
+        DcmDataset scratch;
+        for (auto [id, item] : *this)
+        {
+            if (item->tracked_) continue;
+            DcmDataset* dataset = view(*item, scratch);
+            if (!dataset) continue;
+            DatasetCodec::fingerprintAll(*dataset, item->persisted_);
+            item->tracked_ = true;
+        }
+    }
+
+    // Items unpacked by the delta log replay
+    if (compactItems_)
+    {
+        for (auto [id, item] : *this)
+        {
+            pack(*item);
+        }
+    }
+
+    return report.loaded_ > 0;
+}
+
+// Moves an unusable file from the data folder into the quarantine folder.
+// An existing quarantined file with the same name is kept by numbering the new one.
+// Returns true on success; otherwise reports the failure via SCPStatus.
+bool DICOMWorklistSCP::Worklist::quarantine(const std::filesystem::path& file, SCPStatus& serverStatus)
+{
+    std::error_code ec;
+    std::filesystem::path folder = dataFolder_ + quarantineFolder_;
+    std::filesystem::create_directories(folder, ec);
+
+    std::filesystem::path target = folder / file.filename();
+    for (int i = 1; std::filesystem::exists(target, ec); i++)
+    {
+        target = folder / (file.filename().string() + "." + std::to_string(i));
+    }
+
+    std::filesystem::rename(file, target, ec);
+    if (ec)
+    {
+        serverStatus.error(StatusError::Quarantine, "[Worklist] Failed to quarantine: " + file.filename().string());
+        return false;
+    }
+
+    serverStatus.recovery_.quarantined_++;
+    return true;
+}
+
+// Renames a dataset file named by an earlier version to the name derived from the ID of its Item.
+// The sidecar record stored under the old name is dropped; openSidecar() writes a new one.
+// Returns false if the file cannot be renamed; the caller then drops the Item, so the file keeps
+// its old name and the migration is retried on the next startup. The failure is reported via SCPStatus.
+bool DICOMWorklistSCP::Worklist::migrateLegacyFile(Item& item, const std::string& legacyName, SCPStatus& serverStatus)
+{
+    std::error_code ec;
+    std::filesystem::rename(dataFolder_ + legacyName, dataFolder_ + fileNameOf(item.id_), ec);
+    if (ec)
+    {
+        serverStatus.error(StatusError::Rename, "[Worklist] Failed to rename: " + legacyName);
+        return false;
+    }
+
+    item.sidecarSlot_ = -1;
+    return true;
+}
+
+// Adds 'count' dirty Items sharing the prototype dataset, or empty if 'prototype' is nullptr.
+// Nothing is copied: each Item references the prototype until own() gives it a copy before its first modification.
+// Slots missing beyond the free list are reserved up front, growing the slot map at least geometrically,
+// so repeated small adds stay amortized constant time. Since all Items are equal, key attributes and expiry
+// are evaluated once and registered for every Item. The assigned handles are written to 'handles'.
+void DICOMWorklistSCP::Worklist::addCopies(const DatasetPtr& prototype, int count, Handle* handles)
+{
+    size_t freeSlots = slots_.size() - static_cast<size_t>(count_);
+    if (static_cast<size_t>(count) > freeSlots)
+    {
+        size_t required = slots_.size() + static_cast<size_t>(count) - freeSlots;
+        if (required > slots_.capacity()) slots_.reserve(std::max(required, slots_.capacity() * 2));
+    }
+
+    ItemKeys keys;
+    Sint64 expiry = -1;
+    for (int i = 0; i < count; i++)
+    {
+        DatasetPtr dataset = prototype ? prototype : DatasetPtr(new SharedDataset());
+        if (i == 0)
+        {
+            ItemKeys::extract(*dataset, values_, keys);
+            expiry = expiryOf(*dataset);
+        }
+
+        Handle handle = allocate(dataset, nextId_++, true);
+        Item* item = (*this)[handle];
+        item->shared_ = static_cast<bool>(prototype);
+        handles[i] = handle;
+
+        item->keys_ = keys;
+        index_.insert(handle, keys, values_);
+        item->expiry_ = expiry;
+        if (expiry >= 0)
+        {
+            wheel_.insert({ handle, expiry });
+        }
+        recordChange(ChangeKind::Added, handle);
+    }
+}
+
+// Gives the Item a dataset of its own if it still shares the template prototype, so it can be modified.
+// If no other Item and no longer the template itself references the prototype, the Item takes it over without a copy.
+void DICOMWorklistSCP::Worklist::own(Item& item)
+{
+    if (!item.shared_) return;
+
+    if (!item.dataset_.unique())
+    {
+        item.dataset_ = DatasetPtr(new SharedDataset(static_cast<const DcmDataset&>(*item.dataset_)));
+    }
+    item.shared_ = false;
+}
+
+// Removes the dataset associated with the given handle from the worklist.
+// If the dataset file exists on disk, it is deleted.
+// The Item is dropped from the query index and the index sidecar.
+// Its slot is released for reuse under a new generation, which invalidates the handle.
+// Returns true if the handle was valid and the Item was removed; false otherwise.
+bool DICOMWorklistSCP::Worklist::remove(Handle handle)
+{
+    Item* item = (*this)[handle];
+    if (!item) return false;
+
+    forget(handle, *item);
+
+    std::string path = dataFolder_ + fileNameOf(item->id_);
+    if (std::filesystem::exists(path))
+    {
+        std::filesystem::remove(path);
+    }
+
+    release(handle);
+    recordChange(ChangeKind::Removed, handle);
+    return true;
+}
+
+// Returns the number of currently loaded datasets in the worklist.
+// Represents the number of used slots of the slot map.
+// Useful for diagnostics, iteration, and external queries.
+int DICOMWorklistSCP::Worklist::count() const
+{
+    return count_;
+}
+
+// Provides direct access to a worklist Item by handle.
+// Resolving a handle is a bounds check of its slot plus a comparison with the slot's generation,
+// so handles of removed Items are rejected even if their slot was reused.
+// Returns a pointer to the Item if the handle is valid; nullptr otherwise.
+DICOMWorklistSCP::Worklist::Item* DICOMWorklistSCP::Worklist::operator[](Handle handle)
+{
+    Uint32 slot = static_cast<Uint32>(handle);
+    if (slot >= slots_.size()) return nullptr;
+
+    Slot& entry = slots_[slot];
+    return (entry.used_ && entry.generation_ == static_cast<Uint32>(handle >> 32)) ? &entry.item_ : nullptr;
+}
+
+// Read-only variant of the handle lookup above.
+const DICOMWorklistSCP::Worklist::Item* DICOMWorklistSCP::Worklist::operator[](Handle handle) const
+{
+    Uint32 slot = static_cast<Uint32>(handle);
+    if (slot >= slots_.size()) return nullptr;
+
+    const Slot& entry = slots_[slot];
+    return (entry.used_ && entry.generation_ == static_cast<Uint32>(handle >> 32)) ? &entry.item_ : nullptr;
+}
+
+// Returns an iterator to the first used slot of the slot map.
+DICOMWorklistSCP::Worklist::Iterator DICOMWorklistSCP::Worklist::begin()
+{
+    return Iterator(*this, 0);
+}
+
+// Returns the iterator past the last slot of the slot map.
+DICOMWorklistSCP::Worklist::Iterator DICOMWorklistSCP::Worklist::end()
+{
+    return Iterator(*this, static_cast<Uint32>(slots_.size()));
+}
+
+// Read-only variants of the iterators above, for the lookups of const members.
+DICOMWorklistSCP::Worklist::ConstIterator DICOMWorklistSCP::Worklist::begin() const
+{
+    return ConstIterator(*this, 0);
+}
+
+DICOMWorklistSCP::Worklist::ConstIterator DICOMWorklistSCP::Worklist::end() const
+{
+    return ConstIterator(*this, static_cast<Uint32>(slots_.size()));
+}
+
+// Clears the entire worklist, removing all loaded datasets from memory and disk.
+// For each Item, deletes the associated DICOM file if it exists. If deletion fails,
+// the error is reported via the provided SCPStatus object.
+// After cleanup, releases all slots; handles issued before stay invalid.
+void DICOMWorklistSCP::Worklist::clear(SCPStatus& serverStatus)
+{
+    for (auto [id, item] : *this)
+    {
+        std::string fileName = fileNameOf(item->id_);
+        std::string path = dataFolder_ + fileName;
+        if (std::filesystem::exists(path))
+        {
+            if (!std::filesystem::remove(path))
+            {
+                serverStatus.error(StatusError::Remove, "Failed to remove file: " + fileName);
+            }
+        }
+
+        release(id);
+    }
+
+    wheel_.clear();
+    index_.clear();
+    values_.clear();
+
+    std::error_code ec;
+    std::filesystem::remove(dataFolder_ + deltaLogName_, ec);
+    openSidecar(false, {});
+    recordChange(ChangeKind::Cleared, 0);
+}
+
+// Re-extracts the key attributes of the Item at the given handle, updates the query index if they changed,
+// and reschedules its expiry. Called whenever the dataset of an Item may have been modified.
+void DICOMWorklistSCP::Worklist::refreshItem(Handle handle)
+{
+    Item* item = (*this)[handle];
+    if (!item) return;
+
+    DcmDataset scratch;
+    DcmDataset* dataset = view(*item, scratch);
+    if (!dataset) return;
+
+    ItemKeys keys;
+    ItemKeys::extract(*dataset, values_, keys);
+    if (!(keys == item->keys_))
+    {
+        index_.erase(handle, item->keys_, values_);
+        item->keys_ = keys;
+        index_.insert(handle, item->keys_, values_);
+    }
+
+    scheduleExpiry(handle);
+}
+
+// Drops an Item that is about to leave the worklist from the query index and the index sidecar.
+void DICOMWorklistSCP::Worklist::forget(Handle handle, Item& item)
+{
+    index_.erase(handle, item.keys_, values_);
+    if (item.sidecarSlot_ >= 0)
+    {
+        clearSidecarRecord(item.sidecarSlot_);
+        item.sidecarSlot_ = -1;
+    }
+}
+
+// ------------------------------------------------ Compact items ------------------------------------------------
+
+// Whether the Item holds content, as a dataset or packed.
+bool DICOMWorklistSCP::Worklist::present(const Item& item) const
+{
+    return item.dataset_ || item.compact_;
+}
+
+// Returns the content of an Item for reading: its dataset if it is materialized, otherwise its packed elements
+// decoded into 'scratch', limited to the top-level elements in 'tags' if given (see CompactItem::unpack()).
+// The result stays valid while 'scratch' and the Item are unchanged.
+// Returns nullptr if the Item has no content or could not be decoded.
+DcmDataset* DICOMWorklistSCP::Worklist::view(const Item& item, DcmDataset& scratch, const std::vector<Uint32>* tags) const
+{
+    if (item.dataset_) return item.dataset_.get();
+    if (!item.compact_) return nullptr;
+
+    scratch.clear();
+    return item.compact_.unpack(scratch, tags) ? &scratch : nullptr;
+}
+
+// Gives the Item at the given handle a dataset of its own that can be modified: a dataset shared with the template
+// is copied (see own()) and a packed Item is unpacked. In compact mode the Item is packed again by the next
+// packPending() once nobody else references its dataset.
+// Returns the dataset, or nullptr if the handle is stale or the Item has no content.
+DcmDataset* DICOMWorklistSCP::Worklist::materialize(Handle handle)
+{
+    Item* item = (*this)[handle];
+    if (!item || !present(*item)) return nullptr;
+
+    own(*item);
+    DcmDataset* dataset = unpack(*item);
+    if (dataset && compactItems_) unpacked_.push_back(handle);
+    return dataset;
+}
+
+// Materializes the Item at the given handle like materialize() and pins it, so that it is not packed
+// while the host holds the returned pointer (see DICOMWorklistSCP::pinDataset()).
+// Returns the dataset, or nullptr if the handle is stale or the Item has no content.
+DcmDataset* DICOMWorklistSCP::Worklist::pin(Handle handle)
+{
+    DcmDataset* dataset = materialize(handle);
+    if (dataset) (*this)[handle]->pinned_ = true;
+    return dataset;
+}
+
+// Unpins the Item at the given handle and queues it for packing in compact mode.
+// Returns false if the handle is stale.
+bool DICOMWorklistSCP::Worklist::unpin(Handle handle)
+{
+    Item* item = (*this)[handle];
+    if (!item) return false;
+
+    item->pinned_ = false;
+    if (compactItems_) unpacked_.push_back(handle);
+    return true;
+}
+
+// Packs the Items materialized since the last call. Items whose dataset the host still holds
+// (see DICOMWorklistSCP::getDataset()) stay materialized and are tried again on the next call;
+// pinned Items wait for unpin() instead.
+void DICOMWorklistSCP::Worklist::packPending()
+{
+    if (unpacked_.empty()) return;
+
+    std::vector<Handle> pending;
+    pending.swap(unpacked_);
+    std::sort(pending.begin(), pending.end());
+    pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+
+    for (Handle handle : pending)
+    {
+        Item* item = (*this)[handle];
+        if (item && compactItems_ && !pack(*item) && !item->pinned_) unpacked_.push_back(handle);
+    }
+}
+
+// Switches between packed and materialized Items. Enabling packs every Item that is neither shared with
+// the template nor held by the host; held Items follow with packPending(). Disabling unpacks all Items.
+void DICOMWorklistSCP::Worklist::setCompactItems(bool enable)
+{
+    compactItems_ = enable;
+    unpacked_.clear();
+
+    for (auto [handle, item] : *this)
+    {
+        if (!enable)
+        {
+            unpack(*item);
+        }
+        else if (!pack(*item) && !item->shared_ && !item->pinned_)
+        {
+            unpacked_.push_back(handle);
+        }
+    }
+}
+
+// Replaces the dataset of an Item by its packed form. Items sharing the template prototype, pinned Items and
+// datasets referenced outside the Item stay materialized, as do datasets that cannot be encoded.
+// Returns true if the Item is packed afterwards or has no dataset.
+bool DICOMWorklistSCP::Worklist::pack(Item& item)
+{
+    if (!item.dataset_) return true;
+    if (item.shared_ || item.pinned_ || !item.dataset_.unique()) return false;
+
+    CompactItem compact;
+    if (!CompactItem::pack(*item.dataset_, compact)) return false;
+
+    item.compact_ = std::move(compact);
+    item.dataset_ = nullptr;
+    return true;
+}
+
+// Turns a packed Item back into a dataset and drops the packed form.
+// Returns the dataset of the Item, or nullptr if it has no content or could not be decoded.
+DcmDataset* DICOMWorklistSCP::Worklist::unpack(Item& item)
+{
+    if (!item.dataset_ && item.compact_)
+    {
+        DatasetPtr dataset(new SharedDataset());
+        if (!item.compact_.unpack(*dataset)) return nullptr;
+
+        item.dataset_ = dataset;
+        item.compact_ = CompactItem();
+    }
+    return item.dataset_.get();
+}
+
+// ------------------------------------------------ Saving logic -------------------------------------------------
+
+// Marks the dataset at the given handle as dirty, indicating it has been modified
+// and needs to be saved to disk.
+// Returns true if the handle is valid and the flag was successfully set; false otherwise.
+bool DICOMWorklistSCP::Worklist::markDatasetDirty(Handle handle)
+{
+    Item* item = (*this)[handle];
+    if (!item) return false;
+
+    item->dirty_ = true;
+    refreshItem(handle);
+    recordChange(ChangeKind::Modified, handle);
+    return true;
+}
+
+// Applies selected top-level elements of a source dataset to the Item at the given handle.
+// Elements listed in 'changed' are copied from the source, replacing existing ones;
+// elements listed in 'removed' are deleted. The Item is marked dirty afterwards.
+// Returns true if the handle is valid; false otherwise.
+bool DICOMWorklistSCP::Worklist::applyChanges(Handle handle, DcmDataset& source, const std::vector<Uint32>& changed, const std::vector<Uint32>& removed)
+{
+    DcmDataset* dataset = materialize(handle);
+    if (!dataset) return false;
+    Item* item = (*this)[handle];
+
+    for (Uint32 tag : changed)
+    {
+        DcmElement* element = nullptr;
+        DcmTagKey key(static_cast<Uint16>(tag >> 16), static_cast<Uint16>(tag & 0xFFFF));
+        if (source.findAndGetElement(key, element).good() && element)
+        {
+            dataset->insert(OFstatic_cast(DcmElement*, element->clone()), OFTrue);
+        }
+    }
+
+    for (Uint32 tag : removed)
+    {
+        dataset->findAndDeleteElement(DcmTagKey(static_cast<Uint16>(tag >> 16), static_cast<Uint16>(tag & 0xFFFF)));
+    }
+
+    item->dirty_ = true;
+    refreshItem(handle);
+    recordChange(ChangeKind::Modified, handle);
+    return true;
+}
+
+// Saves the dataset associated with the given handle to disk in explicit little-endian format.
+// In delta mode, only the elements changed since the last save are appended to the delta log;
+// datasets that were never written before are always saved as a complete file.
+// If saving fails, an error message is reported via the provided SCPStatus object.
+// On success, the dataset is marked as not dirty.
+// Returns true if the save operation succeeded; false otherwise.
+bool DICOMWorklistSCP::Worklist::saveDatasetInFile(Handle handle, SCPStatus& serverStatus)
+{
+    Item* item = (*this)[handle];
+    if (!item || !present(*item)) return false;
+
+    if (persistMode_ == PersistMode::Delta && item->tracked_)
+    {
+        std::vector<Uint8> record;
+        std::unordered_map<Uint32, Uint64> current;
+        if (buildDeltaRecord(*item, record, current))
+        {
+            if (!appendDeltaRecords(record, serverStatus)) return false;
+
+            item->persisted_.swap(current);
+            item->logged_ = true;
+            item->dirty_ = false;
+            recordChange(ChangeKind::Flushed, handle);
+            compactIfNeeded(serverStatus);
+            return true;
+        }
+
+        // Either nothing changed, or the delta could not be encoded and tracking was dropped
+        if (item->tracked_)
+        {
+            item->dirty_ = false;
+            recordChange(ChangeKind::Flushed, handle);
+            return true;
+        }
+    }
+
+    if (!writeFullFile(*item, serverStatus)) return false;
+
+    recordChange(ChangeKind::Flushed, handle);
+    return true;
+}
+
+// Saves all datasets currently loaded in the worklist to disk using explicit little-endian encoding.
+// Each dataset is written to its assigned filename under the configured data folder.
+// Since every file is rewritten completely, the delta log becomes obsolete and is removed on success.
+// If any save operation fails, an error message is reported via the provided SCPStatus object,
+// and the method returns false. Otherwise, returns true on complete success.
+bool DICOMWorklistSCP::Worklist::saveAllDatasetsInFile(SCPStatus& serverStatus)
+{
+    bool success = true;
+    serverStatus.flushDone_ = 0;
+    serverStatus.flushTotal_ = count_;
+
+    for (auto [id, item] : *this)
+    {
+        if (!item || !present(*item)) continue;
+
+        if (writeFullFile(*item, serverStatus))
+        {
+            recordChange(ChangeKind::Flushed, id);
+        }
+        else
+        {
+            success = false;
+        }
+        serverStatus.flushDone_++;
+    }
+
+    if (success)
+    {
+        std::error_code ec;
+        std::filesystem::remove(dataFolder_ + deltaLogName_, ec);
+    }
+
+    return success;
+}
+
+// Saves all dirty datasets (marked as modified) in the worklist to disk using explicit little-endian format.
+// Only Items with dirty_ == true are saved. In delta mode, the changes of all tracked Items are
+// collected first and appended to the delta log with a single write.
+// If any save operation fails, an error message is reported via the provided SCPStatus object,
+// and the method returns false. Otherwise, returns true on complete success.
+bool DICOMWorklistSCP::Worklist::saveDirtyDatasetsInFile(SCPStatus& serverStatus)
+{
+    std::vector<Handle> handles;
+    for (auto [id, item] : *this)
+    {
+        if (item->dirty_) handles.push_back(id);
+    }
+
+    return saveDatasetsInFile(handles, serverStatus);
+}
+
+// Saves the dirty datasets among the given handles as one group commit.
+// Handles that are no longer valid or whose Items are clean are skipped. In delta mode, the changes
+// of all tracked Items are collected first and appended to the delta log with a single write.
+// Returns false if any save operation failed; errors are reported via SCPStatus.
+bool DICOMWorklistSCP::Worklist::saveDatasetsInFile(const std::vector<Handle>& handles, SCPStatus& serverStatus)
+{
+    bool success = true;
+
+    std::vector<Uint8> records;
+    std::vector<std::pair<Handle, std::unordered_map<Uint32, Uint64>>> pending;
+
+    serverStatus.flushDone_ = 0;
+    serverStatus.flushTotal_ = static_cast<int>(handles.size());
+
+    for (Handle handle : handles)
+    {
+        serverStatus.flushDone_++;
+        Item* item = (*this)[handle];
+        if (!item || !present(*item) || !item->dirty_) continue;
+
+        if (persistMode_ == PersistMode::Delta && item->tracked_)
+        {
+            std::unordered_map<Uint32, Uint64> current;
+            if (buildDeltaRecord(*item, records, current))
+            {
+                pending.emplace_back(handle, std::move(current));
+                continue;
+            }
+
+            if (item->tracked_)
+            {
+                item->dirty_ = false;
+                recordChange(ChangeKind::Flushed, handle);
+                continue;
+            }
+        }
+
+        if (writeFullFile(*item, serverStatus))
+        {
+            recordChange(ChangeKind::Flushed, handle);
+        }
+        else
+        {
+            success = false;
+        }
+    }
+
+    if (!pending.empty())
+    {
+        if (appendDeltaRecords(records, serverStatus))
+        {
+            for (auto& [handle, current] : pending)
+            {
+                Item* item = (*this)[handle];
+                item->persisted_.swap(current);
+                item->logged_ = true;
+                item->dirty_ = false;
+                recordChange(ChangeKind::Flushed, handle);
+            }
+            compactIfNeeded(serverStatus);
+        }
+        else
+        {
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+// Switches between full-file and delta persistence.
+// Entering delta mode records the fingerprints of all clean Items, so their next save can be written as a delta.
+// Dirty Items are left untracked and get one full write first, as their on-disk state is unknown.
+// Leaving delta mode compacts the log, so full saves never compete with older log records.
+// Returns false if the required compaction failed; the worklist stays in delta mode then.
+bool DICOMWorklistSCP::Worklist::setPersistMode(PersistMode mode, SCPStatus& serverStatus)
+{
+    if (mode == persistMode_) return true;
+
+    if (mode == PersistMode::Full)
+    {
+        if (!compact(serverStatus)) return false;
+
+        for (auto [id, item] : *this)
+        {
+            item->persisted_.clear();
+            item->tracked_ = false;
+        }
+    }
+    else
+    {
+        DcmDataset scratch;
+        for (auto [id, item] : *this)
+        {
+            if (item->dirty_) continue;
+            DcmDataset* dataset = view(*item, scratch);
+            if (!dataset) continue;
+
+            DatasetCodec::fingerprintAll(*dataset, item->persisted_);
+            item->tracked_ = true;
+        }
+    }
+
+    persistMode_ = mode;
+    return true;
+}
+
+// Folds the delta log into the dataset files.
+// Every Item with logged changes is rewritten as a complete file; the log is removed once all rewrites succeeded.
+// Replaying a log over already compacted files yields the same state, so an interrupted compaction is harmless.
+// Returns true if the log was folded completely.
+bool DICOMWorklistSCP::Worklist::compact(SCPStatus& serverStatus)
+{
+    bool success = true;
+
+    for (auto [id, item] : *this)
+    {
+        if (!item || !present(*item) || !item->logged_) continue;
+
+        if (!writeFullFile(*item, serverStatus))
+        {
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        std::error_code ec;
+        std::filesystem::remove(dataFolder_ + deltaLogName_, ec);
+    }
+
+    return success;
+}
+
+// Writes the complete dataset of an Item to its file and resets its dirty and delta state.
+// The dataset is written to a temp file first and renamed over the previous version,
+// so an interrupted save never leaves a truncated dataset file behind.
+// The new stamp of the file makes all delta records written against the previous version obsolete,
+// even if they stay in the log because a compaction failed (see replayDeltaLog()).
+// In delta mode, the fingerprints of the written elements are recorded for later delta saves.
+// The record of the Item in the index sidecar is updated to match the new file.
+// Returns true on success; otherwise reports the failure via SCPStatus.
+bool DICOMWorklistSCP::Worklist::writeFullFile(Item& item, SCPStatus& serverStatus)
+{
+    std::string fileName = fileNameOf(item.id_);
+    std::string path = dataFolder_ + fileName;
+    std::string tempPath = path + TempSuffix;
+    DcmDataset scratch;
+    DcmDataset* dataset = view(item, scratch);
+    OFCondition status = dataset ? dataset->saveFile(tempPath.c_str(), EXS_LittleEndianExplicit) : EC_CorruptedData;
+
+    std::error_code ec;
+    if (status.good())
+    {
+        std::filesystem::rename(tempPath, path, ec);
+    }
+
+    if (status.bad() || ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+        serverStatus.error(StatusError::Save, "Failed to save: " + fileName);
+        return false;
+    }
+
+    // Without a stamp, delta records could not be matched to this file; the next save writes it in full again
+    bool stamped = fileStamp(path, item.fileSize_, item.fileTime_);
+    if (!stamped) item.fileSize_ = item.fileTime_ = 0;
+
+    item.dirty_ = false;
+    item.logged_ = false;
+    item.tracked_ = persistMode_ == PersistMode::Delta && stamped;
+    if (item.tracked_)
+    {
+        DatasetCodec::fingerprintAll(*dataset, item.persisted_);
+    }
+    else
+    {
+        item.persisted_.clear();
+    }
+
+    ItemKeys keys;
+    ItemKeys::extract(*dataset, values_, keys);
+    writeSidecarRecord(item, keys);
+    return true;
+}
+
+// Compares the current elements of an Item with its persisted fingerprints and appends a delta record
+// holding the changed elements and the tags of removed elements to the given buffer.
+// Record layout: magic (4), payload length (4), payload checksum (8), then the payload made of
+// item ID (8), size (8) and modification time (8) of the dataset file the record applies to,
+// removed tag count (4), removed tags (4 each) and the changed elements encoded as an explicit little-endian dataset.
+// The new fingerprints are returned via 'current' and must be applied once the record is written.
+// Returns false if nothing changed; if the changes cannot be encoded, the Item is also untracked.
+bool DICOMWorklistSCP::Worklist::buildDeltaRecord(Item& item, std::vector<Uint8>& records, std::unordered_map<Uint32, Uint64>& current)
+{
+    DcmDataset scratch;
+    DcmDataset* dataset = view(item, scratch);
+    if (!dataset)
+    {
+        item.tracked_ = false;
+        return false;
+    }
+
+    DatasetCodec::fingerprintAll(*dataset, current);
+
+    DcmDataset changed;
+    for (unsigned long i = 0; i < dataset->card(); i++)
+    {
+        DcmElement* element = dataset->getElement(i);
+        Uint32 tag = tagKeyOf(*element);
+
+        auto it = item.persisted_.find(tag);
+        if (it == item.persisted_.end() || it->second != current[tag])
+        {
+            changed.insert(OFstatic_cast(DcmElement*, element->clone()), OFTrue);
+        }
+    }
+
+    std::vector<Uint32> removed;
+    for (const auto& [tag, fingerprint] : item.persisted_)
+    {
+        if (current.find(tag) == current.end())
+        {
+            removed.push_back(tag);
+        }
+    }
+
+    if (changed.card() == 0 && removed.empty()) return false;
+
+    std::vector<Uint8> encoded;
+    if (!DatasetCodec::encode(changed, encoded))
+    {
+        item.tracked_ = false;
+        return false;
+    }
+
+    std::vector<Uint8> payload;
+    payload.reserve(8 + 16 + 4 + 4 * removed.size() + encoded.size());
+    putLE(payload, item.id_, 8);
+    putLE(payload, item.fileSize_, 8);
+    putLE(payload, item.fileTime_, 8);
+    putLE(payload, removed.size(), 4);
+    for (Uint32 tag : removed)
+    {
+        putLE(payload, tag, 4);
+    }
+    payload.insert(payload.end(), encoded.begin(), encoded.end());
+
+    putLE(records, DeltaRecordMagic, 4);
+    putLE(records, payload.size(), 4);
+    putLE(records, fnv1a(payload.data(), payload.size()), 8);
+    records.insert(records.end(), payload.begin(), payload.end());
+    return true;
+}
+
+// Appends one or more encoded delta records to the delta log with a single write.
+// Returns true if the records were written and flushed; otherwise reports the failure via SCPStatus.
+bool DICOMWorklistSCP::Worklist::appendDeltaRecords(const std::vector<Uint8>& records, SCPStatus& serverStatus)
+{
+    std::ofstream log(dataFolder_ + deltaLogName_, std::ios::binary | std::ios::app);
+    log.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size()));
+    log.flush();
+
+    if (!log)
+    {
+        serverStatus.error(StatusError::DeltaLog, "Failed to append to delta log: " + deltaLogName_);
+        return false;
+    }
+    return true;
+}
+
+// Compacts the delta log once it has grown beyond compactThreshold_.
+void DICOMWorklistSCP::Worklist::compactIfNeeded(SCPStatus& serverStatus)
+{
+    std::error_code ec;
+    auto size = std::filesystem::file_size(dataFolder_ + deltaLogName_, ec);
+    if (!ec && size >= compactThreshold_)
+    {
+        compact(serverStatus);
+    }
+}
+
+// Applies all intact records of the delta log to the loaded Items, in the order they were written.
+// Records of Items that no longer exist are skipped, as are records stamped with another version of the
+// dataset file: the file was rewritten in full after them and already holds their changes. A torn or corrupted tail, e.g. from a crash
+// during an append, ends the replay and is cut off the log, which is reported via SCPStatus.
+// Replayed Items are flagged as logged so that the following compaction rewrites their files,
+// and their key attributes are extracted again.
+void DICOMWorklistSCP::Worklist::replayDeltaLog(SCPStatus& serverStatus)
+{
+    std::string path = dataFolder_ + deltaLogName_;
+    std::vector<Uint8> log;
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return;
+        log.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::unordered_map<Uint64, Item*> itemsById;
+    for (auto [handle, item] : *this)
+    {
+        itemsById[item->id_] = item;
+    }
+
+    size_t offset = 0;
+    while (offset + DeltaRecordHeaderSize <= log.size())
+    {
+        const Uint8* header = log.data() + offset;
+        size_t length = static_cast<size_t>(getLE(header + 4, 4));
+        Uint32 magic = static_cast<Uint32>(getLE(header, 4));
+        if (magic != DeltaRecordMagic || length < 28 || length > log.size() - offset - DeltaRecordHeaderSize) break;
+
+        const Uint8* payload = header + DeltaRecordHeaderSize;
+        if (fnv1a(payload, length) != getLE(header + 8, 8)) break;
+
+        const Uint8* end = payload + length;
+        const Uint8* cursor = payload;
+
+        Uint64 id = getLE(cursor, 8);
+        Uint64 fileSize = getLE(cursor + 8, 8);
+        Uint64 fileTime = getLE(cursor + 16, 8);
+        cursor += 24;
+
+        size_t removedCount = static_cast<size_t>(getLE(cursor, 4));
+        cursor += 4;
+        if (static_cast<size_t>(end - cursor) / 4 < removedCount) break;
+
+        // Files whose stamp could not be read at startup take all their records
+        auto it = itemsById.find(id);
+        bool current = it != itemsById.end()
+            && (it->second->fileTime_ == 0 || (it->second->fileSize_ == fileSize && it->second->fileTime_ == fileTime));
+        if (current && unpack(*it->second))
+        {
+            Item* item = it->second;
+            for (size_t i = 0; i < removedCount; i++)
+            {
+                Uint32 tag = static_cast<Uint32>(getLE(cursor + 4 * i, 4));
+                item->dataset_->findAndDeleteElement(DcmTagKey(static_cast<Uint16>(tag >> 16), static_cast<Uint16>(tag & 0xFFFF)));
+            }
+
+            const Uint8* elements = cursor + 4 * removedCount;
+            DcmDataset changed;
+            if (elements < end && !DatasetCodec::decode(elements, end - elements, changed)) break;
+
+            for (unsigned long i = 0; i < changed.card(); i++)
+            {
+                item->dataset_->insert(OFstatic_cast(DcmElement*, changed.getElement(i)->clone()), OFTrue);
+            }
+            item->logged_ = true;
+            ItemKeys::extract(*item->dataset_, values_, item->keys_);
+        }
+
+        offset += DeltaRecordHeaderSize + length;
+        serverStatus.recovery_.deltaReplayed_++;
+    }
+
+    if (offset < log.size())
+    {
+        serverStatus.recovery_.deltaDiscardedBytes_ = log.size() - offset;
+        serverStatus.error(StatusError::DeltaLog, "[Worklist] Discarded damaged delta log tail at byte " + std::to_string(offset));
+        std::error_code ec;
+        std::filesystem::resize_file(path, offset, ec);
+    }
+}
+
+// ------------------------------------------------- Change feed -------------------------------------------------
+
+// Appends a change event to the ring under the generation the next publication will assign.
+// Once the ring is full, the oldest event is overwritten and its generation remembered,
+// so that hosts which have not seen it yet are told to resynchronize.
+// A modified item also drops its read snapshot, so the next read guard encodes it afresh.
+void DICOMWorklistSCP::Worklist::recordChange(ChangeKind kind, Handle handle)
+{
+    if (kind == ChangeKind::Modified)
+    {
+        Item* item = (*this)[handle];
+        if (item) item->snapshot_.reset();
+    }
+
+    ChangeEvent event = { generation_ + 1, handle, kind };
+    if (changes_.size() < ChangeCapacity)
+    {
+        changes_.push_back(event);
+    }
+    else
+    {
+        droppedGeneration_ = changes_[changeHead_].generation_;
+        changes_[changeHead_] = event;
+        changeHead_ = (changeHead_ + 1) % ChangeCapacity;
+    }
+    changesPending_ = true;
+}
+
+// Copies the published events after generation 'since' from the ring, oldest first (see DICOMWorklistSCP::getChanges()).
+// Events recorded but not yet published are never returned.
+void DICOMWorklistSCP::Worklist::changesSince(Uint64 since, ChangeEvent* events, int capacity, int& count, Uint64& generation, bool& resync) const
+{
+    count = 0;
+    generation = generation_;
+    resync = since < droppedGeneration_ || since > generation_;
+    if (resync) return;
+
+    bool truncated = false;
+    for (size_t i = 0; i < changes_.size(); i++)
+    {
+        const ChangeEvent& event = changes_[(changeHead_ + i) % changes_.size()];
+        if (event.generation_ <= since || event.generation_ > generation_) continue;
+
+        if (count == capacity)
+        {
+            truncated = true;
+            break;
+        }
+        events[count++] = event;
+    }
+
+    if (!truncated) return;
+
+    // Return only complete generations, so the next call can continue after the last one
+    Uint64 last = events[count - 1].generation_;
+    while (count > 0 && events[count - 1].generation_ == last) count--;
+
+    if (count == 0)
+    {
+        // A single generation holds more events than the caller can take
+        resync = true;
+        return;
+    }
+    generation = events[count - 1].generation_;
+}
+
+// Discards all recorded events, e.g. those produced while loading the data folder at startup.
+// Hosts that remembered a generation of an earlier session are told to resynchronize.
+void DICOMWorklistSCP::Worklist::resetChanges()
+{
+    changes_.clear();
+    changeHead_ = 0;
+    changesPending_ = false;
+    droppedGeneration_ = ++generation_;
+}
+
+// -------------------------------------------------- Retention --------------------------------------------------
+
+// Applies new retention settings and reschedules every Item in the timing wheel.
+// Items hidden under a previous policy become visible again until they expire under the new one.
+void DICOMWorklistSCP::Worklist::setRetention(RetentionPolicy policy, Sint64 retentionMinutes, const std::string& archiveFolder)
+{
+    retentionPolicy_ = policy;
+    retentionMinutes_ = retentionMinutes;
+    archiveFolder_ = archiveFolder;
+
+    wheel_.clear();
+    for (auto [id, item] : *this)
+    {
+        item->expiry_ = -1;
+        item->hidden_ = false;
+        scheduleExpiry(id);
+    }
+}
+
+// Computes the expiry of the Item at the given handle and schedules it in the timing wheel.
+// Nothing happens if the expiry did not change. Outdated wheel entries are not removed;
+// they are recognized by their differing expiry and skipped when they become due.
+void DICOMWorklistSCP::Worklist::scheduleExpiry(Handle handle)
+{
+    Item* item = (*this)[handle];
+    if (!item) return;
+
+    DcmDataset scratch;
+    DcmDataset* dataset = view(*item, scratch);
+    if (!dataset) return;
+
+    Sint64 expiry = expiryOf(*dataset);
+    if (expiry == item->expiry_) return;
+
+    item->expiry_ = expiry;
+    item->hidden_ = false;
+    if (expiry >= 0)
+    {
+        wheel_.insert({ handle, expiry });
+    }
+}
+
+// Advances the timing wheel to 'now' and applies the retention policy to all Items that became due.
+// Entries of deleted or rescheduled Items are skipped. Items that fail to archive are retried on the next run.
+// Returns the number of expired Items.
+int DICOMWorklistSCP::Worklist::expire(Sint64 now, SCPStatus& serverStatus)
+{
+    std::vector<TimingWheel::Entry> due;
+    wheel_.advance(now, due);
+
+    int expired = 0;
+    for (const auto& entry : due)
+    {
+        Item* item = (*this)[entry.handle_];
+        if (!item || item->expiry_ != entry.expiry_ || item->hidden_) continue;
+
+        switch (retentionPolicy_)
+        {
+        case RetentionPolicy::Purge:
+            if (remove(entry.handle_)) expired++;
+            break;
+
+        case RetentionPolicy::Archive:
+            if (archive(entry.handle_, serverStatus))
+            {
+                expired++;
+            }
+            else
+            {
+                wheel_.insert(entry);
+            }
+            break;
+
+        case RetentionPolicy::Hide:
+            item->hidden_ = true;
+            recordChange(ChangeKind::Modified, entry.handle_);
+            expired++;
+            break;
+
+        case RetentionPolicy::Keep:
+            break;
+        }
+    }
+
+    return expired;
+}
+
+// Returns the expiry minute of a dataset: the latest ScheduledProcedureStepStartDate/Time of all
+// scheduled procedure steps plus the retention period, or -1 if no step carries a valid start date.
+Sint64 DICOMWorklistSCP::Worklist::expiryOf(DcmDataset& dataset) const
+{
+    DcmSequenceOfItems* steps = nullptr;
+    if (dataset.findAndGetSequence(DCM_ScheduledProcedureStepSequence, steps).bad() || !steps) return -1;
+
+    Sint64 latest = -1;
+    for (unsigned long i = 0; i < steps->card(); i++)
+    {
+        DcmItem* step = steps->getItem(i);
+        OFString date, time;
+        if (!step || step->findAndGetOFString(DCM_ScheduledProcedureStepStartDate, date).bad()) continue;
+        step->findAndGetOFString(DCM_ScheduledProcedureStepStartTime, time);
+
+        Sint64 minutes = minutesFromDateTime(date, time);
+        if (minutes > latest) latest = minutes;
+    }
+
+    return latest < 0 ? -1 : latest + retentionMinutes_;
+}
+
+// Moves the file of the Item at the given handle into the archive folder and drops the Item from memory.
+// Unsaved or logged changes are written to the file first, so the archive holds the complete current state.
+// Returns true on success; otherwise reports the failure via SCPStatus and keeps the Item.
+bool DICOMWorklistSCP::Worklist::archive(Handle handle, SCPStatus& serverStatus)
+{
+    Item* item = (*this)[handle];
+    if (!item || !present(*item)) return false;
+
+    std::string fileName = fileNameOf(item->id_);
+    std::filesystem::path source = dataFolder_ + fileName;
+    std::filesystem::path target = std::filesystem::path(archiveFolder_) / fileName;
+
+    if (item->dirty_ || item->logged_ || !std::filesystem::exists(source))
+    {
+        if (!writeFullFile(*item, serverStatus)) return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(source, target, ec);
+    if (ec)
+    {
+        // Archive on another volume: fall back to copy and delete
+        ec.clear();
+        std::filesystem::copy_file(source, target, std::filesystem::copy_options::overwrite_existing, ec);
+        if (!ec) std::filesystem::remove(source, ec);
+    }
+
+    if (ec)
+    {
+        serverStatus.error(StatusError::Archive, "Failed to archive: " + fileName);
+        return false;
+    }
+
+    forget(handle, *item);
+    release(handle);
+    recordChange(ChangeKind::Removed, handle);
+    return true;
+}
+
+// ------------------------------------------------ Index sidecar ------------------------------------------------
+
+// Memory-maps the index sidecar and collects its valid records by file name.
+// Records whose checksum does not match are ignored; their files fall back to key extraction.
+// Returns false if the sidecar is missing or has an unknown format, in which case it is rebuilt.
+bool DICOMWorklistSCP::Worklist::readSidecar(std::unordered_map<std::string, SidecarRecord>& records)
+{
+    records.clear();
+    sidecarSlotCount_ = 0;
+
+    MappedFile file;
+    if (!file.open(dataFolder_ + sidecarName_) || file.size() < SidecarHeaderSize) return false;
+
+    const Uint8* header = file.data();
+    if (getLE(header, 4) != SidecarMagic
+        || getLE(header + 4, 4) != SidecarVersion
+        || getLE(header + 8, 4) != SidecarRecordSize
+        || getLE(header + 16, 8) != fnv1a(header, 16))
+    {
+        return false;
+    }
+
+    sidecarSlotCount_ = static_cast<int>((file.size() - SidecarHeaderSize) / SidecarRecordSize);
+    for (int slot = 0; slot < sidecarSlotCount_; slot++)
+    {
+        const Uint8* data = header + SidecarHeaderSize + slot * SidecarRecordSize;
+        if (getLE(data, 4) != 1) continue;
+        if (getLE(data + SidecarRecordSize - 8, 8) != fnv1a(data, SidecarRecordSize - 8)) continue;
+
+        SidecarRecord record;
+        record.slot_ = slot;
+        record.hasKeys_ = true;
+
+        size_t dateCount = static_cast<size_t>(getLE(data + 4, 2));
+        size_t stationCount = static_cast<size_t>(getLE(data + 6, 2));
+        if (dateCount > SidecarMaxSteps || stationCount > SidecarMaxSteps) continue;
+
+        record.fileSize_ = getLE(data + 8, 8);
+        record.fileTime_ = getLE(data + 16, 8);
+        const Uint8* cursor = data + 24;
+
+        std::string fileName = getFixed(cursor, SidecarFileNameWidth);
+        cursor += SidecarFileNameWidth;
+        record.keys_.patientId_ = getFixed(cursor, SidecarPatientIdWidth);
+        cursor += SidecarPatientIdWidth;
+        record.keys_.accession_ = getFixed(cursor, SidecarAccessionWidth);
+        cursor += SidecarAccessionWidth;
+        for (size_t i = 0; i < dateCount; i++)
+        {
+            record.keys_.dates_.push_back(values_.intern(getFixed(cursor + i * SidecarDateWidth, SidecarDateWidth).c_str()));
+        }
+        cursor += SidecarMaxSteps * SidecarDateWidth;
+        for (size_t i = 0; i < stationCount; i++)
+        {
+            record.keys_.stations_.push_back(values_.intern(getFixed(cursor + i * SidecarStationWidth, SidecarStationWidth).c_str()));
+        }
+        cursor += SidecarMaxSteps * SidecarStationWidth;
+        size_t modalityCount = static_cast<size_t>(getLE(cursor, 4));
+        if (modalityCount > SidecarMaxSteps) continue;
+        cursor += 4;
+        for (size_t i = 0; i < modalityCount; i++)
+        {
+            record.keys_.modalities_.push_back(values_.intern(getFixed(cursor + i * SidecarModalityWidth, SidecarModalityWidth).c_str()));
+        }
+
+        records[fileName] = record;
+    }
+
+    return true;
+}
+
+// Opens the index sidecar for incremental updates once all files are loaded.
+// An invalid sidecar is replaced by an empty one. Slots not claimed by a loaded Item are cleared
+// and reused later, and Items without a current record get one written.
+void DICOMWorklistSCP::Worklist::openSidecar(bool valid, const std::unordered_map<std::string, SidecarRecord>& records)
+{
+    std::string path = dataFolder_ + sidecarName_;
+    sidecar_.close();
+    freeSidecarSlots_.clear();
+
+    if (!valid)
+    {
+        std::vector<Uint8> header;
+        putLE(header, SidecarMagic, 4);
+        putLE(header, SidecarVersion, 4);
+        putLE(header, SidecarRecordSize, 4);
+        putLE(header, 0, 4);
+        putLE(header, fnv1a(header.data(), 16), 8);
+        header.resize(SidecarHeaderSize, 0);
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+        sidecarSlotCount_ = 0;
+    }
+
+    sidecar_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!sidecar_) return;
+
+    std::vector<bool> claimed(sidecarSlotCount_, false);
+    for (auto [id, item] : *this)
+    {
+        if (item->sidecarSlot_ >= 0) claimed[item->sidecarSlot_] = true;
+    }
+
+    std::vector<bool> used(sidecarSlotCount_, false);
+    for (const auto& [fileName, record] : records)
+    {
+        used[record.slot_] = true;
+    }
+
+    for (int slot = 0; slot < sidecarSlotCount_; slot++)
+    {
+        if (claimed[slot]) continue;
+        if (used[slot])
+        {
+            clearSidecarRecord(slot);
+        }
+        else
+        {
+            freeSidecarSlots_.insert(slot);
+        }
+    }
+
+    for (auto [id, item] : *this)
+    {
+        if (item->sidecarSlot_ < 0) writeSidecarRecord(*item, item->keys_);
+    }
+    sidecar_.flush();
+}
+
+// Writes the sidecar record of an Item with the given keys and the size and time of its file as last written or loaded.
+// The Item is assigned a free slot if it has none yet. Keys that do not fit the fixed-size fields
+// are not stored; the record is cleared instead and the keys are extracted from the file on the next startup.
+void DICOMWorklistSCP::Worklist::writeSidecarRecord(Item& item, const ItemKeys& keys)
+{
+    if (!sidecar_.is_open()) return;
+
+    std::string fileName = fileNameOf(item.id_);
+    bool fits = item.fileTime_ != 0
+        && fileName.size() <= SidecarFileNameWidth
+        && keys.patientId_.size() <= SidecarPatientIdWidth
+        && keys.accession_.size() <= SidecarAccessionWidth
+        && keys.dates_.size() <= SidecarMaxSteps
+        && keys.stations_.size() <= SidecarMaxSteps
+        && keys.modalities_.size() <= SidecarMaxSteps;
+    for (Uint32 date : keys.dates_) fits = fits && values_.value(date).size() <= SidecarDateWidth;
+    for (Uint32 station : keys.stations_) fits = fits && values_.value(station).size() <= SidecarStationWidth;
+    for (Uint32 modality : keys.modalities_) fits = fits && values_.value(modality).size() <= SidecarModalityWidth;
+
+    if (!fits)
+    {
+        if (item.sidecarSlot_ >= 0)
+        {
+            clearSidecarRecord(item.sidecarSlot_);
+            item.sidecarSlot_ = -1;
+        }
+        return;
+    }
+
+    if (item.sidecarSlot_ < 0)
+    {
+        if (freeSidecarSlots_.empty())
+        {
+            item.sidecarSlot_ = sidecarSlotCount_++;
+        }
+        else
+        {
+            item.sidecarSlot_ = *freeSidecarSlots_.begin();
+            freeSidecarSlots_.erase(freeSidecarSlots_.begin());
+        }
+    }
+
+    std::vector<Uint8> record;
+    record.reserve(SidecarRecordSize);
+    putLE(record, 1, 4);
+    putLE(record, keys.dates_.size(), 2);
+    putLE(record, keys.stations_.size(), 2);
+    putLE(record, item.fileSize_, 8);
+    putLE(record, item.fileTime_, 8);
+    putFixed(record, fileName, SidecarFileNameWidth);
+    putFixed(record, keys.patientId_, SidecarPatientIdWidth);
+    putFixed(record, keys.accession_, SidecarAccessionWidth);
+    for (size_t i = 0; i < SidecarMaxSteps; i++)
+    {
+        putFixed(record, i < keys.dates_.size() ? values_.value(keys.dates_[i]) : std::string(), SidecarDateWidth);
+    }
+    for (size_t i = 0; i < SidecarMaxSteps; i++)
+    {
+        putFixed(record, i < keys.stations_.size() ? values_.value(keys.stations_[i]) : std::string(), SidecarStationWidth);
+    }
+    putLE(record, keys.modalities_.size(), 4);
+    for (size_t i = 0; i < SidecarMaxSteps; i++)
+    {
+        putFixed(record, i < keys.modalities_.size() ? values_.value(keys.modalities_[i]) : std::string(), SidecarModalityWidth);
+    }
+    putLE(record, fnv1a(record.data(), record.size()), 8);
+
+    sidecar_.clear();
+    sidecar_.seekp(SidecarHeaderSize + static_cast<std::streamoff>(item.sidecarSlot_) * SidecarRecordSize);
+    sidecar_.write(reinterpret_cast<const char*>(record.data()), record.size());
+    sidecar_.flush();
+}
+
+// Marks a sidecar slot as unused and returns it to the pool of free slots.
+void DICOMWorklistSCP::Worklist::clearSidecarRecord(int slot)
+{
+    freeSidecarSlots_.insert(slot);
+    if (!sidecar_.is_open()) return;
+
+    std::vector<Uint8> record(SidecarRecordSize - 8, 0);
+    putLE(record, fnv1a(record.data(), record.size()), 8);
+
+    sidecar_.clear();
+    sidecar_.seekp(SidecarHeaderSize + static_cast<std::streamoff>(slot) * SidecarRecordSize);
+    sidecar_.write(reinterpret_cast<const char*>(record.data()), record.size());
+    sidecar_.flush();
+}
+
+// ----------------------------------------------- DIMSE Handling ------------------------------------------------
+
+// Runs a C-FIND query against the worklist and calls 'visit' for every matching Item with the dataset it matched.
+// Candidates are preselected via the query index when the query carries an indexed key,
+// otherwise all Items are scanned in slot order. Items hidden by the retention policy never match.
+// Compact Items are matched on a decoded copy holding only the top-level elements of the query,
+// SpecificCharacterSet and the elements in 'extraTags'; the copy is only valid during 'visit'.
+// Stops early if 'visit' returns false. Returns the number of visited Items.
+int DICOMWorklistSCP::Worklist::find(DcmDataset& query, const std::function<bool(Handle, const Item&, DcmDataset&)>& visit, const std::vector<Uint32>* extraTags) const
+{
+    std::vector<Handle> candidates;
+    if (!index_.select(query, values_, candidates))
+    {
+        candidates.reserve(count_);
+        for (auto [id, item] : *this)
+        {
+            candidates.push_back(id);
+        }
+    }
+
+    std::vector<Uint32> tags;
+    if (compactItems_)
+    {
+        CompactItem::tagsOf(query, tags);
+        if (extraTags)
+        {
+            tags.insert(tags.end(), extraTags->begin(), extraTags->end());
+            std::sort(tags.begin(), tags.end());
+            tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+        }
+    }
+
+    int matched = 0;
+    DcmDataset scratch;
+    for (Handle id : candidates)
+    {
+        const Item* item = (*this)[id];
+        if (!item || item->hidden_) continue;
+        DcmDataset* dataset = view(*item, scratch, compactItems_ ? &tags : nullptr);
+        if (!dataset || !QueryMatcher::matches(query, *dataset)) continue;
+
+        matched++;
+        if (!visit(id, *item, *dataset)) break;
+    }
+    return matched;
+}
+
+// Handles incoming DIMSE commands from the DICOM network association.
+// This method is invoked internally by the DcmSCP framework whenever a request is received.
+// Returns OFCondition::good() if all responses were sent; otherwise returns an error code.
+OFCondition DICOMWorklistSCP::handleIncomingCommand(
+    T_DIMSE_Message* incomingMsg,
+    const DcmPresentationContextInfo& presInfo)
+{
+    return serveCommand(*this, incomingMsg, presInfo);
+}
+
+// Serves a DIMSE command received by 'connection', the SCP itself or a Listener.
+// C-FIND requests are matched against the worklist: the responses are built under the lock,
+// then sent as pending responses followed by a final success response, outside the lock.
+// The number of responses is limited by the settings of the association (see Settings::maxMatches_);
+// a query with more matches ends with a Refused: Out of Resources status after the allowed responses.
+// A C-CANCEL received between two responses ends the query with a cancel status.
+// All other commands are passed on to DcmSCP.
+template <typename Connection>
+OFCondition DICOMWorklistSCP::serveCommand(
+    Connection& connection,
+    T_DIMSE_Message* incomingMsg,
+    const DcmPresentationContextInfo& presInfo)
+{
+    serverStatus_.requestCount_++;
+    serverStatus_.signal();
+    if (!incomingMsg)
+    {
+        return EC_IllegalCall;
+    }
+
+    if (incomingMsg->CommandField == DIMSE_C_FIND_RQ)
+    {
+        T_DIMSE_C_FindRQ& request = incomingMsg->msg.CFindRQ;
+        T_ASC_PresentationContextID presID = presInfo.presentationContextID;
+
+        DcmDataset* query = nullptr;
+        OFCondition status = connection.receiveFINDRequest(request, presID, query);
+        if (status.bad()) return status;
+        std::unique_ptr<DcmDataset> queryHolder(query);
+
+        std::shared_ptr<const Settings> settings = connection.associationSettings_ ? connection.associationSettings_ : getSettings();
+        size_t maxMatches = static_cast<size_t>(settings->maxMatches_);
+        auto limit = settings->maxMatchesByAE_.find(connection.getPeerAETitle().c_str());
+        if (limit != settings->maxMatchesByAE_.end()) maxMatches = static_cast<size_t>(limit->second);
+
+        std::vector<std::unique_ptr<DcmDataset>> responses;
+        bool truncated = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            datasets_.find(*query, [&](Handle, const Worklist::Item&, DcmDataset& dataset)
+            {
+                if (maxMatches > 0 && responses.size() == maxMatches)
+                {
+                    truncated = true;
+                    return false;
+                }
+
+                auto response = std::make_unique<DcmDataset>();
+                QueryMatcher::buildResponse(*query, dataset, *response);
+
+                DcmElement* charset = nullptr;
+                if (!response->tagExists(DCM_SpecificCharacterSet)
+                    && dataset.findAndGetElement(DCM_SpecificCharacterSet, charset).good() && charset)
+                {
+                    response->insert(OFstatic_cast(DcmElement*, charset->clone()), OFTrue);
+                }
+
+                responses.push_back(std::move(response));
+                return true;
+            });
+        }
+
+        for (auto& response : responses)
+        {
+            if (connection.checkForCANCEL(presID, request.MessageID) == EC_Normal)
+            {
+                return connection.sendFINDResponse(presID, request.MessageID, request.AffectedSOPClassUID, nullptr, STATUS_FIND_Cancel_MatchingTerminatedDueToCancelRequest);
+            }
+
+            status = connection.sendFINDResponse(presID, request.MessageID, request.AffectedSOPClassUID, response.get(), STATUS_Pending);
+            if (status.bad()) return status;
+        }
+
+        return connection.sendFINDResponse(presID, request.MessageID, request.AffectedSOPClassUID, nullptr,
+            truncated ? STATUS_FIND_Refused_OutOfResources : STATUS_Success);
+    }
+
+    return connection.DcmSCP::handleIncomingCommand(incomingMsg, presInfo);
+}
+
+// Takes the current settings for the association that 'connection' is about to negotiate.
+// Runs on the listener thread of 'connection' before negotiation, so AE title, PDU size and timeouts
+// that changed since the previous association are applied without touching an association in progress.
+template <typename Connection>
+void DICOMWorklistSCP::beginAssociation(Connection& connection)
+{
+    std::shared_ptr<const Settings> settings = getSettings();
+    if (settings != connection.associationSettings_)
+    {
+        configureListener(connection, *settings);
+        connection.associationSettings_ = std::move(settings);
+    }
+}
+
+// Picks up the current settings for the requested association (see beginAssociation()).
+void DICOMWorklistSCP::notifyAssociationRequest(const T_ASC_Parameters& params, DcmSCPActionType& desiredAction)
+{
+    DcmSCP::notifyAssociationRequest(params, desiredAction);
+    beginAssociation(*this);
+}
+
+// Counts an accepted association for the server status.
+void DICOMWorklistSCP::notifyAssociationAcknowledge()
+{
+    DcmSCP::notifyAssociationAcknowledge();
+    associationOpened();
+}
+
+// Counts the end of an association for the server status.
+void DICOMWorklistSCP::notifyAssociationTermination()
+{
+    DcmSCP::notifyAssociationTermination();
+    associationClosed();
+}
+
+// Ends the accept loop once stop() or a port change asked for it; DcmSCP then closes the listening port.
+OFBool DICOMWorklistSCP::stopAfterCurrentAssociation()
+{
+    return stopRequested_;
+}
+
+// Ends the accept loop on a connection timeout as well once a stop was requested.
+OFBool DICOMWorklistSCP::stopAfterConnectionTimeout()
+{
+    return stopRequested_;
+}
+
+// Counts an accepted association of any listener for the server status.
+void DICOMWorklistSCP::associationOpened()
+{
+    serverStatus_.activeAssociations_++;
+    serverStatus_.totalAssociations_++;
+    serverStatus_.signal();
+}
+
+// Counts the end of an association of any listener for the server status.
+// Also called for associations that were never acknowledged, which are not counted as active.
+void DICOMWorklistSCP::associationClosed()
+{
+    int active = serverStatus_.activeAssociations_;
+    while (active > 0 && !serverStatus_.activeAssociations_.compare_exchange_weak(active, active - 1))
+    {
+    }
+    serverStatus_.signal();
+}
+
+
+// ------------------------------------------- Index & Naming Helpers --------------------------------------------
+
+// Derives the file name of an Item from its ID.
+// The filename follows the format: dataset_<ID as 16 hex digits>.dcm
+// The fixed width keeps the names in the order the Items were created, and since IDs are never
+// reused within a run, a new Item never overwrites the file of another one.
+std::string DICOMWorklistSCP::Worklist::fileNameOf(Uint64 id) const
+{
+    std::stringstream ss;
+    ss << filePrefix_ << std::hex << std::setw(16) << std::setfill('0') << id << ".dcm";
+    return ss.str();
+}
+
+// Extracts the ID from a file name generated by fileNameOf().
+// Returns false for any other name, e.g. the timestamp-based names written by earlier versions.
+bool DICOMWorklistSCP::Worklist::idOfFileName(const std::string& fileName, Uint64& id) const
+{
+    const std::string& prefix = filePrefix_;
+    const std::string suffix = ".dcm";
+    const size_t digits = 16;
+    if (fileName.size() != prefix.size() + digits + suffix.size()
+        || fileName.compare(0, prefix.size(), prefix) != 0
+        || fileName.compare(prefix.size() + digits, suffix.size(), suffix) != 0)
+    {
+        return false;
+    }
+
+    id = 0;
+    for (size_t i = prefix.size(); i < prefix.size() + digits; i++)
+    {
+        char c = fileName[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) return false;
+        id = (id << 4) | static_cast<Uint64>(digit);
+    }
+    return id != 0;
+}
+
+// Stores a new Item in a slot of the slot map and returns its handle.
+// The most recently freed slot is reused in O(1) via the free list; otherwise the slot map grows by one slot.
+DICOMWorklistSCP::Handle DICOMWorklistSCP::Worklist::allocate(DatasetPtr dataset, Uint64 id, bool dirty)
+{
+    Uint32 slot = freeHead_;
+    if (slot == NoSlot)
+    {
+        slot = static_cast<Uint32>(slots_.size());
+        slots_.emplace_back();
+    }
+    else
+    {
+        freeHead_ = slots_[slot].nextFree_;
+    }
+
+    Slot& entry = slots_[slot];
+    entry.item_ = Item(dataset, id, dirty);
+    entry.used_ = true;
+    count_++;
+
+    return (static_cast<Handle>(entry.generation_) << 32) | slot;
+}
+
+// Releases the slot of a valid handle: the Item is reset, the slot generation is advanced
+// so that the handle and all its copies become stale, and the slot is pushed onto the free list.
+void DICOMWorklistSCP::Worklist::release(Handle handle)
+{
+    Uint32 slot = static_cast<Uint32>(handle);
+    Slot& entry = slots_[slot];
+
+    entry.item_ = Item();
+    entry.used_ = false;
+    if (++entry.generation_ == 0) entry.generation_ = 1;
+    entry.nextFree_ = freeHead_;
+    freeHead_ = slot;
+    count_--;
+}
+
+
+// ===============================================================================================================
+// ========================================== DICOMWorklistSCP::Listener =========================================
+// ===============================================================================================================
+
+
+// Creates a listener serving the worklist of 'owner'; setSettings() configures and opens it.
+DICOMWorklistSCP::Listener::Listener(DICOMWorklistSCP& owner)
+    : owner_(owner)
+{
+}
+
+// Serves a DIMSE command with the owner's worklist.
+OFCondition DICOMWorklistSCP::Listener::handleIncomingCommand(T_DIMSE_Message* msg, const DcmPresentationContextInfo& presInfo)
+{
+    return owner_.serveCommand(*this, msg, presInfo);
+}
+
+// Picks up the owner's current settings for the requested association.
+void DICOMWorklistSCP::Listener::notifyAssociationRequest(const T_ASC_Parameters& params, DcmSCPActionType& desiredAction)
+{
+    DcmSCP::notifyAssociationRequest(params, desiredAction);
+    owner_.beginAssociation(*this);
+}
+
+// Counts an accepted association in the owner's server status.
+void DICOMWorklistSCP::Listener::notifyAssociationAcknowledge()
+{
+    DcmSCP::notifyAssociationAcknowledge();
+    owner_.associationOpened();
+}
+
+// Counts the end of an association in the owner's server status.
+void DICOMWorklistSCP::Listener::notifyAssociationTermination()
+{
+    DcmSCP::notifyAssociationTermination();
+    owner_.associationClosed();
+}
+
+// Ends the accept loop once the owner handed the port on or stopped.
+OFBool DICOMWorklistSCP::Listener::stopAfterCurrentAssociation()
+{
+    return stopRequested_;
+}
+
+// Ends the accept loop on a connection timeout as well once a stop was requested.
+OFBool DICOMWorklistSCP::Listener::stopAfterConnectionTimeout()
+{
+    return stopRequested_;
+}
+
+
+// ===============================================================================================================
+// ========================================== DICOMWorklistSCP::ItemKeys =========================================
+// ===============================================================================================================
+
+
+// Compares two key sets, used to skip index updates when an edit did not touch any key attribute.
+// Interned columns are compared by ID.
+bool DICOMWorklistSCP::ItemKeys::operator==(const ItemKeys& other) const
+{
+    return patientId_ == other.patientId_
+        && accession_ == other.accession_
+        && dates_ == other.dates_
+        && stations_ == other.stations_
+        && modalities_ == other.modalities_;
+}
+
+// Extracts the key attributes of a dataset. Values are normalized like query values,
+// i.e. without padding, so that both can be compared directly. Empty values are not collected.
+// Dates, station AE titles and modalities are interned into 'values'.
+void DICOMWorklistSCP::ItemKeys::extract(DcmDataset& dataset, InternTable& values, ItemKeys& keys)
+{
+    keys = ItemKeys();
+
+    OFString value;
+    if (dataset.findAndGetOFStringArray(DCM_PatientID, value).good()) keys.patientId_ = value.c_str();
+    if (dataset.findAndGetOFStringArray(DCM_AccessionNumber, value).good()) keys.accession_ = value.c_str();
+
+    DcmSequenceOfItems* steps = nullptr;
+    if (dataset.findAndGetSequence(DCM_ScheduledProcedureStepSequence, steps).bad() || !steps) return;
+
+    for (unsigned long i = 0; i < steps->card(); i++)
+    {
+        DcmItem* step = steps->getItem(i);
+        if (!step) continue;
+
+        if (step->findAndGetOFStringArray(DCM_ScheduledProcedureStepStartDate, value).good() && !value.empty())
+        {
+            keys.dates_.push_back(values.intern(value.c_str()));
+        }
+        if (step->findAndGetOFStringArray(DCM_ScheduledStationAETitle, value).good() && !value.empty())
+        {
+            keys.stations_.push_back(values.intern(value.c_str()));
+        }
+        if (step->findAndGetOFStringArray(DCM_Modality, value).good() && !value.empty())
+        {
+            keys.modalities_.push_back(values.intern(value.c_str()));
+        }
+    }
+}
+
+
+// ===============================================================================================================
+// ======================================== DICOMWorklistSCP::InternTable ========================================
+// ===============================================================================================================
+
+
+// Returns the ID of 'value', adding the value to the table if it is new.
+Uint32 DICOMWorklistSCP::InternTable::intern(const char* value)
+{
+    auto [it, added] = ids_.try_emplace(value, static_cast<Uint32>(values_.size()));
+    if (added) values_.push_back(&it->first);
+    return it->second;
+}
+
+// Returns the ID of 'value', or NoId if the value was never interned.
+Uint32 DICOMWorklistSCP::InternTable::find(const char* value) const
+{
+    auto it = ids_.find(value);
+    return it != ids_.end() ? it->second : NoId;
+}
+
+// Returns the value of an ID returned by intern().
+const std::string& DICOMWorklistSCP::InternTable::value(Uint32 id) const
+{
+    return *values_[id];
+}
+
+// Removes all values; IDs handed out before become invalid.
+void DICOMWorklistSCP::InternTable::clear()
+{
+    ids_.clear();
+    values_.clear();
+}
+
+
+// ===============================================================================================================
+// ========================================= DICOMWorklistSCP::QueryIndex ========================================
+// ===============================================================================================================
+
+
+// Registers the keys of the Item at the given handle. Empty keys are not indexed,
+// since an empty attribute never matches a non-empty single value.
+void DICOMWorklistSCP::QueryIndex::insert(Handle handle, const ItemKeys& keys, const InternTable& values)
+{
+    if (!keys.patientId_.empty()) patientIds_[keys.patientId_].insert(handle);
+    if (!keys.accession_.empty()) accessions_[keys.accession_].insert(handle);
+    for (Uint32 date : keys.dates_) dates_[values.value(date)].insert(handle);
+    for (Uint32 station : keys.stations_) stations_[station].insert(handle);
+    for (Uint32 modality : keys.modalities_) modalities_[modality].insert(handle);
+}
+
+// Unregisters the keys of the Item at the given handle; keys left without Items are dropped.
+void DICOMWorklistSCP::QueryIndex::erase(Handle handle, const ItemKeys& keys, const InternTable& values)
+{
+    auto drop = [handle](auto& table, const auto& key)
+    {
+        auto it = table.find(key);
+        if (it == table.end()) return;
+        it->second.erase(handle);
+        if (it->second.empty()) table.erase(it);
+    };
+
+    if (!keys.patientId_.empty()) drop(patientIds_, keys.patientId_);
+    if (!keys.accession_.empty()) drop(accessions_, keys.accession_);
+    for (Uint32 date : keys.dates_) drop(dates_, values.value(date));
+    for (Uint32 station : keys.stations_) drop(stations_, station);
+    for (Uint32 modality : keys.modalities_) drop(modalities_, modality);
+}
+
+// Collects the candidate handles for a C-FIND query, sorted ascending.
+// PatientID, AccessionNumber, ScheduledStationAETitle and Modality are used when they hold a single value without
+// wildcards; the latter two are looked up by their interned ID. ScheduledProcedureStepStartDate is used for
+// single dates and date ranges. The candidates are the intersection of the Items found for every usable key.
+// Returns false if the query carries no usable key.
+bool DICOMWorklistSCP::QueryIndex::select(DcmDataset& query, const InternTable& values, std::vector<Handle>& candidates) const
+{
+    static const std::set<Handle> none;
+    std::vector<const std::set<Handle>*> sets;
+    std::set<Handle> dateMatches;
+
+    auto singleValue = [](DcmItem& item, const DcmTagKey& tag, OFString& value)
+    {
+        return item.findAndGetOFStringArray(tag, value).good() && !value.empty() && value.find_first_of("*?\\") == OFString_npos;
+    };
+    auto lookup = [&sets](const auto& table, const OFString& value)
+    {
+        auto it = table.find(value.c_str());
+        sets.push_back(it == table.end() ? &none : &it->second);
+    };
+    auto lookupId = [&sets, &values](const auto& table, const OFString& value)
+    {
+        auto it = table.find(values.find(value.c_str()));
+        sets.push_back(it == table.end() ? &none : &it->second);
+    };
+
+    OFString value;
+    if (singleValue(query, DCM_PatientID, value)) lookup(patientIds_, value);
+    if (singleValue(query, DCM_AccessionNumber, value)) lookup(accessions_, value);
+
+    DcmItem* step = nullptr;
+    if (query.findAndGetSequenceItem(DCM_ScheduledProcedureStepSequence, step).good() && step)
+    {
+        if (singleValue(*step, DCM_ScheduledStationAETitle, value)) lookupId(stations_, value);
+        if (singleValue(*step, DCM_Modality, value)) lookupId(modalities_, value);
+
+        if (step->findAndGetOFStringArray(DCM_ScheduledProcedureStepStartDate, value).good() && !value.empty())
+        {
+            std::string range = value.c_str();
+            size_t dash = range.find('-');
+            std::string from = dash == std::string::npos ? range : range.substr(0, dash);
+            std::string to = dash == std::string::npos ? range : range.substr(dash + 1);
+
+            if (from.empty() || to.empty() || from <= to)
+            {
+                auto first = from.empty() ? dates_.begin() : dates_.lower_bound(from);
+                auto last = to.empty() ? dates_.end() : dates_.upper_bound(to);
+                for (auto it = first; it != last; ++it)
+                {
+                    dateMatches.insert(it->second.begin(), it->second.end());
+                }
+            }
+            sets.push_back(&dateMatches);
+        }
+    }
+
+    if (sets.empty()) return false;
+
+    std::sort(sets.begin(), sets.end(), [](const std::set<Handle>* a, const std::set<Handle>* b) { return a->size() < b->size(); });
+    candidates.clear();
+    for (Handle handle : *sets.front())
+    {
+        bool inAll = true;
+        for (size_t i = 1; i < sets.size() && inAll; i++)
+        {
+            inAll = sets[i]->count(handle) > 0;
+        }
+        if (inAll) candidates.push_back(handle);
+    }
+    return true;
+}
+
+// Removes all entries.
+void DICOMWorklistSCP::QueryIndex::clear()
+{
+    patientIds_.clear();
+    accessions_.clear();
+    dates_.clear();
+    stations_.clear();
+    modalities_.clear();
+}
+
+
+// ===============================================================================================================
+// ======================================== DICOMWorklistSCP::QueryMatcher =======================================
+// ===============================================================================================================
+
+
+// Returns true if the target item matches every matching key of the query item.
+// Empty keys are universal matches. For a sequence key whose item holds at least one matching key, at least one
+// item of the target sequence has to match that query item; a sequence item of universal keys only matches
+// all targets, including those without the sequence. Group lengths and SpecificCharacterSet are ignored.
+bool DICOMWorklistSCP::QueryMatcher::matches(DcmItem& query, DcmItem& target)
+{
+    for (unsigned long i = 0; i < query.card(); i++)
+    {
+        DcmElement* queryElement = query.getElement(i);
+        if (!queryElement || queryElement->getETag() == 0x0000 || queryElement->getTag() == DCM_SpecificCharacterSet) continue;
+
+        if (queryElement->ident() == EVR_SQ)
+        {
+            DcmSequenceOfItems* querySequence = OFstatic_cast(DcmSequenceOfItems*, queryElement);
+            DcmItem* queryItem = querySequence->card() > 0 ? querySequence->getItem(0) : nullptr;
+            if (!queryItem || !hasMatchingKeys(*queryItem)) continue;
+
+            DcmSequenceOfItems* targetSequence = nullptr;
+            if (target.findAndGetSequence(queryElement->getTag(), targetSequence).bad() || !targetSequence) return false;
+
+            bool found = false;
+            for (unsigned long j = 0; j < targetSequence->card() && !found; j++)
+            {
+                found = matches(*queryItem, *targetSequence->getItem(j));
+            }
+            if (!found) return false;
+            continue;
+        }
+
+        if (queryElement->isEmpty()) continue;
+
+        DcmElement* targetElement = nullptr;
+        if (target.findAndGetElement(queryElement->getTag(), targetElement).bad() || !targetElement) return false;
+        if (!matchValue(*queryElement, *targetElement)) return false;
+    }
+    return true;
+}
+
+// Builds the response identifier for a matching target: every key of the query is returned
+// with the value of the target, or empty if the target does not have it. Sequence keys return
+// the matching target items, reduced to the keys of the query item, or the complete items
+// if the query item is empty.
+void DICOMWorklistSCP::QueryMatcher::buildResponse(DcmItem& query, DcmItem& target, DcmItem& response)
+{
+    for (unsigned long i = 0; i < query.card(); i++)
+    {
+        DcmElement* queryElement = query.getElement(i);
+        if (!queryElement || queryElement->getETag() == 0x0000) continue;
+
+        if (queryElement->ident() == EVR_SQ)
+        {
+            DcmSequenceOfItems* querySequence = OFstatic_cast(DcmSequenceOfItems*, queryElement);
+            DcmItem* queryItem = querySequence->card() > 0 ? querySequence->getItem(0) : nullptr;
+            bool universal = !queryItem || queryItem->card() == 0;
+
+            DcmSequenceOfItems* responseSequence = new DcmSequenceOfItems(queryElement->getTag());
+            DcmSequenceOfItems* targetSequence = nullptr;
+            if (target.findAndGetSequence(queryElement->getTag(), targetSequence).good() && targetSequence)
+            {
+                for (unsigned long j = 0; j < targetSequence->card(); j++)
+                {
+                    DcmItem* targetItem = targetSequence->getItem(j);
+                    if (universal)
+                    {
+                        responseSequence->append(new DcmItem(*targetItem));
+                    }
+                    else if (matches(*queryItem, *targetItem))
+                    {
+                        DcmItem* responseItem = new DcmItem();
+                        buildResponse(*queryItem, *targetItem, *responseItem);
+                        responseSequence->append(responseItem);
+                    }
+                }
+            }
+            response.insert(responseSequence, OFTrue);
+            continue;
+        }
+
+        DcmElement* targetElement = nullptr;
+        if (target.findAndGetElement(queryElement->getTag(), targetElement).good() && targetElement)
+        {
+            response.insert(OFstatic_cast(DcmElement*, targetElement->clone()), OFTrue);
+        }
+        else
+        {
+            response.insertEmptyElement(queryElement->getTag(), OFTrue);
+        }
+    }
+}
+
+// Returns true if the query item holds at least one non-empty key, directly or in the item of a sequence key,
+// i.e. if it restricts the matches at all.
+bool DICOMWorklistSCP::QueryMatcher::hasMatchingKeys(DcmItem& query)
+{
+    for (unsigned long i = 0; i < query.card(); i++)
+    {
+        DcmElement* element = query.getElement(i);
+        if (!element || element->getETag() == 0x0000 || element->getTag() == DCM_SpecificCharacterSet) continue;
+
+        if (element->ident() == EVR_SQ)
+        {
+            DcmSequenceOfItems* sequence = OFstatic_cast(DcmSequenceOfItems*, element);
+            if (sequence->card() > 0 && hasMatchingKeys(*sequence->getItem(0))) return true;
+        }
+        else if (!element->isEmpty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Matches a single non-empty query value against a target value:
+// DA, TM and DT support ranges ("from-to", "-to", "from-"), compared on the precision of the range bounds;
+// UI supports a list of UIDs; all other VRs support wildcards '*' and '?'.
+// Person names are compared case-insensitively, everything else exactly.
+bool DICOMWorklistSCP::QueryMatcher::matchValue(DcmElement& queryElement, DcmElement& targetElement)
+{
+    OFString pattern, value;
+    queryElement.getOFStringArray(pattern);
+    targetElement.getOFStringArray(value);
+    std::string queryText = pattern.c_str();
+    std::string targetText = value.c_str();
+
+    switch (queryElement.ident())
+    {
+    case EVR_DA:
+    case EVR_TM:
+    case EVR_DT:
+    {
+        size_t dash = queryText.find('-');
+        if (dash == std::string::npos) return targetText == queryText;
+        if (targetText.empty()) return false;
+
+        std::string from = queryText.substr(0, dash);
+        std::string to = queryText.substr(dash + 1);
+        if (!from.empty() && targetText.compare(0, from.size(), from) < 0) return false;
+        if (!to.empty() && targetText.compare(0, to.size(), to) > 0) return false;
+        return true;
+    }
+
+    case EVR_UI:
+    {
+        std::istringstream uids(queryText);
+        std::string uid;
+        while (std::getline(uids, uid, '\\'))
+        {
+            if (uid == targetText) return true;
+        }
+        return false;
+    }
+
+    default:
+    {
+        bool ignoreCase = queryElement.ident() == EVR_PN;
+        return wildcardMatch(queryText.c_str(), targetText.c_str(), ignoreCase);
+    }
+    }
+}
+
+// Matches a value against a pattern where '*' matches any sequence and '?' any single character.
+// A pattern without wildcards requires an exact match.
+bool DICOMWorklistSCP::QueryMatcher::wildcardMatch(const char* pattern, const char* value, bool ignoreCase)
+{
+    auto same = [ignoreCase](char a, char b)
+    {
+        if (!ignoreCase) return a == b;
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    };
+
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*value)
+    {
+        if (*pattern == '*')
+        {
+            star = pattern++;
+            resume = value;
+        }
+        else if (*pattern == '?' || (*pattern && same(*pattern, *value)))
+        {
+            pattern++;
+            value++;
+        }
+        else if (star)
+        {
+            pattern = star + 1;
+            value = ++resume;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*') pattern++;
+    return *pattern == 0;
+}
+
+
+// ===============================================================================================================
+// ======================================== DICOMWorklistSCP::TimingWheel ========================================
+// ===============================================================================================================
+
+
+// Inserts an entry into the level whose span covers the distance to its expiry.
+// Entries that are already due are kept aside and returned by the next advance().
+void DICOMWorklistSCP::TimingWheel::insert(const Entry& entry)
+{
+    Sint64 delta = entry.expiry_ - current_;
+    if (delta <= 0)
+    {
+        due_.push_back(entry);
+        return;
+    }
+
+    for (int level = 0; level < LevelCount; level++)
+    {
+        if (delta < (Sint64(1) << (SlotBits * (level + 1))))
+        {
+            slots_[level][(entry.expiry_ >> (SlotBits * level)) & (SlotCount - 1)].push_back(entry);
+            return;
+        }
+    }
+
+    overflow_.push_back(entry);
+}
+
+// Advances the wheel minute by minute up to 'now' and appends all entries that became due.
+// At every slot boundary of an upper level, that slot is cascaded into the lower levels.
+// After a very long pause (more than the span of all levels) the wheel is rebuilt instead of stepped.
+void DICOMWorklistSCP::TimingWheel::advance(Sint64 now, std::vector<Entry>& due)
 {
-    if (freeIndexes_.empty())
+    const Sint64 span = Sint64(1) << (SlotBits * LevelCount);
+
+    if (now - current_ > span)
     {
-        return static_cast<int>(indexMap_.size());
+        std::vector<Entry> entries;
+        entries.swap(overflow_);
+        for (auto& level : slots_)
+        {
+            for (auto& slot : level)
+            {
+                entries.insert(entries.end(), slot.begin(), slot.end());
+                slot.clear();
+            }
+        }
+
+        current_ = now;
+        cascade(entries);
     }
-    else
+
+    while (current_ < now)
+    {
+        current_++;
+
+        if ((current_ & (span - 1)) == 0)
+        {
+            cascade(overflow_);
+        }
+
+        for (int level = LevelCount - 1; level > 0; level--)
+        {
+            if ((current_ & ((Sint64(1) << (SlotBits * level)) - 1)) == 0)
+            {
+                cascade(slots_[level][(current_ >> (SlotBits * level)) & (SlotCount - 1)]);
+            }
+        }
+
+        auto& slot = slots_[0][current_ & (SlotCount - 1)];
+        due.insert(due.end(), slot.begin(), slot.end());
+        slot.clear();
+    }
+
+    due.insert(due.end(), due_.begin(), due_.end());
+    due_.clear();
+}
+
+// Removes all entries while keeping the current time.
+void DICOMWorklistSCP::TimingWheel::clear()
+{
+    for (auto& level : slots_)
+    {
+        for (auto& slot : level)
+        {
+            slot.clear();
+        }
+    }
+    overflow_.clear();
+    due_.clear();
+}
+
+// Re-inserts the given entries relative to the current time, which moves them to lower levels.
+void DICOMWorklistSCP::TimingWheel::cascade(std::vector<Entry>& entries)
+{
+    std::vector<Entry> pending;
+    pending.swap(entries);
+    for (const auto& entry : pending)
+    {
+        insert(entry);
+    }
+}
+
+
+// ===============================================================================================================
+// ======================================= DICOMWorklistSCP::SharedDataset =======================================
+// ===============================================================================================================
+
+
+namespace
+{
+    // Fixed-size block allocator backing SharedDataset.
+    // Blocks are carved from chunks aligned to their own size, so the chunk of a block is found by masking its
+    // address; each chunk threads a free list through its unused blocks. Every thread keeps up to CacheSize free
+    // blocks of its own, so most allocations and releases take no lock; the cache is refilled from and drained to
+    // the chunks in batches under the pool lock.
+    // Up to SpareChunks chunks whose blocks are all free again are kept for reuse; any further one goes back to the
+    // heap, so the pool shrinks after the worklist did. The thread caches belong to the single pool of the process
+    // (see datasetPool()).
+    class BlockPool
+    {
+    public:
+        explicit BlockPool(size_t blockSize)
+            : blockSize_(roundUp(std::max(blockSize, sizeof(FreeBlock))))
+        {
+            chunkSize_ = MinChunkSize;
+            while (chunkSize_ < roundUp(sizeof(Chunk)) + MinBlocksPerChunk * blockSize_) chunkSize_ *= 2;
+            blocksPerChunk_ = (chunkSize_ - roundUp(sizeof(Chunk))) / blockSize_;
+        }
+
+        // Returns a free block, from the cache of the calling thread if it holds one.
+        void* allocate()
+        {
+            Cache& cache = threadCache();
+            if (cache.count_ == 0 && !cache.closed_) refill(cache);
+            if (cache.count_ == 0)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return take();
+            }
+            return pop(cache);
+        }
+
+        // Returns a block to the cache of the calling thread; a full cache hands half of its blocks back to their chunks.
+        void deallocate(void* block)
+        {
+            Cache& cache = threadCache();
+            if (cache.closed_)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                give(block);
+                return;
+            }
+
+            push(cache, block);
+            if (cache.count_ >= CacheSize) drain(cache, CacheSize / 2);
+        }
+
+    private:
+        struct FreeBlock
+        {
+            FreeBlock* next_;
+        };
+
+        // Header at the start of every chunk: its free list, the number of free blocks, and its neighbors in the
+        // list of chunks that have free blocks
+        struct Chunk
+        {
+            FreeBlock* free_;
+            size_t freeCount_;
+            Chunk* prev_;
+            Chunk* next_;
+        };
+
+        // Free blocks of one thread. Trivially destructible, so it stays usable while the thread or the process
+        // exits; once CacheCloser has handed its blocks back, the thread uses the chunks directly.
+        struct Cache
+        {
+            FreeBlock* head_;
+            size_t count_;
+            bool closed_;
+        };
+
+        // Hands the blocks of a thread's cache back to the pool when the thread ends.
+        struct CacheCloser
+        {
+            BlockPool& pool_;
+            Cache& cache_;
+
+            ~CacheCloser()
+            {
+                pool_.drain(cache_, 0);
+                cache_.closed_ = true;
+            }
+        };
+
+        static const size_t MinChunkSize = 64 * 1024;
+        static const size_t MinBlocksPerChunk = 64;
+        static const size_t SpareChunks = 16;
+        static const size_t CacheSize = 64;
+
+        static size_t roundUp(size_t size)
+        {
+            return (size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+        }
+
+        Cache& threadCache()
+        {
+            thread_local Cache cache = { nullptr, 0, false };
+            thread_local CacheCloser closer = { *this, cache };
+            return cache;
+        }
+
+        static void push(Cache& cache, void* block)
+        {
+            FreeBlock* free = static_cast<FreeBlock*>(block);
+            free->next_ = cache.head_;
+            cache.head_ = free;
+            cache.count_++;
+        }
+
+        static void* pop(Cache& cache)
+        {
+            FreeBlock* block = cache.head_;
+            cache.head_ = block->next_;
+            cache.count_--;
+            return block;
+        }
+
+        // Moves half a cache worth of blocks from the chunks into 'cache'.
+        void refill(Cache& cache)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (cache.count_ < CacheSize / 2)
+            {
+                push(cache, take());
+            }
+        }
+
+        // Hands blocks of 'cache' back to their chunks until 'keep' are left.
+        void drain(Cache& cache, size_t keep)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (cache.count_ > keep)
+            {
+                give(pop(cache));
+            }
+        }
+
+        // Takes a block from the first chunk with free blocks, adding a chunk if none has any.
+        // Must be called with mutex_ held.
+        void* take()
+        {
+            if (!available_)
+            {
+                Uint8* memory = static_cast<Uint8*>(::operator new(chunkSize_, std::align_val_t(chunkSize_)));
+                Chunk* chunk = reinterpret_cast<Chunk*>(memory);
+                chunk->free_ = nullptr;
+                chunk->freeCount_ = blocksPerChunk_;
+                Uint8* blocks = memory + roundUp(sizeof(Chunk));
+                for (size_t i = blocksPerChunk_; i-- > 0;)
+                {
+                    FreeBlock* free = reinterpret_cast<FreeBlock*>(blocks + i * blockSize_);
+                    free->next_ = chunk->free_;
+                    chunk->free_ = free;
+                }
+                link(chunk);
+                emptyChunks_++;
+            }
+
+            Chunk* chunk = available_;
+            if (chunk->freeCount_ == blocksPerChunk_) emptyChunks_--;
+            FreeBlock* block = chunk->free_;
+            chunk->free_ = block->next_;
+            if (--chunk->freeCount_ == 0) unlink(chunk);
+            return block;
+        }
+
+        // Returns a block to its chunk. Of the chunks whose blocks are all free, SpareChunks are kept for the next
+        // allocations and any other goes back to the heap.
+        // Must be called with mutex_ held.
+        void give(void* block)
+        {
+            Chunk* chunk = reinterpret_cast<Chunk*>(reinterpret_cast<std::uintptr_t>(block) & ~static_cast<std::uintptr_t>(chunkSize_ - 1));
+
+            FreeBlock* free = static_cast<FreeBlock*>(block);
+            free->next_ = chunk->free_;
+            chunk->free_ = free;
+            if (++chunk->freeCount_ == 1) link(chunk);
+            if (chunk->freeCount_ < blocksPerChunk_) return;
+
+            if (emptyChunks_ < SpareChunks)
+            {
+                emptyChunks_++;
+                return;
+            }
+            unlink(chunk);
+            ::operator delete(chunk, std::align_val_t(chunkSize_));
+        }
+
+        // Adds 'chunk' to the front of the chunks with free blocks.
+        void link(Chunk* chunk)
+        {
+            chunk->prev_ = nullptr;
+            chunk->next_ = available_;
+            if (available_) available_->prev_ = chunk;
+            available_ = chunk;
+        }
+
+        // Removes 'chunk' from the chunks with free blocks.
+        void unlink(Chunk* chunk)
+        {
+            if (chunk->prev_) chunk->prev_->next_ = chunk->next_;
+            else available_ = chunk->next_;
+            if (chunk->next_) chunk->next_->prev_ = chunk->prev_;
+        }
+
+        std::mutex mutex_;
+        size_t blockSize_;
+        size_t chunkSize_;
+        size_t blocksPerChunk_;
+
+        // Chunks that have free blocks, and how many of them have no block in use
+        Chunk* available_ = nullptr;
+        size_t emptyChunks_ = 0;
+    };
+
+    // Pool shared by all SharedDataset instances. It is never destroyed, so datasets the host
+    // still references during static destruction can be released safely.
+    BlockPool& datasetPool()
+    {
+        static BlockPool* pool = new BlockPool(sizeof(DICOMWorklistSCP::SharedDataset));
+        return *pool;
+    }
+}
+
+// Constructs a dataset holding a deep copy of all elements of 'other', e.g. of the template prototype
+// when an Item sharing it is modified for the first time.
+// The reference count starts at zero; the first DatasetPtr takes ownership.
+DICOMWorklistSCP::SharedDataset::SharedDataset(const DcmDataset& other)
+    : DcmDataset(other)
+{
+}
+
+// Allocates a SharedDataset from the dataset pool.
+// Objects of derived classes with a different size fall back to the global heap.
+void* DICOMWorklistSCP::SharedDataset::operator new(size_t size)
+{
+    if (size != sizeof(SharedDataset)) return ::operator new(size);
+    return datasetPool().allocate();
+}
+
+// Returns the block of a destroyed SharedDataset to the dataset pool.
+void DICOMWorklistSCP::SharedDataset::operator delete(void* block, size_t size)
+{
+    if (block == nullptr) return;
+    if (size != sizeof(SharedDataset))
+    {
+        ::operator delete(block);
+        return;
+    }
+    datasetPool().deallocate(block);
+}
+
+
+// ===============================================================================================================
+// ========================================= DICOMWorklistSCP::DatasetPtr ========================================
+// ===============================================================================================================
+
+
+// Takes a reference to 'dataset', which may be nullptr.
+DICOMWorklistSCP::DatasetPtr::DatasetPtr(SharedDataset* dataset)
+    : dataset_(dataset)
+{
+    if (dataset_) dataset_->refCount_.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Takes another reference to the dataset of 'other'.
+DICOMWorklistSCP::DatasetPtr::DatasetPtr(const DatasetPtr& other)
+    : dataset_(other.dataset_)
+{
+    if (dataset_) dataset_->refCount_.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Takes over the reference of 'other' without touching the reference count.
+DICOMWorklistSCP::DatasetPtr::DatasetPtr(DatasetPtr&& other) noexcept
+    : dataset_(other.dataset_)
+{
+    other.dataset_ = nullptr;
+}
+
+// Replaces the referenced dataset. 'other' is taken by value, so the previous reference
+// is released when it goes out of scope.
+DICOMWorklistSCP::DatasetPtr& DICOMWorklistSCP::DatasetPtr::operator=(DatasetPtr other) noexcept
+{
+    std::swap(dataset_, other.dataset_);
+    return *this;
+}
+
+// Returns true if this is the only reference to the dataset.
+// Only meaningful while no other thread can take or drop references, e.g. under the worklist lock.
+bool DICOMWorklistSCP::DatasetPtr::unique() const
+{
+    return dataset_ && dataset_->refCount_.load(std::memory_order_acquire) == 1;
+}
+
+// Releases the reference and destroys the dataset if it was the last one.
+DICOMWorklistSCP::DatasetPtr::~DatasetPtr()
+{
+    if (dataset_ && dataset_->refCount_.fetch_sub(1, std::memory_order_acq_rel) == 1)
     {
-        int index = *freeIndexes_.begin();
-        freeIndexes_.erase(freeIndexes_.begin());
-        return index;
+        delete dataset_;
     }
 }
 
@@ -663,12 +5035,252 @@ int DICOMWorklistSCP::Worklist::getFreeIndex()
 
 
 // Constructs a new Item object to represent a DICOM dataset within the worklist.
-// Stores the dataset pointer, its filename, and the dirty flag indicating unsaved modifications.
-DICOMWorklistSCP::Worklist::Item::Item(std::shared_ptr<DcmDataset> dataset, std::string fileName, bool dirty)
+// Stores the dataset pointer, its ID, and the dirty flag indicating unsaved modifications.
+// Default-constructed Items without a dataset fill free slots of the slot map.
+DICOMWorklistSCP::Worklist::Item::Item(DatasetPtr dataset, Uint64 id, bool dirty)
 {
     dataset_ = dataset;
-    fileName_ = fileName;
+    id_ = id;
     dirty_ = dirty;
+    tracked_ = false;
+    logged_ = false;
+    expiry_ = -1;
+    hidden_ = false;
+    sidecarSlot_ = -1;
+    shared_ = false;
+    fileSize_ = 0;
+    fileTime_ = 0;
+    pinned_ = false;
+}
+
+
+// ===============================================================================================================
+// =================================== DICOMWorklistSCP::Worklist::SlotIterator ==================================
+// ===============================================================================================================
+
+
+// Constructs an iterator positioned at the first used slot at or after 'slot'.
+template <typename Owner, typename Value>
+DICOMWorklistSCP::Worklist::SlotIterator<Owner, Value>::SlotIterator(Owner& worklist, Uint32 slot)
+    : worklist_(worklist), slot_(slot)
+{
+    while (slot_ < worklist_.slots_.size() && !worklist_.slots_[slot_].used_) slot_++;
+}
+
+// Returns the handle and Item of the current slot.
+template <typename Owner, typename Value>
+std::pair<DICOMWorklistSCP::Handle, Value*> DICOMWorklistSCP::Worklist::SlotIterator<Owner, Value>::operator*() const
+{
+    auto& entry = worklist_.slots_[slot_];
+    return { (static_cast<Handle>(entry.generation_) << 32) | slot_, &entry.item_ };
+}
+
+// Advances to the next used slot. The current slot may be released while iterating.
+template <typename Owner, typename Value>
+DICOMWorklistSCP::Worklist::SlotIterator<Owner, Value>& DICOMWorklistSCP::Worklist::SlotIterator<Owner, Value>::operator++()
+{
+    slot_++;
+    while (slot_ < worklist_.slots_.size() && !worklist_.slots_[slot_].used_) slot_++;
+    return *this;
+}
+
+// Compares the slot positions of two iterators over the same worklist.
+template <typename Owner, typename Value>
+bool DICOMWorklistSCP::Worklist::SlotIterator<Owner, Value>::operator!=(const SlotIterator& other) const
+{
+    return slot_ != other.slot_;
+}
+
+
+// ===============================================================================================================
+// ============================================ DICOMWorklistRegistry ============================================
+// ===============================================================================================================
+
+
+// Creates the shared pools and starts the ticker that expires the datasets of all instances once per minute.
+// The pool threads are pinned round-robin to the CPUs in 'cpuAffinity', worker threads first (empty = no pinning).
+DICOMWorklistRegistry::DICOMWorklistRegistry(int workerThreads, int ioThreads, const std::vector<int>& cpuAffinity)
+    : workers_(workerThreads, cpuAffinity, 0), io_(ioThreads, cpuAffinity, static_cast<size_t>(std::max(workerThreads, 1)))
+{
+    ticker_ = std::thread([this]()
+        {
+            std::unique_lock<std::mutex> wait(mutex_);
+            while (!tickerWakeup_.wait_for(wait, std::chrono::minutes(1), [this]() { return tickerStop_; }))
+            {
+                for (const auto& [name, instance] : instances_)
+                {
+                    std::shared_ptr<DICOMWorklistSCP> target = instance;
+                    workers_.post([target]() { target->expireDatasets(); });
+                }
+            }
+        });
+}
+
+// Stops the ticker, finishes the tasks already running on the pools and destroys all instances,
+// which stops those still listening.
+DICOMWorklistRegistry::~DICOMWorklistRegistry()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tickerStop_ = true;
+    }
+    tickerWakeup_.notify_all();
+    ticker_.join();
+}
+
+// Creates an instance under 'name' with the given options and returns it; the registry keeps ownership.
+// Expiry of the instance runs on the shared worker pool instead of a thread of its own.
+// The instance loads its data folder without the registry lock held, so the ticker and the other registry
+// operations go on meanwhile; name, folder and port are reserved first, so concurrent opens cannot collide.
+// Returns nullptr if the name is taken, or if another instance already uses the same data folder
+// and file prefix or the same port, as the two would overwrite each other's files or fail to listen.
+DICOMWorklistSCP* DICOMWorklistRegistry::open(const std::string& name, const DICOMWorklistSCP::Options& options)
+{
+    std::error_code ec;
+    auto folderOf = [&ec](const std::string& folder) { return std::filesystem::weakly_canonical(folder, ec).string(); };
+    const std::string folder = folderOf(options.dataFolder_);
+    auto conflicts = [&](const DICOMWorklistSCP::Options& other, Uint16 port)
+    {
+        return port == options.port_ || (other.filePrefix_ == options.filePrefix_ && folderOf(other.dataFolder_) == folder);
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (instances_.count(name) || opening_.count(name)) return nullptr;
+        for (const auto& [otherName, instance] : instances_)
+        {
+            if (conflicts(instance->options_, instance->getSettings()->port_)) return nullptr;
+        }
+        for (const auto& [otherName, other] : opening_)
+        {
+            if (conflicts(other, other.port_)) return nullptr;
+        }
+        opening_[name] = options;
+    }
+
+    DICOMWorklistSCP::Options instanceOptions = options;
+    instanceOptions.retentionThread_ = false;
+    auto instance = std::make_shared<DICOMWorklistSCP>(instanceOptions);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    opening_.erase(name);
+    instances_[name] = instance;
+    return instance.get();
+}
+
+// Returns the instance registered under 'name', or nullptr if there is none.
+DICOMWorklistSCP* DICOMWorklistRegistry::find(const std::string& name) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = instances_.find(name);
+    return it != instances_.end() ? it->second.get() : nullptr;
+}
+
+// Removes the instance registered under 'name' from the registry and destroys it once no pool task uses it anymore.
+// Pointers returned by open() or find() for it become invalid. Returns false if there is no such instance.
+bool DICOMWorklistRegistry::close(const std::string& name)
+{
+    std::shared_ptr<DICOMWorklistSCP> instance;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = instances_.find(name);
+        if (it == instances_.end()) return false;
+        instance = std::move(it->second);
+        instances_.erase(it);
+    }
+    return true;
+}
+
+// Returns the number of registered instances.
+int DICOMWorklistRegistry::count() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int>(instances_.size());
+}
+
+// Saves the dirty datasets of all instances in parallel on the I/O pool and waits for all of them.
+// Returns true if every instance saved successfully.
+bool DICOMWorklistRegistry::saveAll()
+{
+    std::vector<std::future<bool>> results;
+    for (const auto& instance : instances())
+    {
+        auto task = std::make_shared<std::packaged_task<bool()>>([instance]() { return instance->saveDirtyDatasets(); });
+        results.push_back(task->get_future());
+        io_.post([task]() { (*task)(); });
+    }
+
+    bool saved = true;
+    for (auto& result : results)
+    {
+        saved = result.get() && saved;
+    }
+    return saved;
+}
+
+// Returns references to all registered instances, so they can be used after the registry lock is released.
+std::vector<std::shared_ptr<DICOMWorklistSCP>> DICOMWorklistRegistry::instances() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<DICOMWorklistSCP>> result;
+    result.reserve(instances_.size());
+    for (const auto& [name, instance] : instances_)
+    {
+        result.push_back(instance);
+    }
+    return result;
+}
+
+// -------------------------------------------------- Task pool --------------------------------------------------
+
+// Starts 'threads' worker threads (at least one), each taking tasks from the queue until the pool is destroyed.
+// Thread i is pinned to entry firstCpu + i of 'cpuAffinity', wrapping around (see pinThread()).
+DICOMWorklistRegistry::TaskPool::TaskPool(int threads, const std::vector<int>& cpuAffinity, size_t firstCpu)
+{
+    for (int i = 0; i < std::max(threads, 1); i++)
+    {
+        threads_.emplace_back([this]()
+            {
+                while (true)
+                {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        wakeup_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+                        if (stop_) return;
+                        task = std::move(tasks_.front());
+                        tasks_.pop_front();
+                    }
+                    task();
+                }
+            });
+        pinThread(threads_.back(), cpuAffinity, firstCpu + static_cast<size_t>(i));
+    }
+}
+
+// Lets running tasks finish, drops the queued ones and joins all threads.
+DICOMWorklistRegistry::TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wakeup_.notify_all();
+
+    for (auto& thread : threads_)
+    {
+        thread.join();
+    }
+}
+
+// Queues a task for the next free thread.
+void DICOMWorklistRegistry::TaskPool::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    wakeup_.notify_one();
 }
 
 
@@ -3,79 +3,693 @@
 
 #include <dcmtk/dcmnet/scp.h>
 #include <unordered_map>
+#include <map>
 #include <set>
+#include <vector>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <chrono>
 
 // Represents a DICOM Modality Worklist SCP server.
 // Provides dataset management, status tracking, and file persistence.
 class DICOMWorklistSCP : public DcmSCP 
 {
 public:
+    // Strategy used when modified datasets are written to disk.
+    // Full rewrites the whole dataset file on every save.
+    // Delta appends only the changed elements to a log that is folded into the dataset files on compaction.
+    enum class PersistMode
+    {
+        Full,
+        Delta
+    };
+
+    // Action applied to worklist items whose scheduled procedure step start lies further
+    // in the past than the retention period.
+    // Keep disables expiry, Purge deletes the item and its file, Archive moves the file into
+    // the archive folder and drops the item, Hide keeps the item but excludes it from C-FIND matching.
+    enum class RetentionPolicy
+    {
+        Keep,
+        Purge,
+        Archive,
+        Hide
+    };
+
+    // Handle of a worklist item. The low 32 bits select the storage slot of the item, the high 32 bits
+    // hold the generation of that slot, which changes whenever the slot is freed. A handle of a deleted item
+    // therefore never resolves to an item added later into the same slot. 0 is never a valid handle.
+    using Handle = Uint64;
+
+    class DatasetPtr;
+
+    // DICOM dataset of a worklist item with an intrusive reference count.
+    // Instances live in blocks of a shared pool instead of separate heap allocations and are
+    // referenced through DatasetPtr, which needs no separate control block.
+    class SharedDataset : public DcmDataset
+    {
+    public:
+        SharedDataset() = default;
+        explicit SharedDataset(const DcmDataset& other);
+
+        static void* operator new(size_t size);
+        static void operator delete(void* block, size_t size);
+
+    private:
+        friend class DatasetPtr;
+        std::atomic<Uint32> refCount_{ 0 };
+    };
+
+    // Reference to a SharedDataset, used like std::shared_ptr<DcmDataset> but only one pointer wide.
+    // The dataset is destroyed and its block returned to the pool when the last reference goes away.
+    class DatasetPtr
+    {
+    public:
+        DatasetPtr() = default;
+        DatasetPtr(std::nullptr_t) {}
+        explicit DatasetPtr(SharedDataset* dataset);
+        DatasetPtr(const DatasetPtr& other);
+        DatasetPtr(DatasetPtr&& other) noexcept;
+        DatasetPtr& operator=(DatasetPtr other) noexcept;
+        ~DatasetPtr();
+
+        SharedDataset* get() const { return dataset_; }
+        SharedDataset& operator*() const { return *dataset_; }
+        SharedDataset* operator->() const { return dataset_; }
+        explicit operator bool() const { return dataset_ != nullptr; }
+        bool unique() const;
+
+    private:
+        SharedDataset* dataset_ = nullptr;
+    };
+
+    // Category of the most recent error reported in the server status.
+    enum class StatusError
+    {
+        None,
+        Load,
+        Quarantine,
+        Rename,
+        Remove,
+        Save,
+        DeltaLog,
+        Archive,
+        Configuration
+    };
+
+    // Snapshot of the server status filled by getStatus(StatusInfo&) from atomic counters,
+    // without locking or allocating, so it can be polled at any rate.
+    struct StatusInfo
+    {
+        // Whether the SCP is listening for associations
+        bool running_;
+
+        // Base server state ("Idle", "Listening"); points to a string literal
+        const char* state_;
+
+        // Number of received DIMSE commands
+        Uint64 requestCount_;
+
+        // Number of currently open associations and of all associations accepted so far
+        int activeAssociations_;
+        Uint64 totalAssociations_;
+
+        // Number of reported errors and the category of the latest one
+        Uint64 errorCount_;
+        StatusError lastError_;
+
+        // Number of worklist items and current generation (see getGeneration())
+        int datasetCount_;
+        Uint64 generation_;
+
+        // Progress of the running or last load and bulk save: files processed and files in total
+        int loadDone_;
+        int loadTotal_;
+        int flushDone_;
+        int flushTotal_;
+    };
+
+    // Counter of StatusInfo that waitForStatus() compares against a threshold
+    enum class StatusCounter
+    {
+        None,
+        Requests,
+        ActiveAssociations,
+        TotalAssociations,
+        Errors,
+        Datasets,
+        Generation
+    };
+
+    // Kind of a change event of the change feed.
+    // Cleared is recorded once for clearAllDatasets() and carries no handle.
+    enum class ChangeKind
+    {
+        Added,
+        Removed,
+        Modified,
+        Flushed,
+        Cleared
+    };
+
+    // Entry of the change feed returned by getChanges()
+    struct ChangeEvent
+    {
+        // Generation under which the change was published
+        Uint64 generation_;
+
+        // Handle of the affected worklist item (0 for ChangeKind::Cleared)
+        Handle handle_;
+
+        ChangeKind kind_;
+    };
+
+    // Tracked edit handle created by beginEdit().
+    // The host modifies dataset_, a private copy of the worklist item, and hands the session
+    // to commitEdit() or cancelEdit(). Nothing becomes visible before the commit.
+    struct EditSession
+    {
+        // Handle of the edited worklist item
+        Handle handle_;
+
+        // Working copy of the item's dataset that the host modifies
+        DcmDataset dataset_;
+
+        // Fingerprints of the working copy at the time the session was opened
+        std::unordered_map<Uint32, Uint64> baseline_;
+    };
+
+    // Outcome of commitBatch().
+    // Rejected leaves the worklist unchanged. SaveFailed means the batch was applied in memory and is visible,
+    // but not all of its datasets could be saved; they stay dirty and are saved again by the next flush.
+    enum class CommitResult
+    {
+        Committed,
+        Rejected,
+        SaveFailed
+    };
+
+    // Batch of mutations created by beginBatch().
+    // Adds, deletes and edits are collected by the host and applied together by commitBatch(),
+    // so C-FIND never sees part of a batch. Nothing becomes visible before the commit.
+    struct Batch
+    {
+        // Number of datasets to add from the template
+        int addCount_ = 0;
+
+        // Handles of the datasets to delete
+        std::vector<Handle> deletes_;
+
+        // Edit sessions of the datasets to modify
+        std::vector<std::unique_ptr<EditSession>> edits_;
+    };
+
+    // Immutable flat encoding of the string attributes of one worklist item, built for read guards.
+    // 'entries_' is the offset table: one entry per attribute, sorted by key, pointing into 'keys_'
+    // (the attribute's path as words: tag, item number, tag, ..., tag) and into 'text_' (the zero-terminated value).
+    struct Snapshot
+    {
+        struct Entry
+        {
+            Uint32 key_;
+            Uint32 keyLength_;
+            Uint32 value_;
+            Uint32 valueLength_;
+        };
+
+        // Maximum number of key words of a path (eight segments)
+        static const int MaxKeyLength = 15;
+
+        std::vector<Entry> entries_;
+        std::vector<Uint32> keys_;
+        std::vector<char> text_;
+
+        static std::shared_ptr<const Snapshot> build(DcmItem& dataset);
+        const char* find(const Uint32* key, int keyLength, size_t* length) const;
+
+    private:
+        void add(DcmItem& item, std::vector<Uint32>& path);
+    };
+
+    // Snapshots of all worklist items as of one generation, in slot order, shared by the read guards of that generation
+    struct SnapshotTable
+    {
+        Uint64 generation_ = 0;
+        std::vector<Handle> handles_;
+        std::vector<std::shared_ptr<const Snapshot>> snapshots_;
+    };
+
+    // Read-only view of all worklist items created by beginRead().
+    // value() returns pointers into the immutable item snapshots held by the guard, valid until the guard is destroyed;
+    // reading neither copies nor allocates. A guard holds no lock, so writers are never blocked by it;
+    // their changes show up in guards opened after the change was published.
+    struct ReadGuard
+    {
+        std::shared_ptr<const SnapshotTable> table_;
+
+        int count() const;
+        Handle handle(int index) const;
+        Uint64 generation() const;
+        const char* value(int index, const char* path, size_t* length = nullptr) const;
+        const char* value(Handle handle, const char* path, size_t* length = nullptr) const;
+    };
+
+    // Per-instance settings passed to the constructor.
+    // Instances in the same process need their own data folder, or at least their own file prefix, and their own port.
+    struct Options
+    {
+        // Folder holding the dataset files, the delta log and the index sidecar; created if missing
+        std::string dataFolder_ = "./worklist/";
+
+        // Prefix of the dataset file names; only files starting with it are loaded from dataFolder_.
+        // With a prefix other than the default, the delta log and the sidecar carry it as well.
+        std::string filePrefix_ = "dataset_";
+
+        // Storage backend: whole dataset files, or dataset files plus delta log (see setPersistMode())
+        PersistMode persistMode_ = PersistMode::Full;
+
+        // Port and AE title the SCP listens on after start()
+        Uint16 port_ = 104;
+        std::string aeTitle_ = "WORKLIST_SCP";
+
+        // Whether expiry runs on a thread of the instance; DICOMWorklistRegistry runs it on its worker pool instead
+        bool retentionThread_ = true;
+
+        // CPUs the association thread may run on (empty = no restriction)
+        std::vector<int> cpuAffinity_;
+
+        // Whether items are kept as compact encoded buffers instead of dataset trees (see setCompactItems())
+        bool compactItems_ = false;
+    };
+
+    // Network and query settings that can be replaced while the SCP is running (see setSettings()).
+    // Published as an immutable object: an association keeps the settings that were current when it was requested,
+    // so a replacement only affects associations requested afterwards.
+    struct Settings
+    {
+        // Port and AE title the SCP listens on; a new port is taken over by a new listener without a gap
+        Uint16 port_ = 104;
+        std::string aeTitle_ = "WORKLIST_SCP";
+
+        // Largest PDU accepted and the network timeouts in seconds
+        Uint32 maxReceivePDULength_ = 16384;
+        Uint32 connectionTimeout_ = 30;
+        Uint32 acseTimeout_ = 30;
+        Uint32 dimseTimeout_ = 30;
+
+        // Maximum number of C-FIND responses per query (0 = unlimited), overridden per calling AE title by maxMatchesByAE_.
+        // A query with more matches gets the first ones followed by a Refused: Out of Resources status.
+        int maxMatches_ = 0;
+        std::map<std::string, int> maxMatchesByAE_;
+    };
+
     DICOMWorklistSCP();
+    explicit DICOMWorklistSCP(const Options& options);
     ~DICOMWorklistSCP();
 
     // Configuration
     bool setTemplateFile(const std::string& filename);  
+    std::shared_ptr<const Settings> getSettings() const;
+    bool setSettings(const Settings& settings);
+    bool updateSettings(const std::function<void(Settings&)>& edit);
 
     // Dataset management
-    bool addDataset(int* index);                                  
-    bool deleteDataset(int index);                            
+    bool addDataset(Handle* handle);                                  
+    bool addDatasets(int count, Handle* handles);
+    bool deleteDataset(Handle handle);                            
     bool getDatasetCount(int* count) const;                       
-    std::shared_ptr<DcmDataset> getDataset(int index) const;                        
+    DatasetPtr getDataset(Handle handle);                        
+    DcmDataset* pinDataset(Handle handle);
+    bool releaseDataset(Handle handle);
     bool clearAllDatasets();                                                 
+    std::unique_ptr<EditSession> beginEdit(Handle handle) const;
+    bool commitEdit(std::unique_ptr<EditSession> session, bool* modified = nullptr);
+    void cancelEdit(std::unique_ptr<EditSession> session);
+    bool getGeneration(Uint64* generation) const;
+    bool getChanges(Uint64 since, ChangeEvent* events, int capacity, int* count, Uint64* generation, bool* resync) const;
+    bool waitForChanges(Uint64 since, int timeoutMs, Uint64* generation = nullptr) const;
+    std::unique_ptr<Batch> beginBatch() const;
+    bool batchAddDatasets(Batch& batch, int count) const;
+    bool batchDeleteDataset(Batch& batch, Handle handle) const;
+    EditSession* batchEditDataset(Batch& batch, Handle handle) const;
+    CommitResult commitBatch(std::unique_ptr<Batch> batch, std::vector<Handle>* addedHandles = nullptr);
+    void rollbackBatch(std::unique_ptr<Batch> batch);
+
+    // Attribute access by tag path, e.g. "0040,0100[0].0040,0002" (see AttributePath)
+    bool getString(Handle handle, const char* path, char* buffer, size_t size, size_t* length = nullptr) const;
+    bool setString(Handle handle, const char* path, const char* value);
+    bool getInt(Handle handle, const char* path, Sint32* value) const;
+    bool setInt(Handle handle, const char* path, Sint32 value);
+    bool getDate(Handle handle, const char* path, int* year, int* month, int* day) const;
+    bool setDate(Handle handle, const char* path, int year, int month, int day);
+    bool getItemCount(Handle handle, const char* path, int* count) const;
+    bool addItem(Handle handle, const char* path, int* index = nullptr);
+    bool deleteItem(Handle handle, const char* path, int index);
+
+    // Enumeration of all items with selected attribute values in one pass
+    bool enumerateDatasets(const char* const* paths, int pathCount, const std::function<bool(Handle, const char* const*)>& visit, int* visited = nullptr) const;
+    bool listDatasets(Handle* handles, int capacity, int* count, const char* const* paths = nullptr, int pathCount = 0,
+        char* values = nullptr, size_t valueWidth = 0, Uint64* generation = nullptr) const;
+
+    // In-process queries with C-FIND matching
+    bool findDatasets(DcmDataset& query, const char* const* paths, int pathCount, const std::function<bool(Handle, const char* const*)>& visit, int* matches = nullptr) const;
+    bool findDatasets(const char* const* keys, const char* const* keyValues, int keyCount, const char* const* paths, int pathCount,
+        const std::function<bool(Handle, const char* const*)>& visit, int* matches = nullptr) const;
+
+    // Zero-copy reads
+    std::unique_ptr<ReadGuard> beginRead() const;
 
     // Lifecycle control
     bool start();                                              
     bool stop();                                                 
-    bool getStatus(std::string& status);                          
+    bool getStatus(std::string& status);
+    bool getStatus(StatusInfo& info) const;                          
+    bool waitForStatus(StatusInfo& status, int timeoutMs, StatusCounter counter = StatusCounter::None, Uint64 threshold = 0) const;
 
     // Saving logic
-    bool markDatasetDirty(int index);
-    bool saveDataset(int index);
+    bool markDatasetDirty(Handle handle);
+    bool saveDataset(Handle handle);
     bool saveDirtyDatasets();
     bool saveAllDatasets();
+    bool setPersistMode(PersistMode mode);
+    bool compactDatasets();
+
+    // Item storage
+    bool setCompactItems(bool enable);
+
+    // Retention
+    bool setRetentionPolicy(RetentionPolicy policy, int retentionMinutes, const std::string& archiveFolder = "");
+    bool expireDatasets(int* expiredCount = nullptr);
 
 protected:
     OFCondition handleIncomingCommand(
         T_DIMSE_Message* msg,
         const DcmPresentationContextInfo& presInfo);
+    void notifyAssociationRequest(const T_ASC_Parameters& params, DcmSCPActionType& desiredAction);
+    void notifyAssociationAcknowledge();
+    void notifyAssociationTermination();
+    OFBool stopAfterCurrentAssociation();
+    OFBool stopAfterConnectionTimeout();
 
 private:
+    friend class DICOMWorklistRegistry;
+
+    // Additional DcmSCP serving the worklist of its owner on another port.
+    // setSettings() opens one when the port changes while the SCP is running; it accepts associations on the new port
+    // while the previous listener finishes its current association, so the port moves without a gap.
+    class Listener : public DcmSCP
+    {
+    public:
+        explicit Listener(DICOMWorklistSCP& owner);
+
+    protected:
+        OFCondition handleIncomingCommand(T_DIMSE_Message* msg, const DcmPresentationContextInfo& presInfo);
+        void notifyAssociationRequest(const T_ASC_Parameters& params, DcmSCPActionType& desiredAction);
+        void notifyAssociationAcknowledge();
+        void notifyAssociationTermination();
+        OFBool stopAfterCurrentAssociation();
+        OFBool stopAfterConnectionTimeout();
+
+    private:
+        friend class DICOMWorklistSCP;
+
+        DICOMWorklistSCP& owner_;
+
+        // Set to end the accept loop after the current association (see DICOMWorklistSCP::stopRequested_)
+        std::atomic<bool> stopRequested_{ false };
+
+        // Settings of the current association (see DICOMWorklistSCP::associationSettings_)
+        std::shared_ptr<const Settings> associationSettings_;
+    };
+
     bool loadAllDatasets();
+    DatasetPtr templatePrototype();
+    static bool diffEdit(EditSession& session, std::vector<Uint32>& changed, std::vector<Uint32>& removed);
+    void startRetention();
+    void stopRetention();
+    void publishChanges();
+    template <typename Read> bool readAttribute(Handle handle, const char* path, const char* action, Read read) const;
+    template <typename Write> bool writeAttribute(Handle handle, const char* path, bool create, const char* action, Write write);
+    template <typename Connection> void beginAssociation(Connection& connection);
+    template <typename Connection> OFCondition serveCommand(Connection& connection, T_DIMSE_Message* msg, const DcmPresentationContextInfo& presInfo);
+    static bool validSettings(const Settings& settings);
+    bool applySettings(const Settings& settings);
+    bool openListener(DcmSCP& listener, const Settings& settings);
+    static void configureListener(DcmSCP& listener, const Settings& settings);
+    void runListener(std::function<void()> accept);
+    void associationOpened();
+    void associationClosed();
+
+    // Summary of the recovery performed while loading the data folder at startup.
+    struct RecoveryReport
+    {
+        // Number of dataset files loaded successfully
+        int loaded_ = 0;
+
+        // Number of unreadable or empty files moved into the quarantine folder
+        int quarantined_ = 0;
+
+        // Number of temp files from interrupted first saves that were promoted to dataset files
+        int tempRecovered_ = 0;
+
+        // Number of temp files from interrupted saves that were discarded in favor of the previous version
+        int tempDiscarded_ = 0;
+
+        // Number of delta log records replayed, and bytes of a damaged log tail that were cut off
+        int deltaReplayed_ = 0;
+        Uint64 deltaDiscardedBytes_ = 0;
+    };
 
     // Maintains current server status and request metrics.
     struct SCPStatus
     {
         // Indicates whether the SCP server is currently running and accepting associations
-        bool isRunning_;
+        std::atomic<bool> isRunning_;
 
         // Tracks the total number of received DIMSE commands (e.g., C-FIND)
-        int requestCount_;
+        std::atomic<Uint64> requestCount_;
 
-        // Human-readable description of the current server state (e.g., "Idle", "Listening")
-        std::string statusText_;
+        // Number of currently open associations and of all associations accepted so far
+        std::atomic<int> activeAssociations_{ 0 };
+        std::atomic<Uint64> totalAssociations_{ 0 };
+
+        // Number of reported errors and the category of the latest one
+        std::atomic<Uint64> errorCount_{ 0 };
+        std::atomic<StatusError> lastError_{ StatusError::None };
+
+        // Copies of the worklist size and generation, updated whenever changes are published
+        std::atomic<int> datasetCount_{ 0 };
+        std::atomic<Uint64> generation_{ 0 };
+
+        // Progress of the running or last load and bulk save: files processed and files in total
+        std::atomic<int> loadDone_{ 0 };
+        std::atomic<int> loadTotal_{ 0 };
+        std::atomic<int> flushDone_{ 0 };
+        std::atomic<int> flushTotal_{ 0 };
+
+        // Base state of the server ("Idle", "Listening"); always points to a string literal
+        std::atomic<const char*> stateText_;
+
+        // Names of the operations currently in progress (string literals, nullptr marks a free slot).
+        // Claimed and released by ScopedStatus without locking; listed by ToString().
+        static const int OperationSlots = 16;
+        std::atomic<const char*> operations_[OperationSlots];
 
         // Aggregated error log with timestamps, reset after each ToString() call
         std::string lastErrors_;
 
+        // Outcome of the startup recovery, kept for the lifetime of the server
+        RecoveryReport recovery_;
+
+        // Wakes up threads blocked in wait(); waiters_ lets signal() skip the mutex while nobody waits
+        std::mutex waitMutex_;
+        std::condition_variable wakeup_;
+        std::atomic<int> waiters_{ 0 };
+
 
-        SCPStatus(bool isRunning = false, int requestCount = 0, std::string statusText = "Idle", std::string lastErrors = "");
+        SCPStatus(bool isRunning = false, int requestCount = 0, const char* stateText = "Idle", std::string lastErrors = "");
         std::string ToString();
-        void error(const std::string& message);
+        void error(StatusError code, const std::string& message);
+        void fill(StatusInfo& info) const;
+        void signal();
+        bool wait(StatusInfo& status, int timeoutMs, StatusCounter counter, Uint64 threshold);
     };
 
-    // Temporarily sets server status during processing.
-    // Automatically restores previous status on destruction.
+    // Marks an operation as active in the server status for the lifetime of the object.
+    // The action name and final state must be string literals; nothing is allocated or locked.
     struct ScopedStatus
     {
         DICOMWorklistSCP::SCPStatus& status_;
-        std::string previousStatusText_;
-        std::string finalStatusText_;
-        ScopedStatus(DICOMWorklistSCP::SCPStatus& status, const std::string& actionName = "", const std::string& finalStatusText = "None");
-        void changeStatus(const std::string& finalStatusText = "None");
+        int slot_;
+        const char* finalStateText_;
+        ScopedStatus(DICOMWorklistSCP::SCPStatus& status, const char* actionName = "Processing", const char* finalStateText = nullptr);
+        void changeStatus(const char* finalStateText);
         ~ScopedStatus();
     };
 
+    // Converts datasets and single elements to and from their explicit little-endian byte encoding.
+    // Used by the delta log to store changed elements and to detect which elements changed.
+    struct DatasetCodec
+    {
+        static bool encode(DcmDataset& dataset, std::vector<Uint8>& buffer);
+        static bool decode(const Uint8* data, size_t length, DcmDataset& dataset);
+        static Uint64 fingerprint(DcmObject& element);
+        static void fingerprintAll(DcmDataset& dataset, std::unordered_map<Uint32, Uint64>& fingerprints);
+    };
+
+    // Parses tag paths that address an attribute inside a dataset.
+    // A path is a list of segments separated by '.', each holding a tag as "gggg,eeee" in hex,
+    // optionally enclosed in parentheses. All segments but the last name a sequence and may select
+    // an item by its zero-based number in brackets, e.g. "(0040,0100)[0].(0040,0002)"; the item number defaults to 0.
+    struct AttributePath
+    {
+        static bool target(const char* path, DcmTagKey& tag);
+        static bool resolve(DcmItem& root, const char* path, bool create, DcmItem*& parent, DcmTagKey& tag);
+        static const char* stringValue(DcmItem& parent, const DcmTagKey& tag);
+        static const char* stringValue(DcmItem& root, const char* path);
+        static bool key(const char* path, Uint32* words, int capacity, int& length);
+
+    private:
+        static const char* parseSegment(const char* cursor, DcmTagKey& tag, long& index, bool& indexed);
+    };
+
+    // Hierarchical timing wheel ordering worklist items by their expiry minute.
+    // Three levels of 64 slots span one minute, 64 minutes and 4096 minutes per slot;
+    // entries further ahead wait in an overflow list. Advancing the wheel cascades entries
+    // from the upper levels down and returns all entries that became due in one batch.
+    struct TimingWheel
+    {
+        struct Entry
+        {
+            // Handle of the scheduled item
+            Handle handle_;
+
+            // Expiry time in minutes since 1970-01-01 (local time)
+            Sint64 expiry_;
+        };
+
+        static const int SlotBits = 6;
+        static const int SlotCount = 1 << SlotBits;
+        static const int LevelCount = 3;
+
+        std::vector<Entry> slots_[LevelCount][SlotCount];
+        std::vector<Entry> overflow_;
+        std::vector<Entry> due_;
+        Sint64 current_ = 0;
+
+        void insert(const Entry& entry);
+        void advance(Sint64 now, std::vector<Entry>& due);
+        void clear();
+
+    private:
+        void cascade(std::vector<Entry>& entries);
+    };
+
+    // Distinct values of the repetitive key columns of a worklist (dates, station AE titles, modalities).
+    // Every value is stored once and identified by a small ID, so the keys of all items and the query index
+    // hold IDs instead of strings and compare them as integers. IDs stay valid until clear(); the table only grows,
+    // which is bounded by the number of distinct values these columns take.
+    struct InternTable
+    {
+        static const Uint32 NoId = 0xFFFFFFFF;
+
+        // IDs by value, and the values by ID (pointing to the keys of ids_, whose nodes never move)
+        std::unordered_map<std::string, Uint32> ids_;
+        std::vector<const std::string*> values_;
+
+        Uint32 intern(const char* value);
+        Uint32 find(const char* value) const;
+        const std::string& value(Uint32 id) const;
+        void clear();
+    };
+
+    // Key attributes of a worklist item that are kept in the query indexes and the index sidecar.
+    struct ItemKeys
+    {
+        // PatientID and AccessionNumber of the item; unique per item, so they are not interned
+        std::string patientId_;
+        std::string accession_;
+
+        // ScheduledProcedureStepStartDate, ScheduledStationAETitle and Modality of every scheduled procedure step,
+        // as IDs of the worklist's InternTable
+        std::vector<Uint32> dates_;
+        std::vector<Uint32> stations_;
+        std::vector<Uint32> modalities_;
+
+        bool operator==(const ItemKeys& other) const;
+        static void extract(DcmDataset& dataset, InternTable& values, ItemKeys& keys);
+    };
+
+    // Lookup tables from key attribute values to worklist item handles.
+    // Used to preselect C-FIND candidates before the full match. Interned columns are keyed by ID,
+    // so a query value that was never interned matches nothing without a lookup; dates are ordered to serve range queries.
+    struct QueryIndex
+    {
+        std::unordered_map<std::string, std::set<Handle>> patientIds_;
+        std::unordered_map<std::string, std::set<Handle>> accessions_;
+        std::map<std::string, std::set<Handle>> dates_;
+        std::unordered_map<Uint32, std::set<Handle>> stations_;
+        std::unordered_map<Uint32, std::set<Handle>> modalities_;
+
+        void insert(Handle handle, const ItemKeys& keys, const InternTable& values);
+        void erase(Handle handle, const ItemKeys& keys, const InternTable& values);
+        bool select(DcmDataset& query, const InternTable& values, std::vector<Handle>& candidates) const;
+        void clear();
+    };
+
+    // Matches worklist items against a C-FIND query identifier and builds the response identifiers.
+    // Supports universal, single value, wildcard, list of UID and date/time range matching
+    // as well as sequence matching on the attributes of the first query item.
+    struct QueryMatcher
+    {
+        static bool matches(DcmItem& query, DcmItem& target);
+        static void buildResponse(DcmItem& query, DcmItem& target, DcmItem& response);
+
+    private:
+        static bool hasMatchingKeys(DcmItem& query);
+        static bool matchValue(DcmElement& queryElement, DcmElement& targetElement);
+        static bool wildcardMatch(const char* pattern, const char* value, bool ignoreCase);
+    };
+
+    // Entry of the index sidecar as read at startup
+    struct SidecarRecord
+    {
+        // Slot of the record within the sidecar file
+        int slot_;
+
+        // Size and modification time of the dataset file the keys were taken from
+        Uint64 fileSize_;
+        Uint64 fileTime_;
+
+        // Stored keys; only valid if hasKeys_ is set (keys that do not fit a record are not stored)
+        ItemKeys keys_;
+        bool hasKeys_;
+    };
+
+    // Worklist item packed into a single heap block instead of a DcmDataset tree (see setCompactItems()).
+    // The block starts with a table of 'count_' (tag, offset) pairs, one per top-level element in tag order,
+    // followed by the elements as encoded by DatasetCodec::encode(). The table lets readers decode only
+    // the elements they need, e.g. the keys of a C-FIND query.
+    struct CompactItem
+    {
+        std::unique_ptr<Uint8[]> data_;
+        Uint32 size_ = 0;
+        Uint32 count_ = 0;
+
+        explicit operator bool() const { return data_ != nullptr; }
+        static bool pack(DcmDataset& dataset, CompactItem& item);
+        bool unpack(DcmDataset& dataset, const std::vector<Uint32>* tags = nullptr) const;
+        static void tagsOf(DcmItem& query, std::vector<Uint32>& tags);
+        static void tagsOf(const char* const* paths, int pathCount, std::vector<Uint32>& tags);
+    };
+
     // Container for DICOM datasets.
     // Handles indexing, dirty tracking, and saving to files.
     struct Worklist
@@ -83,36 +697,194 @@ private:
         struct Item
         {
             // Pointer to the actual DICOM dataset associated with this worklist item
-            std::shared_ptr<DcmDataset> dataset_;
+            DatasetPtr dataset_;
 
-            // Filename used to persist this dataset on disk
-            std::string fileName_;
+            // Numeric ID of the item; the name of its file on disk is derived from it (see fileNameOf())
+            Uint64 id_;
 
             // Flag indicating whether this dataset has been modified and requires saving
             bool dirty_;
 
-            Item(std::shared_ptr<DcmDataset> dataset, std::string fileName, bool dirty);
+            // Fingerprints of the top-level elements as they are currently persisted (dataset file plus delta log)
+            std::unordered_map<Uint32, Uint64> persisted_;
+
+            // Flag indicating whether persisted_ reflects the state on disk and delta saves are possible
+            bool tracked_;
+
+            // Flag indicating whether the delta log holds changes not yet folded into the dataset file
+            bool logged_;
+
+            // Minute at which the item expires, as currently scheduled in the timing wheel (-1 = never)
+            Sint64 expiry_;
+
+            // Flag indicating whether the item was expired under RetentionPolicy::Hide
+            bool hidden_;
+
+            // Key attributes as currently registered in the query index
+            ItemKeys keys_;
+
+            // Slot of the item's record in the index sidecar (-1 = none)
+            int sidecarSlot_;
+
+            // Size and modification time of the dataset file as last loaded or written (0 = unknown),
+            // stamped on the delta records of the Item so that records older than the file are skipped on replay
+            Uint64 fileSize_;
+            Uint64 fileTime_;
+
+            // Snapshot of the item for read guards, built on demand and dropped whenever the item is modified;
+            // a cache, so beginRead() fills it in through a const view of the worklist
+            mutable std::shared_ptr<const Snapshot> snapshot_;
+
+            // Flag indicating whether dataset_ is the template prototype, shared with other Items until own() is called
+            bool shared_;
+
+            // Packed content of the item while dataset_ is not materialized (see Worklist::materialize())
+            CompactItem compact_;
+
+            // Flag indicating whether the host holds a raw pointer to dataset_ (see DICOMWorklistSCP::pinDataset()),
+            // which keeps the Item materialized until the host releases it
+            bool pinned_;
+
+            Item(DatasetPtr dataset = nullptr, Uint64 id = 0, bool dirty = false);
+        };
+
+        // Storage slot of the slot map. Free slots are chained through nextFree_.
+        struct Slot
+        {
+            Item item_;
+            Uint32 generation_ = 1;
+            Uint32 nextFree_ = 0;
+            bool used_ = false;
+        };
+
+        // Iterates the used slots of the slot map as (handle, Item*) pairs; ConstIterator yields const Items.
+        template <typename Owner, typename Value>
+        class SlotIterator
+        {
+        public:
+            SlotIterator(Owner& worklist, Uint32 slot);
+            std::pair<Handle, Value*> operator*() const;
+            SlotIterator& operator++();
+            bool operator!=(const SlotIterator& other) const;
+
+        private:
+            Owner& worklist_;
+            Uint32 slot_;
         };
+        using Iterator = SlotIterator<Worklist, Item>;
+        using ConstIterator = SlotIterator<const Worklist, const Item>;
+
+        static const Uint32 NoSlot = 0xFFFFFFFF;
 
         std::string dataFolder_ = "./worklist/";
-        std::unordered_map<int, Item*> indexMap_;
-        std::set<int> freeIndexes_;
+
+        // Prefix of the dataset file names (see fileNameOf())
+        std::string filePrefix_ = "dataset_";
+
+        // Dense slot map holding all Items, head of its free slot list and number of used slots
+        std::vector<Slot> slots_;
+        Uint32 freeHead_ = NoSlot;
+        int count_ = 0;
+
+        // ID assigned to the next new Item
+        Uint64 nextId_ = 1;
+
+        // Delta persistence settings: active mode, log file inside dataFolder_ and log size that triggers compaction
+        PersistMode persistMode_ = PersistMode::Full;
+        std::string deltaLogName_ = "worklist.delta";
+        Uint64 compactThreshold_ = 4 * 1024 * 1024;
+
+        // Folder inside dataFolder_ that receives files which failed validation at startup
+        std::string quarantineFolder_ = "quarantine/";
+
+        // Query index over the key attributes, the values of its interned columns, and its persisted copy inside dataFolder_
+        QueryIndex index_;
+        InternTable values_;
+        std::string sidecarName_ = "worklist.idx";
+        std::fstream sidecar_;
+        std::set<int> freeSidecarSlots_;
+        int sidecarSlotCount_ = 0;
+
+        // Counter incremented once per published change of the worklist content
+        Uint64 generation_ = 0;
+
+        // Ring of the most recent change events, its oldest entry once full, the highest generation
+        // whose events were overwritten, and whether events were recorded since the last publication
+        static const size_t ChangeCapacity = 4096;
+        std::vector<ChangeEvent> changes_;
+        size_t changeHead_ = 0;
+        Uint64 droppedGeneration_ = 0;
+        bool changesPending_ = false;
+
+        // Retention settings and the timing wheel holding the expiry of every scheduled item
+        RetentionPolicy retentionPolicy_ = RetentionPolicy::Keep;
+        Sint64 retentionMinutes_ = 24 * 60;
+        std::string archiveFolder_;
+        TimingWheel wheel_;
+
+        // Whether Items are packed into CompactItems, and the Items materialized since the last packPending()
+        bool compactItems_ = false;
+        std::vector<Handle> unpacked_;
 
 
-        Item* operator[](int index) const;
+        void configure(const Options& options);
+        Item* operator[](Handle handle);
+        const Item* operator[](Handle handle) const;
+        Iterator begin();
+        Iterator end();
+        ConstIterator begin() const;
+        ConstIterator end() const;
         bool loadAllDatasets(SCPStatus& serverStatus);
-        int add(std::shared_ptr<DcmDataset> dataset);
-        bool markDatasetDirty(int index);
-        bool remove(int id);
+        void addCopies(const DatasetPtr& prototype, int count, Handle* handles);
+        void own(Item& item);
+        bool present(const Item& item) const;
+        DcmDataset* view(const Item& item, DcmDataset& scratch, const std::vector<Uint32>* tags = nullptr) const;
+        DcmDataset* materialize(Handle handle);
+        DcmDataset* pin(Handle handle);
+        bool unpin(Handle handle);
+        void packPending();
+        void setCompactItems(bool enable);
+        bool markDatasetDirty(Handle handle);
+        bool applyChanges(Handle handle, DcmDataset& source, const std::vector<Uint32>& changed, const std::vector<Uint32>& removed);
+        bool remove(Handle handle);
         void clear(SCPStatus& serverStatus);
-        bool saveDatasetInFile(int index, SCPStatus& serverStatus);
+        bool saveDatasetInFile(Handle handle, SCPStatus& serverStatus);
         bool saveAllDatasetsInFile(SCPStatus& serverStatus);
         bool saveDirtyDatasetsInFile(SCPStatus& serverStatus);
+        bool saveDatasetsInFile(const std::vector<Handle>& handles, SCPStatus& serverStatus);
+        bool setPersistMode(PersistMode mode, SCPStatus& serverStatus);
+        bool compact(SCPStatus& serverStatus);
+        void setRetention(RetentionPolicy policy, Sint64 retentionMinutes, const std::string& archiveFolder);
+        void scheduleExpiry(Handle handle);
+        void refreshItem(Handle handle);
+        int find(DcmDataset& query, const std::function<bool(Handle, const Item&, DcmDataset&)>& visit, const std::vector<Uint32>* extraTags = nullptr) const;
+        int expire(Sint64 now, SCPStatus& serverStatus);
         int count() const;
+        void recordChange(ChangeKind kind, Handle handle);
+        void changesSince(Uint64 since, ChangeEvent* events, int capacity, int& count, Uint64& generation, bool& resync) const;
+        void resetChanges();
+        std::string fileNameOf(Uint64 id) const;
+        bool idOfFileName(const std::string& fileName, Uint64& id) const;
 
     private:
-        std::string newFileName(const std::string& prefix = "dataset");
-        int getFreeIndex();
+        Handle allocate(DatasetPtr dataset, Uint64 id, bool dirty);
+        void release(Handle handle);
+        bool pack(Item& item);
+        DcmDataset* unpack(Item& item);
+        bool writeFullFile(Item& item, SCPStatus& serverStatus);
+        bool buildDeltaRecord(Item& item, std::vector<Uint8>& records, std::unordered_map<Uint32, Uint64>& current);
+        bool appendDeltaRecords(const std::vector<Uint8>& records, SCPStatus& serverStatus);
+        void compactIfNeeded(SCPStatus& serverStatus);
+        void replayDeltaLog(SCPStatus& serverStatus);
+        bool migrateLegacyFile(Item& item, const std::string& legacyName, SCPStatus& serverStatus);
+        Sint64 expiryOf(DcmDataset& dataset) const;
+        bool archive(Handle handle, SCPStatus& serverStatus);
+        bool quarantine(const std::filesystem::path& file, SCPStatus& serverStatus);
+        void forget(Handle handle, Item& item);
+        bool readSidecar(std::unordered_map<std::string, SidecarRecord>& records);
+        void openSidecar(bool valid, const std::unordered_map<std::string, SidecarRecord>& records);
+        void writeSidecarRecord(Item& item, const ItemKeys& keys);
+        void clearSidecarRecord(int slot);
     };
 
     // Synchronization primitive to ensure thread-safe access to shared state
@@ -121,12 +893,105 @@ private:
     // Path to the template DICOM file used when creating new worklist entries
     std::string templateFile_;
 
+    // Parsed template shared by new datasets until they are modified (see Worklist::own()),
+    // with the size and modification time of the file it was parsed from and the time that file was last checked
+    DatasetPtr templatePrototype_;
+    Uint64 templateSize_ = 0;
+    Uint64 templateTime_ = 0;
+    std::chrono::steady_clock::time_point templateChecked_;
+
+    // Signaled whenever a new generation is published, see waitForChanges()
+    mutable std::condition_variable changeWakeup_;
+
+    // Snapshot table handed to read guards, rebuilt by beginRead() when the generation has moved on
+    mutable std::shared_ptr<const SnapshotTable> readTable_;
+
+    // Top-level tag and decoded element of the compact item readAttribute() reads from; reused under mutex_,
+    // so a read allocates neither per call
+    mutable std::vector<Uint32> readTags_;
+    mutable DcmDataset readScratch_;
+
     // Server status tracker that logs state, number of processed requests, and error messages
     mutable SCPStatus serverStatus_;
 
+    // Settings the instance was created with
+    Options options_;
+
+    // Current runtime settings, replaced as a whole by setSettings(); read and written with std::atomic_load/atomic_store
+    std::shared_ptr<const Settings> settings_;
+
+    // Listener that took over after a port change (nullptr while the SCP itself listens)
+    std::shared_ptr<Listener> listener_;
+
+    // Set to end the accept loop of the SCP itself after its current association.
+    // DcmSCP::acceptAssociations() polls it through stopAfterCurrentAssociation() after every association request.
+    std::atomic<bool> stopRequested_{ false };
+
+    // Settings of the association currently served by the SCP itself; only used by its listener thread
+    std::shared_ptr<const Settings> associationSettings_;
+
     // Internal container for managing all loaded and active worklist datasets
     Worklist datasets_;
 
+    // Background thread that periodically expires datasets according to the retention policy
+    std::thread retentionThread_;
+
+    // Accept loops of the SCP itself and of every listener opened since start(); joined by stop()
+    std::vector<std::thread> listenerThreads_;
+    std::mutex retentionMutex_;
+    std::condition_variable retentionWakeup_;
+    bool retentionStop_ = false;
+
+};
+
+// Owns several isolated DICOMWorklistSCP instances in one process, e.g. one per tenant or site, addressed by name.
+// Instead of a retention thread per instance, a single ticker expires the datasets of all instances on the shared
+// worker pool once per minute, and bulk saves of all instances run in parallel on the shared I/O pool.
+class DICOMWorklistRegistry
+{
+public:
+    explicit DICOMWorklistRegistry(int workerThreads = 2, int ioThreads = 4, const std::vector<int>& cpuAffinity = {});
+    ~DICOMWorklistRegistry();
+
+    DICOMWorklistSCP* open(const std::string& name, const DICOMWorklistSCP::Options& options);
+    DICOMWorklistSCP* find(const std::string& name) const;
+    bool close(const std::string& name);
+    int count() const;
+    bool saveAll();
+
+private:
+    // Fixed set of threads running posted tasks in the order they were posted
+    class TaskPool
+    {
+    public:
+        TaskPool(int threads, const std::vector<int>& cpuAffinity, size_t firstCpu);
+        ~TaskPool();
+        void post(std::function<void()> task);
+
+    private:
+        std::vector<std::thread> threads_;
+        std::deque<std::function<void()>> tasks_;
+        std::mutex mutex_;
+        std::condition_variable wakeup_;
+        bool stop_ = false;
+    };
+
+    std::vector<std::shared_ptr<DICOMWorklistSCP>> instances() const;
+
+    // Instances by name; tasks on the pools hold their own reference, so closing never pulls an instance from under them
+    mutable std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<DICOMWorklistSCP>> instances_;
+
+    // Options of the instances open() is still constructing, reserving their name, data folder and port
+    std::map<std::string, DICOMWorklistSCP::Options> opening_;
+
+    TaskPool workers_;
+    TaskPool io_;
+
+    // Thread posting the expiry of all instances to workers_ once per minute
+    std::thread ticker_;
+    std::condition_variable tickerWakeup_;
+    bool tickerStop_ = false;
 };
 
 
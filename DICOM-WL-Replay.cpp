@@ -0,0 +1,275 @@
+// ===============================================================================================================
+// ========================================== File DICOM-WL-Replay.cpp ===========================================
+// ===============================================================================================================
+
+// C-FIND replay workload used to train the profile-guided build of the DICOMC library (see CMakeLists.txt).
+// Fills a worklist through the C API, then replays modality worklist queries over the network against it,
+// edits and saves items in delta mode and scans them through read guards, so the profile covers the
+// query index, the matcher, response encoding, delta encoding and snapshot building.
+//
+// Usage: DICOM-WL-Replay [queries.txt] [items] [rounds]
+// Each line of the query file holds one query as tag paths with values separated by ';',
+// e.g. "0010,0010=DOE*;0040,0100.0008,0060=CT". Empty lines match all items; '#' starts a comment.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+#include <dcmtk/config/osconfig.h>
+#include <dcmtk/dcmnet/scu.h>
+#include <dcmtk/dcmdata/dctk.h>
+
+#include "DICOMC.h"
+
+namespace
+{
+    const Uint16 ReplayPort = 11112;
+    const char* ReplayAETitle = "REPLAY_SCP";
+
+    // Query mix used when no query file is given
+    const char* DefaultQueries[] =
+    {
+        "",
+        "0040,0100.0008,0060=CT",
+        "0010,0010=PATIENT^1*",
+        "0040,0100.0040,0002=20250105-20250110",
+        "0040,0100.0040,0001=STATION2;0040,0100.0008,0060=MR",
+        "0008,0050=ACC00042",
+        "0010,0020=PID0001*;0040,0100.0040,0002=20250101-",
+    };
+
+    // Return keys requested by every query in addition to its matching keys
+    const char* ReturnKeys[] =
+    {
+        "0010,0010",
+        "0010,0020",
+        "0008,0050",
+        "0040,0100.0008,0060",
+        "0040,0100.0040,0001",
+        "0040,0100.0040,0002",
+    };
+
+    // Inserts the attribute at a tag path ("gggg,eeee" segments separated by '.') with the given value into 'query',
+    // creating the first item of every sequence on the way. Existing values are kept if 'value' is empty.
+    bool putPath(DcmItem& query, const std::string& path, const std::string& value)
+    {
+        DcmItem* parent = &query;
+        std::stringstream segments(path);
+        std::string segment;
+        std::vector<std::string> parts;
+        while (std::getline(segments, segment, '.')) parts.push_back(segment);
+
+        for (size_t i = 0; i < parts.size(); i++)
+        {
+            unsigned int group = 0, element = 0;
+            if (std::sscanf(parts[i].c_str(), "%4x,%4x", &group, &element) != 2) return false;
+            DcmTag tag(static_cast<Uint16>(group), static_cast<Uint16>(element));
+
+            if (i + 1 < parts.size())
+            {
+                DcmItem* item = nullptr;
+                if (parent->findOrCreateSequenceItem(tag, item, 0).bad() || !item) return false;
+                parent = item;
+            }
+            else if (!value.empty() || !parent->tagExists(tag))
+            {
+                if (parent->putAndInsertString(tag, value.c_str()).bad()) return false;
+            }
+        }
+        return true;
+    }
+
+    // Builds a C-FIND query from one line of the query file.
+    bool buildQuery(const std::string& line, DcmDataset& query)
+    {
+        std::stringstream keys(line);
+        std::string key;
+        while (std::getline(keys, key, ';'))
+        {
+            if (key.empty()) continue;
+            size_t separator = key.find('=');
+            if (separator == std::string::npos) return false;
+            if (!putPath(query, key.substr(0, separator), key.substr(separator + 1))) return false;
+        }
+
+        for (const char* returnKey : ReturnKeys)
+        {
+            if (!putPath(query, returnKey, "")) return false;
+        }
+        return true;
+    }
+
+    // Fills the worklist with 'count' items whose attributes spread over the values used by the default queries.
+    bool fillWorklist(LPVOID scp, int count)
+    {
+        static const char* modalities[] = { "CT", "MR", "US", "CR", "NM" };
+
+        std::vector<UINT64> handles(count);
+        if (!DICOMWLSPAddDatasets(scp, count, handles.data())) return false;
+
+        char value[64];
+        for (int i = 0; i < count; i++)
+        {
+            std::snprintf(value, sizeof(value), "PATIENT^%04d", i);
+            DICOMWLSPSetString(scp, handles[i], "0010,0010", value);
+            std::snprintf(value, sizeof(value), "PID%06d", i);
+            DICOMWLSPSetString(scp, handles[i], "0010,0020", value);
+            std::snprintf(value, sizeof(value), "ACC%05d", i);
+            DICOMWLSPSetString(scp, handles[i], "0008,0050", value);
+            DICOMWLSPSetString(scp, handles[i], "0040,0100.0008,0060", modalities[i % 5]);
+            std::snprintf(value, sizeof(value), "STATION%d", i % 8);
+            DICOMWLSPSetString(scp, handles[i], "0040,0100.0040,0001", value);
+            DICOMWLSPSetDate(scp, handles[i], "0040,0100.0040,0002", 2025, 1, 1 + i % 28);
+        }
+        return DICOMWLSPFlushAll(scp) != FALSE;
+    }
+
+    // Sends every query once over a single association and returns the number of responses received, or -1 on failure.
+    long replayQueries(const std::vector<std::string>& lines)
+    {
+        DcmSCU scu;
+        scu.setAETitle("REPLAY_SCU");
+        scu.setPeerHostName("127.0.0.1");
+        scu.setPeerPort(ReplayPort);
+        scu.setPeerAETitle(ReplayAETitle);
+
+        OFList<OFString> syntaxes;
+        syntaxes.push_back(UID_LittleEndianImplicitTransferSyntax);
+        scu.addPresentationContext(UID_FINDModalityWorklistInformationModel, syntaxes);
+
+        if (scu.initNetwork().bad() || scu.negotiateAssociation().bad()) return -1;
+        T_ASC_PresentationContextID presID = scu.findPresentationContextID(UID_FINDModalityWorklistInformationModel, "");
+
+        long received = 0;
+        for (const auto& line : lines)
+        {
+            DcmDataset query;
+            if (!buildQuery(line, query))
+            {
+                std::cout << "Skipping malformed query: " << line << std::endl;
+                continue;
+            }
+
+            OFList<QRResponse*> responses;
+            if (scu.sendFINDRequest(presID, &query, &responses).good())
+            {
+                received += static_cast<long>(responses.size());
+            }
+            for (QRResponse* response : responses)
+            {
+                delete response;
+            }
+        }
+
+        scu.releaseAssociation();
+        return received;
+    }
+
+    // Reads all items through a read guard, then edits a tenth of them and saves the changes in delta mode.
+    void editAndScan(LPVOID scp, int round)
+    {
+        LPVOID guard = DICOMWLSPBeginRead(scp);
+        int count = DICOMWLSPReadCount(guard);
+        std::vector<UINT64> handles;
+        size_t length = 0;
+        for (int i = 0; i < count; i++)
+        {
+            handles.push_back(DICOMWLSPReadHandle(guard, i));
+            for (const char* path : ReturnKeys)
+            {
+                INT valueLength = 0;
+                if (DICOMWLSPReadValue(guard, i, path, &valueLength)) length += valueLength;
+            }
+        }
+        DICOMWLSPEndRead(guard);
+
+        char value[32];
+        for (size_t i = round % 10; i < handles.size(); i += 10)
+        {
+            std::snprintf(value, sizeof(value), "STATION%d", static_cast<int>((i + round) % 8));
+            DICOMWLSPSetString(scp, handles[i], "0040,0100.0040,0001", value);
+        }
+        DICOMWLSPFlushDirty(scp);
+
+        std::cout << "Round " << round << ": scanned " << count << " items (" << length << " value bytes)" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> lines;
+    if (argc > 1)
+    {
+        std::ifstream file(argv[1]);
+        if (!file)
+        {
+            std::cout << "Cannot open query file: " << argv[1] << std::endl;
+            return 1;
+        }
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (!line.empty() && line[0] == '#') continue;
+            lines.push_back(line);
+        }
+    }
+    else
+    {
+        lines.assign(std::begin(DefaultQueries), std::end(DefaultQueries));
+    }
+
+    int items = argc > 2 ? std::atoi(argv[2]) : 5000;
+    int rounds = argc > 3 ? std::atoi(argv[3]) : 20;
+    if (items <= 0 || rounds <= 0)
+    {
+        std::cout << "Usage: DICOM-WL-Replay [queries.txt] [items] [rounds]" << std::endl;
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all("./replay-worklist/", ec);
+
+    DICOMWLSPOPTIONS options = {};
+    options.Size = sizeof(options);
+    options.DataFolder = "./replay-worklist/";
+    options.FilePrefix = "replay_";
+    options.PersistMode = 1;
+    options.Port = ReplayPort;
+    options.AETitle = ReplayAETitle;
+
+    LPVOID scp = DICOMWLSPCreateEx(&options);
+    if (!scp)
+    {
+        std::cout << "Failed to create SCP instance." << std::endl;
+        return 1;
+    }
+
+    std::cout << "Filling worklist with " << items << " items..." << std::endl;
+    if (!fillWorklist(scp, items) || !DICOMWLSPStart(scp))
+    {
+        std::cout << "Failed to prepare the worklist." << std::endl;
+        return 1;
+    }
+
+    for (int round = 0; round < rounds; round++)
+    {
+        long received = replayQueries(lines);
+        if (received < 0)
+        {
+            std::cout << "Association with the SCP failed." << std::endl;
+            DICOMWLSPStop(scp);
+            return 1;
+        }
+        std::cout << "Round " << round << ": " << lines.size() << " queries, " << received << " responses" << std::endl;
+        editAndScan(scp, round);
+    }
+
+    DICOMWLSPStop(scp);
+    std::filesystem::remove_all("./replay-worklist/", ec);
+    return 0;
+}
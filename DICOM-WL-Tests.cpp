@@ -0,0 +1,1057 @@
+// ===============================================================================================================
+// =========================================== File DICOM-WL-Tests.cpp ===========================================
+// ===============================================================================================================
+
+// Behavior tests of the worklist core.
+// Every test works in a folder of its own below the system temp folder and reopens instances on it
+// to check what survived on disk.
+//
+// Usage: DICOM-WL-Tests [test]
+// Without an argument all tests run; otherwise only the named one. Returns 0 if all of them passed.
+
+#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+
+#include <dcmtk/config/osconfig.h>
+#include <dcmtk/dcmdata/dctk.h>
+#include <dcmtk/dcmnet/scu.h>
+
+#include "CDICOMWorklistSCP.h"
+
+namespace
+{
+    using Handle = DICOMWorklistSCP::Handle;
+
+    const char* PatientName = "0010,0010";
+    const char* PatientId = "0010,0020";
+    const char* Modality = "0040,0100[0].0008,0060";
+
+    // Port the SCPs of the C-FIND tests listen on
+    const Uint16 TestPort = 11112;
+
+    int failures = 0;
+
+    // Reports a failed expectation with its location; the test goes on, so one run shows all failures
+    void check(bool condition, const char* expression, int line)
+    {
+        if (condition) return;
+        std::cout << "  FAILED line " << line << ": " << expression << std::endl;
+        failures++;
+    }
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+    // Returns an empty data folder for 'test', with the trailing separator the SCP expects
+    std::string freshFolder(const std::string& test)
+    {
+        std::filesystem::path folder = std::filesystem::temp_directory_path() / ("DICOM-WL-Tests-" + test);
+        std::error_code ec;
+        std::filesystem::remove_all(folder, ec);
+        std::filesystem::create_directories(folder);
+        return folder.string() + "/";
+    }
+
+    std::unique_ptr<DICOMWorklistSCP> openWorklist(const std::string& folder, DICOMWorklistSCP::PersistMode mode, bool compact = false)
+    {
+        DICOMWorklistSCP::Options options;
+        options.dataFolder_ = folder;
+        options.persistMode_ = mode;
+        options.compactItems_ = compact;
+        options.port_ = TestPort;
+        return std::make_unique<DICOMWorklistSCP>(options);
+    }
+
+    // Returns the string value at 'path', or "<missing>" if it cannot be read
+    std::string valueOf(const DICOMWorklistSCP& scp, Handle handle, const char* path)
+    {
+        char buffer[256];
+        if (!scp.getString(handle, path, buffer, sizeof(buffer))) return "<missing>";
+        return buffer;
+    }
+
+    // Returns the handles of all items
+    std::vector<Handle> handlesOf(const DICOMWorklistSCP& scp)
+    {
+        std::vector<Handle> handles(1024);
+        int count = 0;
+        if (!scp.listDatasets(handles.data(), static_cast<int>(handles.size()), &count)) return {};
+        handles.resize(std::min(count, static_cast<int>(handles.size())));
+        return handles;
+    }
+
+    int countOf(const DICOMWorklistSCP& scp)
+    {
+        int count = -1;
+        scp.getDatasetCount(&count);
+        return count;
+    }
+
+    // Adds an item with the given patient name, saved to disk
+    Handle addSaved(DICOMWorklistSCP& scp, const char* name)
+    {
+        Handle handle = 0;
+        if (!scp.addDataset(&handle)) return 0;
+        scp.setString(handle, PatientName, name);
+        scp.saveDataset(handle);
+        return handle;
+    }
+
+    // Sets the start date of the first scheduled procedure step and saves the item
+    bool schedule(DICOMWorklistSCP& scp, Handle handle, const char* date)
+    {
+        return scp.setString(handle, "0040,0100[0].0040,0002", date) && scp.saveDataset(handle);
+    }
+
+    // Returns the contents of a file
+    std::string contentsOf(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+
+    // -------------------------------------------------- Delta log --------------------------------------------------
+
+    // Changes appended to the delta log are replayed when the worklist is opened again without a compaction,
+    // as after a crash; a torn record at the end of the log is cut off without losing the intact ones.
+    void deltaReplayAfterCrash()
+    {
+        std::string folder = freshFolder("crash");
+        {
+            auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Delta);
+            Handle handle = addSaved(*scp, "DOE^A");
+            CHECK(scp->setString(handle, PatientName, "DOE^B"));
+            CHECK(scp->saveDataset(handle));
+        }
+        {
+            // A copy of the intact record that misses its last byte, as left by a crash during the append
+            std::string record = contentsOf(folder + "worklist.delta");
+            CHECK(!record.empty());
+            std::ofstream log(folder + "worklist.delta", std::ios::binary | std::ios::app);
+            log.write(record.data(), static_cast<std::streamsize>(record.size()) - 1);
+        }
+
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Delta);
+        std::vector<Handle> handles = handlesOf(*scp);
+        CHECK(handles.size() == 1);
+        if (!handles.empty()) CHECK(valueOf(*scp, handles[0], PatientName) == "DOE^B");
+
+        std::string status;
+        CHECK(scp->getStatus(status) && status.find("damaged delta log tail") != std::string::npos);
+    }
+
+    // A delta log left behind by a failed compaction must not roll back changes written in full afterwards:
+    // its records are stamped with the dataset file they apply to and skipped once the file was replaced.
+    void deltaReplayAfterCompactionFailure()
+    {
+        std::string folder = freshFolder("compaction");
+        const std::string log = folder + "worklist.delta";
+        const std::string staleLog = folder + "stale.delta";
+        {
+            auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Delta);
+            Handle handle = addSaved(*scp, "DOE^A");
+            CHECK(scp->setString(handle, PatientName, "DOE^B"));
+            CHECK(scp->saveDataset(handle));
+            CHECK(std::filesystem::exists(log));
+            std::filesystem::copy_file(log, staleLog);
+
+            CHECK(scp->setPersistMode(DICOMWorklistSCP::PersistMode::Full));
+            CHECK(scp->setString(handle, PatientName, "DOE^CHARLES"));
+            CHECK(scp->saveDataset(handle));
+        }
+        std::filesystem::rename(staleLog, log);
+
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Delta);
+        std::vector<Handle> handles = handlesOf(*scp);
+        CHECK(handles.size() == 1);
+        if (!handles.empty()) CHECK(valueOf(*scp, handles[0], PatientName) == "DOE^CHARLES");
+    }
+
+
+    // -------------------------------------------------- Retention --------------------------------------------------
+
+    // Items whose scheduled procedure step started more than the retention period ago are purged, archived
+    // or hidden by expireDatasets(); items scheduled later, or without a start date, stay untouched.
+    void retentionPolicies()
+    {
+        using Policy = DICOMWorklistSCP::RetentionPolicy;
+        const std::string archive = (std::filesystem::temp_directory_path() / "DICOM-WL-Tests-archive").string();
+        std::error_code ec;
+        std::filesystem::remove_all(archive, ec);
+
+        // Opens a worklist with a past, a future and an unscheduled item and expires it under 'policy'
+        auto expireUnder = [&archive](const std::string& test, Policy policy, int retentionMinutes, int expectedExpired)
+        {
+            std::string folder = freshFolder(test);
+            auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+            Handle past = addSaved(*scp, "DOE^PAST");
+            Handle future = addSaved(*scp, "DOE^FUTURE");
+            addSaved(*scp, "DOE^UNSCHEDULED");
+            CHECK(schedule(*scp, past, "20000101"));
+            CHECK(schedule(*scp, future, "29991231"));
+
+            CHECK(scp->setRetentionPolicy(policy, retentionMinutes, policy == Policy::Archive ? archive : ""));
+            int expired = -1;
+            CHECK(scp->expireDatasets(&expired));
+            CHECK(expired == expectedExpired);
+            CHECK(valueOf(*scp, future, PatientName) == "DOE^FUTURE");
+            if (expectedExpired > 0 && policy != Policy::Hide) CHECK(valueOf(*scp, past, PatientName) == "<missing>");
+
+            // A second sweep finds nothing new
+            CHECK(scp->expireDatasets(&expired) && expired == 0);
+            return scp;
+        };
+
+        {
+            auto scp = expireUnder("retention-keep", Policy::Keep, 0, 0);
+            CHECK(countOf(*scp) == 3);
+        }
+        {
+            // Expiries beyond the span of the wheel levels wait in the overflow list
+            auto scp = expireUnder("retention-long", Policy::Purge, 100 * 366 * 24 * 60, 0);
+            CHECK(countOf(*scp) == 3);
+        }
+        {
+            auto scp = expireUnder("retention-purge", Policy::Purge, 60, 1);
+            CHECK(countOf(*scp) == 2);
+        }
+        {
+            auto scp = expireUnder("retention-archive", Policy::Archive, 60, 1);
+            CHECK(countOf(*scp) == 2);
+            CHECK(std::filesystem::exists(archive) && !std::filesystem::is_empty(archive));
+        }
+        {
+            auto scp = expireUnder("retention-hide", Policy::Hide, 60, 1);
+            CHECK(countOf(*scp) == 3);
+
+            // Hidden items become visible again once the policy no longer expires them
+            CHECK(scp->setRetentionPolicy(Policy::Purge, 100 * 366 * 24 * 60));
+            int expired = -1;
+            CHECK(scp->expireDatasets(&expired) && expired == 0);
+            CHECK(countOf(*scp) == 3);
+        }
+    }
+
+
+    // -------------------------------------------------- Quarantine -------------------------------------------------
+
+    // A dataset file that cannot be parsed is moved into the quarantine folder instead of being loaded.
+    // The temp file of an interrupted first save is promoted; one whose previous version exists is discarded.
+    void quarantineOfCorruptFiles()
+    {
+        std::string folder = freshFolder("quarantine");
+        const std::string broken = "dataset_0000000000000001.dcm";
+        const std::string promoted = "dataset_0000000000000002.dcm";
+        const std::string kept = "dataset_0000000000000003.dcm";
+        {
+            std::ofstream(folder + broken, std::ios::binary) << "not a DICOM file";
+            std::ofstream(folder + kept + ".tmp", std::ios::binary) << "interrupted save";
+
+            DcmDataset dataset;
+            dataset.putAndInsertString(DCM_PatientName, "DOE^PROMOTED");
+            CHECK(dataset.saveFile((folder + promoted + ".tmp").c_str(), EXS_LittleEndianExplicit).good());
+            dataset.putAndInsertString(DCM_PatientName, "DOE^KEPT");
+            CHECK(dataset.saveFile((folder + kept).c_str(), EXS_LittleEndianExplicit).good());
+        }
+
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+        CHECK(countOf(*scp) == 2);
+        CHECK(!std::filesystem::exists(folder + broken));
+        CHECK(std::filesystem::exists(folder + "quarantine/" + broken));
+        CHECK(std::filesystem::exists(folder + promoted));
+        CHECK(!std::filesystem::exists(folder + promoted + ".tmp"));
+        CHECK(!std::filesystem::exists(folder + kept + ".tmp"));
+
+        std::vector<std::string> names;
+        for (Handle handle : handlesOf(*scp))
+        {
+            names.push_back(valueOf(*scp, handle, PatientName));
+        }
+        CHECK(std::count(names.begin(), names.end(), "DOE^PROMOTED") == 1);
+        CHECK(std::count(names.begin(), names.end(), "DOE^KEPT") == 1);
+
+        Handle handle = addSaved(*scp, "DOE^A");
+        CHECK(valueOf(*scp, handle, PatientName) == "DOE^A");
+    }
+
+
+    // ---------------------------------------------------- C-FIND ---------------------------------------------------
+
+    // Scheduled procedure step of a test item
+    struct Step
+    {
+        const char* date_;
+        const char* station_;
+        const char* modality_;
+    };
+
+    // Adds a saved item with the given patient and scheduled procedure steps
+    Handle addScheduled(DICOMWorklistSCP& scp, const char* name, const char* patientId, const std::vector<Step>& steps)
+    {
+        Handle handle = addSaved(scp, name);
+        scp.setString(handle, PatientId, patientId);
+        for (size_t i = 0; i < steps.size(); i++)
+        {
+            std::string step = "0040,0100[" + std::to_string(i) + "].";
+            scp.setString(handle, (step + "0040,0002").c_str(), steps[i].date_);
+            scp.setString(handle, (step + "0040,0001").c_str(), steps[i].station_);
+            scp.setString(handle, (step + "0008,0060").c_str(), steps[i].modality_);
+        }
+        scp.saveDataset(handle);
+        return handle;
+    }
+
+    // Builds a C-FIND identifier asking for PatientName and PatientID; 'step' adds a scheduled procedure
+    // step item with the given date, station and modality keys (nullptr = key not requested)
+    DcmDataset findQuery(const char* name, const char* patientId, const Step* step = nullptr)
+    {
+        DcmDataset query;
+        query.putAndInsertString(DCM_PatientName, name);
+        query.putAndInsertString(DCM_PatientID, patientId);
+        if (step)
+        {
+            DcmItem* item = nullptr;
+            query.findOrCreateSequenceItem(DCM_ScheduledProcedureStepSequence, item, 0);
+            if (item && step->date_) item->putAndInsertString(DCM_ScheduledProcedureStepStartDate, step->date_);
+            if (item && step->station_) item->putAndInsertString(DCM_ScheduledStationAETitle, step->station_);
+            if (item && step->modality_) item->putAndInsertString(DCM_Modality, step->modality_);
+        }
+        return query;
+    }
+
+    // Requests an association for worklist C-FIND from the SCP on 'port'; returns false if it was not accepted
+    bool connect(DcmSCU& scu, Uint16 port)
+    {
+        scu.setAETitle("TESTS_SCU");
+        scu.setPeerHostName("127.0.0.1");
+        scu.setPeerPort(port);
+        scu.setPeerAETitle("WORKLIST_SCP");
+
+        OFList<OFString> syntaxes;
+        syntaxes.push_back(UID_LittleEndianImplicitTransferSyntax);
+        scu.addPresentationContext(UID_FINDModalityWorklistInformationModel, syntaxes);
+        return scu.initNetwork().good() && scu.negotiateAssociation().good();
+    }
+
+    // Sends a C-FIND request to the SCP on 'port' and returns the patient names of all pending responses
+    // in the order received, or { "<failed>" } if the query could not be sent
+    std::vector<std::string> findOverNetwork(DcmDataset query, Uint16 port = TestPort, Uint16* finalStatus = nullptr)
+    {
+        DcmSCU scu;
+        if (!connect(scu, port)) return { "<failed>" };
+
+        T_ASC_PresentationContextID presID = scu.findPresentationContextID(UID_FINDModalityWorklistInformationModel, "");
+        OFList<QRResponse*> responses;
+        std::vector<std::string> names;
+        if (scu.sendFINDRequest(presID, &query, &responses).bad()) names.push_back("<failed>");
+
+        for (QRResponse* response : responses)
+        {
+            OFString name;
+            if (response->m_dataset)
+            {
+                response->m_dataset->findAndGetOFString(DCM_PatientName, name);
+                names.push_back(name.c_str());
+            }
+            else if (finalStatus)
+            {
+                *finalStatus = response->m_status;
+            }
+            delete response;
+        }
+
+        scu.releaseAssociation();
+        return names;
+    }
+
+    // Returns true once the SCP on 'port' no longer answers, waiting up to two seconds for a listener that
+    // was told to stop to close its port
+    bool portReleased(Uint16 port)
+    {
+        for (int attempt = 0; attempt < 20; attempt++)
+        {
+            if (findOverNetwork(findQuery("", ""), port) == std::vector<std::string>({ "<failed>" })) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        return false;
+    }
+
+    std::vector<std::string> sorted(std::vector<std::string> values)
+    {
+        std::sort(values.begin(), values.end());
+        return values;
+    }
+
+    // C-FIND requests are matched against all items: universal and wildcard matching, case-insensitive
+    // person names, date ranges, and sequence keys that have to match within a single step item.
+    // Items hidden by the retention policy are not returned.
+    void cfindMatching()
+    {
+        using Names = std::vector<std::string>;
+        std::string folder = freshFolder("cfind");
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+        addScheduled(*scp, "DOE^JOHN", "P1", { { "20250101", "CT1", "CT" } });
+        addScheduled(*scp, "DOE^JANE", "P2", { { "20250115", "MR1", "MR" } });
+        addScheduled(*scp, "SMITH^ANNA", "P3", { { "20250201", "CT2", "CT" }, { "20250301", "MR1", "MR" } });
+
+        if (!scp->start())
+        {
+            std::cout << "  skipped: port " << TestPort << " is not available" << std::endl;
+            return;
+        }
+
+        CHECK(findOverNetwork(findQuery("", "")) == Names({ "DOE^JOHN", "DOE^JANE", "SMITH^ANNA" }));
+        CHECK(findOverNetwork(findQuery("DOE*", "")) == Names({ "DOE^JOHN", "DOE^JANE" }));
+        CHECK(findOverNetwork(findQuery("doe^j?ne", "")) == Names({ "DOE^JANE" }));
+        CHECK(findOverNetwork(findQuery("", "P2")) == Names({ "DOE^JANE" }));
+        CHECK(findOverNetwork(findQuery("DOE*", "P3")).empty());
+        CHECK(findOverNetwork(findQuery("", "P?")).size() == 3);
+
+        Step january = { "20250101-20250131", nullptr, nullptr };
+        CHECK(findOverNetwork(findQuery("", "", &january)) == Names({ "DOE^JOHN", "DOE^JANE" }));
+        Step fromFebruary = { "20250201-", nullptr, nullptr };
+        CHECK(findOverNetwork(findQuery("", "", &fromFebruary)) == Names({ "SMITH^ANNA" }));
+        Step untilNewYear = { "-20250101", nullptr, nullptr };
+        CHECK(findOverNetwork(findQuery("", "", &untilNewYear)) == Names({ "DOE^JOHN" }));
+
+        Step mr = { nullptr, "MR1", nullptr };
+        CHECK(findOverNetwork(findQuery("", "", &mr)) == Names({ "DOE^JANE", "SMITH^ANNA" }));
+        Step mrInFebruary = { "20250201", "MR1", nullptr };
+        CHECK(findOverNetwork(findQuery("", "", &mrInFebruary)).empty());
+        Step mrInMarch = { "20250301", "MR1", "MR" };
+        CHECK(findOverNetwork(findQuery("", "", &mrInMarch)) == Names({ "SMITH^ANNA" }));
+        Step ctStation = { nullptr, "CT*", "CT" };
+        CHECK(findOverNetwork(findQuery("", "", &ctStation)) == Names({ "DOE^JOHN", "SMITH^ANNA" }));
+
+        CHECK(scp->setRetentionPolicy(DICOMWorklistSCP::RetentionPolicy::Hide, 60));
+        CHECK(scp->expireDatasets());
+        CHECK(findOverNetwork(findQuery("", "")).empty());
+
+        // A step item of universal keys only does not require the item to have scheduled procedure steps
+        addScheduled(*scp, "ROE^NOSTEP", "P4", {});
+        Step universal = { "", "", "" };
+        CHECK(findOverNetwork(findQuery("", "", &universal)) == Names({ "ROE^NOSTEP" }));
+
+        CHECK(scp->stop());
+        CHECK(portReleased(TestPort));
+    }
+
+
+    // --------------------------------------------------- Sidecar ---------------------------------------------------
+
+    // On reopening, the query index is filled from worklist.idx for every dataset file whose size and
+    // modification time match its record. A file altered behind the sidecar's back with both kept
+    // still answers with its recorded keys, which proves they were not extracted again.
+    void indexSidecar()
+    {
+        using Names = std::vector<std::string>;
+        std::string folder = freshFolder("sidecar");
+        {
+            auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+            addScheduled(*scp, "DOE^JOHN", "PID-SIDECAR-1", { { "20250101", "CT1", "CT" } });
+            addScheduled(*scp, "DOE^JANE", "PID-SIDECAR-2", { { "20250115", "MR1", "MR" } });
+        }
+        CHECK(std::filesystem::exists(folder + "worklist.idx"));
+
+        for (const auto& entry : std::filesystem::directory_iterator(folder))
+        {
+            std::string contents = contentsOf(entry.path().string());
+            size_t position = contents.find("PID-SIDECAR-1");
+            if (entry.path().extension() != ".dcm" || position == std::string::npos) continue;
+
+            auto time = std::filesystem::last_write_time(entry.path());
+            contents.replace(position, 13, "PID-SIDECAR-9");
+            std::ofstream(entry.path(), std::ios::binary | std::ios::trunc) << contents;
+            std::filesystem::last_write_time(entry.path(), time);
+        }
+
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+        CHECK(countOf(*scp) == 2);
+        if (!scp->start())
+        {
+            std::cout << "  skipped: port " << TestPort << " is not available" << std::endl;
+            return;
+        }
+
+        CHECK(findOverNetwork(findQuery("", "PID-SIDECAR-2")) == Names({ "DOE^JANE" }));
+        Step january = { "20250101-20250131", nullptr, nullptr };
+        CHECK(sorted(findOverNetwork(findQuery("", "", &january))) == Names({ "DOE^JANE", "DOE^JOHN" }));
+        Step mr = { nullptr, "MR1", nullptr };
+        CHECK(findOverNetwork(findQuery("", "", &mr)) == Names({ "DOE^JANE" }));
+
+        // The index still holds the recorded ID, which the altered dataset no longer matches
+        CHECK(findOverNetwork(findQuery("", "PID-SIDECAR-9")).empty());
+        CHECK(findOverNetwork(findQuery("", "PID-SIDECAR-1")).empty());
+        CHECK(findOverNetwork(findQuery("", "PID-SIDECAR-9*")) == Names({ "DOE^JOHN" }));
+
+        scp->stop();
+    }
+
+
+    // ----------------------------------------------------- Batch ---------------------------------------------------
+
+    // A batch applies its edits, deletes and adds together with a single generation bump. It is rejected
+    // without any change if an item it edits is gone; a rolled back batch leaves the worklist untouched.
+    // A batch that was applied but could not be saved is reported as such, stays visible and still returns
+    // the handles of its added items.
+    void commitBatch()
+    {
+        std::string folder = freshFolder("batch");
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+        Handle edited = addSaved(*scp, "DOE^A");
+        Handle deleted = addSaved(*scp, "DOE^B");
+
+        Uint64 before = 0, after = 0;
+        CHECK(scp->getGeneration(&before));
+        auto batch = scp->beginBatch();
+        CHECK(scp->batchAddDatasets(*batch, 2));
+        CHECK(scp->batchDeleteDataset(*batch, deleted));
+        auto* session = scp->batchEditDataset(*batch, edited);
+        CHECK(session != nullptr);
+        if (session) session->dataset_.putAndInsertString(DCM_PatientName, "DOE^EDITED");
+
+        std::vector<Handle> added;
+        CHECK(scp->commitBatch(std::move(batch), &added) == DICOMWorklistSCP::CommitResult::Committed);
+        CHECK(scp->getGeneration(&after) && after == before + 1);
+        CHECK(added.size() == 2);
+        CHECK(countOf(*scp) == 3);
+        CHECK(valueOf(*scp, edited, PatientName) == "DOE^EDITED");
+        CHECK(valueOf(*scp, deleted, PatientName) == "<missing>");
+
+        batch = scp->beginBatch();
+        CHECK(scp->batchAddDatasets(*batch, 1));
+        scp->rollbackBatch(std::move(batch));
+        CHECK(countOf(*scp) == 3);
+        if (added.empty()) return;
+
+        // An edit of an item deleted after the session was opened rejects the whole batch
+        batch = scp->beginBatch();
+        CHECK(scp->batchAddDatasets(*batch, 2));
+        session = scp->batchEditDataset(*batch, added[0]);
+        CHECK(session != nullptr);
+        if (session) session->dataset_.putAndInsertString(DCM_PatientName, "DOE^REJECTED");
+        CHECK(scp->deleteDataset(added[0]));
+
+        CHECK(scp->commitBatch(std::move(batch), &added) == DICOMWorklistSCP::CommitResult::Rejected);
+        CHECK(added.empty());
+        CHECK(countOf(*scp) == 2);
+        CHECK(valueOf(*scp, edited, PatientName) == "DOE^EDITED");
+
+        batch = scp->beginBatch();
+        CHECK(scp->batchAddDatasets(*batch, 1));
+        session = scp->batchEditDataset(*batch, edited);
+        CHECK(session != nullptr);
+        if (session) session->dataset_.putAndInsertString(DCM_PatientName, "DOE^UNSAVED");
+
+        // Replacing the data folder by a plain file makes every save fail
+        std::filesystem::path dataFolder = std::filesystem::path(folder).parent_path();
+        std::filesystem::remove_all(dataFolder);
+        std::ofstream(dataFolder.string()) << "blocked";
+
+        CHECK(scp->commitBatch(std::move(batch), &added) == DICOMWorklistSCP::CommitResult::SaveFailed);
+        CHECK(added.size() == 1);
+        CHECK(countOf(*scp) == 3);
+        CHECK(valueOf(*scp, edited, PatientName) == "DOE^UNSAVED");
+
+        std::filesystem::remove(dataFolder);
+        std::filesystem::create_directories(dataFolder);
+        CHECK(scp->saveDirtyDatasets());
+    }
+
+
+    // ---------------------------------------------------- Handles --------------------------------------------------
+
+    // The handle of a deleted item stays invalid after its slot was reused by a new item
+    void staleHandles()
+    {
+        std::string folder = freshFolder("handles");
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+
+        Handle stale = addSaved(*scp, "DOE^A");
+        CHECK(stale != 0);
+        CHECK(scp->deleteDataset(stale));
+        Handle fresh = addSaved(*scp, "DOE^B");
+
+        CHECK(fresh != stale);
+        CHECK(static_cast<Uint32>(fresh) == static_cast<Uint32>(stale));
+        CHECK(valueOf(*scp, stale, PatientName) == "<missing>");
+        CHECK(!scp->markDatasetDirty(stale));
+        CHECK(!scp->beginEdit(stale));
+        CHECK(!scp->deleteDataset(stale));
+        CHECK(!scp->getDataset(stale));
+        CHECK(!scp->getDataset(0));
+        CHECK(valueOf(*scp, fresh, PatientName) == "DOE^B");
+        CHECK(countOf(*scp) == 1);
+    }
+
+
+    // ---------------------------------------------- Attribute paths ------------------------------------------------
+
+    // Tag paths reach attributes in nested sequence items, with or without parentheses and item numbers.
+    // Malformed paths and values that do not fit the VR of the target attribute are rejected without
+    // changing the dataset.
+    void attributePaths()
+    {
+        std::string folder = freshFolder("paths");
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+        Handle handle = addSaved(*scp, "DOE^A");
+
+        CHECK(scp->setString(handle, "0040,0100[0].0040,0001", "STATION1"));
+        CHECK(valueOf(*scp, handle, "(0040,0100)[0].(0040,0001)") == "STATION1");
+        CHECK(valueOf(*scp, handle, "0040,0100.0040,0001") == "STATION1");
+        CHECK(valueOf(*scp, handle, "0040,0100[0].0040,0001") == "STATION1");
+
+        int count = -1;
+        CHECK(scp->getItemCount(handle, "0040,0100", &count) && count == 1);
+        int index = -1;
+        CHECK(scp->addItem(handle, "0040,0100", &index) && index == 1);
+        CHECK(scp->setString(handle, "0040,0100[1].0040,0001", "STATION2"));
+        CHECK(scp->getItemCount(handle, "0040,0100", &count) && count == 2);
+        CHECK(scp->deleteItem(handle, "0040,0100", 0));
+        CHECK(valueOf(*scp, handle, "0040,0100[0].0040,0001") == "STATION2");
+        CHECK(valueOf(*scp, handle, "0040,0100[1].0040,0001") == "<missing>");
+        CHECK(!scp->deleteItem(handle, "0040,0100", 1));
+        CHECK(scp->getItemCount(handle, "0008,1110", &count) && count == 0);
+
+        const char* malformed[] =
+        {
+            "", "0010", "0010,001", "0010;0010", "0010,001G", "(0010,0010", "0010,0010)", "0010,0010.",
+            "0010,0010[0]", "0040,0100[].0040,0001", "0040,0100[x].0040,0001", "0040,0100[0.0040,0001",
+            "0040,0100..0040,0001", "0040,0100[99999999].0040,0001",
+        };
+        for (const char* path : malformed)
+        {
+            check(!scp->setString(handle, path, "X"), path, __LINE__);
+        }
+        CHECK(!scp->setString(handle, nullptr, "X"));
+        CHECK(!scp->setString(handle, PatientName, nullptr));
+        CHECK(scp->getItemCount(handle, "0040,0100", &count) && count == 1);
+
+        char small[4];
+        size_t length = 0;
+        CHECK(!scp->getString(handle, PatientName, small, sizeof(small), &length));
+        CHECK(length == 5);
+
+        // VRs from the data dictionary decide which typed setters apply
+        Sint32 number = 0;
+        CHECK(scp->setInt(handle, "0020,0013", 42));
+        CHECK(scp->getInt(handle, "0020,0013", &number) && number == 42);
+        CHECK(!scp->setInt(handle, PatientName, 1));
+        CHECK(!scp->setInt(handle, "0028,0010", 70000));
+        CHECK(!scp->setInt(handle, "0028,0010", -1));
+        CHECK(scp->setInt(handle, "0028,0010", 512));
+        CHECK(!scp->getInt(handle, PatientName, &number));
+
+        int year = 0, month = 0, day = 0;
+        CHECK(scp->setDate(handle, "0040,0100[0].0040,0002", 2025, 2, 28));
+        CHECK(scp->getDate(handle, "0040,0100[0].0040,0002", &year, &month, &day));
+        CHECK(year == 2025 && month == 2 && day == 28);
+        CHECK(valueOf(*scp, handle, "0040,0100[0].0040,0002") == "20250228");
+        CHECK(!scp->setDate(handle, PatientName, 2025, 2, 28));
+        CHECK(!scp->setDate(handle, "0040,0100[0].0040,0002", 2025, 13, 1));
+        CHECK(!scp->getDate(handle, PatientName, &year, &month, &day));
+
+        CHECK(!scp->addItem(handle, PatientName));
+        CHECK(valueOf(*scp, handle, PatientName) == "DOE^A");
+    }
+
+
+    // -------------------------------------------------- Change feed ------------------------------------------------
+
+    // The change feed returns the events after a generation in complete generations, oldest first,
+    // and asks for a resynchronization once the requested events were overwritten in its ring,
+    // for a generation it never published, or for a generation too large for the caller's buffer.
+    void changeFeed()
+    {
+        using Kind = DICOMWorklistSCP::ChangeKind;
+        std::string folder = freshFolder("changes");
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+
+        std::vector<DICOMWorklistSCP::ChangeEvent> events(8);
+        int count = -1;
+        Uint64 start = 0, generation = 0;
+        bool resync = true;
+        CHECK(scp->getGeneration(&start));
+
+        Handle handle = 0;
+        CHECK(scp->addDataset(&handle));
+        CHECK(scp->setString(handle, PatientName, "DOE^A"));
+        CHECK(scp->getChanges(start, events.data(), 8, &count, &generation, &resync));
+        CHECK(!resync && count == 2 && generation == start + 2);
+        CHECK(events[0].kind_ == Kind::Added && events[0].handle_ == handle && events[0].generation_ == start + 1);
+        CHECK(events[1].kind_ == Kind::Modified && events[1].handle_ == handle && events[1].generation_ == start + 2);
+
+        CHECK(scp->getChanges(generation, events.data(), 8, &count, &generation, &resync));
+        CHECK(!resync && count == 0 && generation == start + 2);
+        CHECK(scp->getChanges(generation + 1, events.data(), 8, &count, &generation, &resync) && resync);
+        CHECK(!scp->waitForChanges(generation, 10));
+
+        // Reading in small steps continues after the last complete generation
+        Uint64 since = generation;
+        for (int i = 0; i < 5; i++)
+        {
+            CHECK(scp->setString(handle, PatientName, ("DOE^" + std::to_string(i)).c_str()));
+        }
+        int total = 0;
+        for (int round = 0; round < 5 && since < start + 7; round++)
+        {
+            CHECK(scp->getChanges(since, events.data(), 2, &count, &since, &resync) && !resync);
+            total += count;
+        }
+        CHECK(total == 5 && since == start + 7);
+
+        // A single generation with more events than the buffer holds
+        Handle added[4] = {};
+        CHECK(scp->addDatasets(4, added));
+        CHECK(scp->getChanges(since, events.data(), 2, &count, &generation, &resync) && resync);
+        CHECK(scp->getChanges(since, events.data(), 8, &count, &generation, &resync) && !resync && count == 4);
+
+        // Events older than the ring capacity are gone
+        since = generation;
+        for (int i = 0; i < 5000; i++)
+        {
+            scp->setString(handle, PatientName, (i % 2) ? "DOE^ODD" : "DOE^EVEN");
+        }
+        CHECK(scp->getChanges(since, events.data(), 8, &count, &generation, &resync) && resync);
+        CHECK(generation == since + 5000);
+        CHECK(scp->getChanges(generation - 3, events.data(), 8, &count, &generation, &resync) && !resync && count == 3);
+
+        CHECK(scp->clearAllDatasets());
+        CHECK(scp->getChanges(generation, events.data(), 8, &count, &generation, &resync) && !resync);
+        CHECK(count >= 1 && events[count - 1].kind_ == Kind::Cleared && events[count - 1].handle_ == 0);
+    }
+
+
+    // ---------------------------------------------------- Status ---------------------------------------------------
+
+    // waitForStatus() returns once a counter reaches its threshold or an error is reported,
+    // and times out with false if nothing happens
+    void waitForStatus()
+    {
+        using Counter = DICOMWorklistSCP::StatusCounter;
+        std::string folder = freshFolder("status");
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+
+        DICOMWorklistSCP::StatusInfo info = {};
+        CHECK(scp->getStatus(info));
+        CHECK(info.datasetCount_ == 0);
+        auto started = std::chrono::steady_clock::now();
+        CHECK(!scp->waitForStatus(info, 50));
+        CHECK(std::chrono::steady_clock::now() - started >= std::chrono::milliseconds(40));
+
+        std::thread writer([&scp]()
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                Handle handle = 0;
+                scp->addDataset(&handle);
+            }
+        });
+        CHECK(scp->waitForStatus(info, 5000, Counter::Datasets, 3));
+        CHECK(info.datasetCount_ == 3);
+        writer.join();
+
+        Uint64 generation = info.generation_;
+        std::thread editor([&scp]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            Handle handle = 0;
+            scp->addDataset(&handle);
+        });
+        CHECK(scp->waitForStatus(info, 5000, Counter::Generation, generation + 1));
+        CHECK(info.generation_ == generation + 1 && info.datasetCount_ == 4);
+        editor.join();
+
+        // An archive folder below a plain file cannot be created, which reports an error
+        std::ofstream(folder + "blocked") << "blocked";
+        Uint64 errors = info.errorCount_;
+        std::thread failing([&scp, folder]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            scp->setRetentionPolicy(DICOMWorklistSCP::RetentionPolicy::Archive, 60, folder + "blocked/archive");
+        });
+        CHECK(scp->waitForStatus(info, 5000));
+        CHECK(info.errorCount_ == errors + 1);
+        failing.join();
+    }
+
+
+    // ---------------------------------------------------- Settings -------------------------------------------------
+
+    // Settings are replaced as a whole: a published object never changes, invalid settings leave the
+    // current ones in effect and concurrent updates of different fields all take effect. A running SCP
+    // applies maxMatches to the next query, answers on a new port as soon as setSettings() returns and
+    // releases the previous port.
+    void settingsSwap()
+    {
+        using Names = std::vector<std::string>;
+        std::string folder = freshFolder("settings");
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+        addSaved(*scp, "DOE^JOHN");
+        addSaved(*scp, "DOE^JANE");
+        addSaved(*scp, "SMITH^ANNA");
+
+        auto previous = scp->getSettings();
+        DICOMWorklistSCP::Settings settings = *previous;
+        settings.maxMatches_ = 2;
+        CHECK(scp->setSettings(settings));
+        CHECK(previous->maxMatches_ == 0);
+        CHECK(scp->getSettings()->maxMatches_ == 2);
+
+        DICOMWorklistSCP::Settings invalid = settings;
+        invalid.aeTitle_ = "AN_AE_TITLE_TOO_LONG";
+        CHECK(!scp->setSettings(invalid));
+        invalid = settings;
+        invalid.maxMatchesByAE_["TESTS_SCU"] = -1;
+        CHECK(!scp->setSettings(invalid));
+        CHECK(scp->getSettings()->aeTitle_ == "WORKLIST_SCP");
+        CHECK(scp->getSettings()->maxMatches_ == 2);
+
+        // Concurrent updates of different fields all take effect
+        const int writers = 8;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < writers; i++)
+        {
+            threads.emplace_back([&scp, i]()
+            {
+                for (int round = 0; round < 50; round++)
+                {
+                    scp->updateSettings([i, round](DICOMWorklistSCP::Settings& edited)
+                    {
+                        edited.maxMatchesByAE_["AE" + std::to_string(i)] = round;
+                    });
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        auto current = scp->getSettings();
+        CHECK(current->maxMatchesByAE_.size() == static_cast<size_t>(writers));
+        for (const auto& [aeTitle, maxMatches] : current->maxMatchesByAE_)
+        {
+            CHECK(maxMatches == 49);
+        }
+        CHECK(!scp->updateSettings([](DICOMWorklistSCP::Settings& edited) { edited.maxMatches_ = -1; }));
+        CHECK(scp->getSettings()->maxMatches_ == 2);
+
+        if (!scp->start())
+        {
+            std::cout << "  skipped: port " << TestPort << " is not available" << std::endl;
+            return;
+        }
+
+        Uint16 status = 0;
+        CHECK(findOverNetwork(findQuery("", ""), TestPort, &status).size() == 2);
+        CHECK(status == STATUS_FIND_Refused_OutOfResources);
+        settings.maxMatchesByAE_["TESTS_SCU"] = 0;
+        CHECK(scp->setSettings(settings));
+        CHECK(findOverNetwork(findQuery("", ""), TestPort, &status).size() == 3);
+        CHECK(status == STATUS_Success);
+
+        settings.port_ = TestPort + 1;
+        if (scp->setSettings(settings))
+        {
+            CHECK(findOverNetwork(findQuery("DOE^JANE", ""), TestPort + 1) == Names({ "DOE^JANE" }));
+            CHECK(portReleased(TestPort));
+        }
+        else
+        {
+            std::cout << "  port change skipped: port " << TestPort + 1 << " is not available" << std::endl;
+        }
+
+        scp->stop();
+    }
+
+
+    // Items added from the template share its prototype until they are modified; a modification
+    // affects neither the other items nor items added later
+    void templateCopyOnWrite()
+    {
+        std::string folder = freshFolder("template");
+        const std::string templateFile = folder + "template.tpl";
+        {
+            DcmFileFormat file;
+            file.getDataset()->putAndInsertString(DCM_PatientName, "TEMPLATE^X");
+            CHECK(file.saveFile(templateFile.c_str(), EXS_LittleEndianExplicit).good());
+        }
+
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full);
+        CHECK(scp->setTemplateFile(templateFile));
+
+        Handle handles[2] = {};
+        CHECK(scp->addDatasets(2, handles));
+        CHECK(scp->setString(handles[0], PatientName, "EDITED"));
+        CHECK(valueOf(*scp, handles[0], PatientName) == "EDITED");
+        CHECK(valueOf(*scp, handles[1], PatientName) == "TEMPLATE^X");
+
+        Handle later = 0;
+        CHECK(scp->addDataset(&later));
+        CHECK(valueOf(*scp, later, PatientName) == "TEMPLATE^X");
+
+        auto dataset = scp->getDataset(handles[1]);
+        CHECK(dataset && dataset->putAndInsertString(DCM_PatientName, "DIRECT").good());
+        CHECK(scp->markDatasetDirty(handles[1]));
+        CHECK(valueOf(*scp, handles[1], PatientName) == "DIRECT");
+        CHECK(valueOf(*scp, later, PatientName) == "TEMPLATE^X");
+    }
+
+
+    // ------------------------------------------------- Compact items -----------------------------------------------
+
+    // Values written to compact items read back the same while packed, after unpacking and packing again,
+    // and after a reload
+    void compactRoundTrip()
+    {
+        std::string folder = freshFolder("compact");
+        {
+            auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full, true);
+            Handle handle = addSaved(*scp, "DOE^A");
+            CHECK(scp->setString(handle, Modality, "CT"));
+            CHECK(scp->saveDataset(handle));
+
+            CHECK(valueOf(*scp, handle, PatientName) == "DOE^A");
+            CHECK(valueOf(*scp, handle, Modality) == "CT");
+            CHECK(scp->setCompactItems(false));
+            CHECK(valueOf(*scp, handle, Modality) == "CT");
+            CHECK(scp->setCompactItems(true));
+            CHECK(valueOf(*scp, handle, PatientName) == "DOE^A");
+            CHECK(valueOf(*scp, handle, Modality) == "CT");
+        }
+
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full, true);
+        std::vector<Handle> handles = handlesOf(*scp);
+        CHECK(handles.size() == 1);
+        if (handles.empty()) return;
+        CHECK(valueOf(*scp, handles[0], PatientName) == "DOE^A");
+        CHECK(valueOf(*scp, handles[0], Modality) == "CT");
+    }
+
+    // A dataset pointer from pinDataset() stays valid while the change is published and saved, as the
+    // pinned item is not packed; after releaseDataset() the item is packed again and keeps the change
+    void compactPinnedDataset()
+    {
+        std::string folder = freshFolder("pinned");
+        auto scp = openWorklist(folder, DICOMWorklistSCP::PersistMode::Full, true);
+        Handle handle = addSaved(*scp, "DOE^A");
+
+        DcmDataset* dataset = scp->pinDataset(handle);
+        CHECK(dataset != nullptr);
+        if (!dataset) return;
+        CHECK(dataset->putAndInsertString(DCM_PatientName, "PINNED").good());
+        CHECK(scp->markDatasetDirty(handle));
+        CHECK(scp->saveDirtyDatasets());
+
+        OFString value;
+        CHECK(dataset->findAndGetOFString(DCM_PatientName, value).good() && value == "PINNED");
+        CHECK(valueOf(*scp, handle, PatientName) == "PINNED");
+
+        CHECK(scp->releaseDataset(handle));
+        CHECK(valueOf(*scp, handle, PatientName) == "PINNED");
+        CHECK(!scp->releaseDataset(0));
+    }
+
+
+    // ---------------------------------------------------- Shutdown -------------------------------------------------
+
+    // The shutdown sequence of DICOM-WLD: stop() waits for an open association to finish, and once it has returned
+    // the SCP no longer runs and its port is closed, so the following saveAll() sees no more network changes
+    void drainBeforeSave()
+    {
+        std::string folder = freshFolder("drain");
+        DICOMWorklistRegistry registry(1, 1);
+        DICOMWorklistSCP::Options options;
+        options.dataFolder_ = folder;
+        options.port_ = TestPort;
+        DICOMWorklistSCP* scp = registry.open("drain", options);
+        CHECK(scp != nullptr);
+        if (!scp) return;
+        Handle handle = addSaved(*scp, "DOE^A");
+        if (!scp->start())
+        {
+            std::cout << "  skipped: port " << TestPort << " is not available" << std::endl;
+            return;
+        }
+
+        DcmSCU scu;
+        CHECK(connect(scu, TestPort));
+        std::atomic<bool> stopped{ false };
+        std::thread stopping([&]()
+        {
+            scp->stop();
+            stopped = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        CHECK(!stopped);
+        scu.releaseAssociation();
+        stopping.join();
+
+        DICOMWorklistSCP::StatusInfo status;
+        CHECK(scp->getStatus(status) && !status.running_);
+        CHECK(status.activeAssociations_ == 0);
+        CHECK(findOverNetwork(findQuery("", "")) == std::vector<std::string>({ "<failed>" }));
+
+        CHECK(scp->setString(handle, PatientName, "DOE^B"));
+        CHECK(registry.saveAll());
+    }
+
+    struct Test
+    {
+        const char* name_;
+        void (*run_)();
+    };
+
+    const Test Tests[] =
+    {
+        { "delta-replay-after-crash", deltaReplayAfterCrash },
+        { "delta-replay-after-compaction-failure", deltaReplayAfterCompactionFailure },
+        { "retention-policies", retentionPolicies },
+        { "quarantine", quarantineOfCorruptFiles },
+        { "cfind-matching", cfindMatching },
+        { "index-sidecar", indexSidecar },
+        { "commit-batch", commitBatch },
+        { "stale-handles", staleHandles },
+        { "attribute-paths", attributePaths },
+        { "change-feed", changeFeed },
+        { "wait-for-status", waitForStatus },
+        { "settings-swap", settingsSwap },
+        { "template-copy-on-write", templateCopyOnWrite },
+        { "compact-round-trip", compactRoundTrip },
+        { "compact-pinned-dataset", compactPinnedDataset },
+        { "drain-before-save", drainBeforeSave },
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string selected = argc > 1 ? argv[1] : "";
+    bool found = false;
+    for (const Test& test : Tests)
+    {
+        if (!selected.empty() && selected != test.name_) continue;
+        found = true;
+
+        int before = failures;
+        std::cout << test.name_ << std::endl;
+        test.run_();
+        std::cout << (failures == before ? "  passed" : "  failed") << std::endl;
+    }
+
+    if (!found)
+    {
+        std::cout << "Unknown test: " << selected << std::endl;
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
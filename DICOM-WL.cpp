@@ -1,4 +1,3 @@
-#include <windows.h>
 #include <iostream>
 #include <string>
 
@@ -25,14 +24,14 @@ int main()
     DICOMWLSPClear(scp);
 
     std::cout << "Adding new dataset..." << std::endl;
-    int index = -1;
-    if (!DICOMWLSPAddDataset(scp, &index)) 
+    UINT64 handle = 0;
+    if (!DICOMWLSPAddDataset(scp, &handle)) 
     {
         std::cout << "Failed to add dataset." << std::endl;
     }
     else 
     {
-        std::cout << "Dataset added at index: " << index << std::endl;
+        std::cout << "Dataset added with handle: " << handle << std::endl;
     }
 
     std::cout << "Counting datasets..." << std::endl;
@@ -40,8 +39,8 @@ int main()
     DICOMWLSPCntDataset(scp, &count);
     std::cout << "Total datasets: " << count << std::endl;
 
-    std::cout << "Getting dataset by index..." << std::endl;
-    LPVOID ds = DICOMWLSPGetDataset(scp, index);
+    std::cout << "Getting dataset by handle..." << std::endl;
+    LPVOID ds = DICOMWLSPGetDataset(scp, handle);
     std::cout << "Dataset pointer: " << ds << std::endl;
 
     std::cout << "Starting SCP..." << std::endl;
@@ -57,18 +56,29 @@ int main()
         {
             std::cin >> eingabe;
         }).detach();
+
+    // Report status changes as they happen instead of polling: wakes on a state change,
+    // a new error or a new association, and re-checks the input at least every second
+    DICOMWLSPSTATUS status = {};
+    status.Size = sizeof(status);
+    DICOMWLSPGetStatusInfo(scp, &status);
     while (eingabe == "")
     {
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        DICOMWLSPStatus(scp, &statusText);
-        std::cout << "\nStatus:\n" << statusText << std::endl;
+        if (DICOMWLSPWaitForStatus(scp, &status, 1000, 3, status.TotalAssociations + 1))
+        {
+            DICOMWLSPStatus(scp, &statusText);
+            std::cout << "\nStatus:\n" << statusText << std::endl;
+        }
     }
 
     std::cout << "Marking dataset as dirty..." << std::endl;
-    DICOMWLSPMarkDirty(scp, index);
+    DICOMWLSPMarkDirty(scp, handle);
 
     std::cout << "Saving dirty dataset..." << std::endl;
-    DICOMWLSPFlushDataset(scp, index);
+    DICOMWLSPFlushDataset(scp, handle);
+
+    std::cout << "Releasing dataset..." << std::endl;
+    DICOMWLSPReleaseDataset(scp, handle);
 
     std::cout << "Saving all datasets..." << std::endl;
     DICOMWLSPFlushAll(scp);
@@ -77,7 +87,7 @@ int main()
     DICOMWLSPFlushDirty(scp);
 
     std::cout << "Deleting dataset..." << std::endl;
-    DICOMWLSPDelDataset(scp, index);
+    DICOMWLSPDelDataset(scp, handle);
 
     std::cout << "Stopping SCP..." << std::endl;
     DICOMWLSPStop(scp);
@@ -0,0 +1,558 @@
+// ===============================================================================================================
+// ============================================= File DICOM-WLD.cpp ==============================================
+// ===============================================================================================================
+
+// Headless worklist daemon serving one or more isolated worklists from a DICOMWorklistRegistry.
+//
+// Usage: DICOM-WLD [config file]   (default: dicom-wld.conf)
+//
+// The configuration file has a [daemon] section and one [worklist <name>] section per worklist.
+// Lines starting with '#' or ';' are comments.
+//
+//   [daemon]
+//   workers = 2                      threads of the shared worker pool (expiry)
+//   io_threads = 4                   threads of the shared I/O pool (bulk saves)
+//   cpu_affinity = 0-3               CPUs the pool and association threads are pinned to, e.g. "0,2,4-7"
+//   flush_interval = 60              seconds between saves of all dirty datasets (0 = only at shutdown)
+//   metrics_file = dicom-wld.prom    status counters in Prometheus text format, rewritten periodically
+//   metrics_interval = 15            seconds between metrics updates
+//
+//   [worklist site1]
+//   data_folder = /var/lib/dicom-wl/site1/
+//   file_prefix = dataset_
+//   persist_mode = delta             full | delta
+//   compact_items = yes              keep items as packed buffers instead of dataset trees: yes | no
+//   port = 104
+//   ae_title = WORKLIST_SCP
+//   max_pdu = 16384
+//   connection_timeout = 30          seconds; acse_timeout and dimse_timeout likewise
+//   max_matches = 0                  C-FIND responses per query (0 = unlimited)
+//   max_matches.MODALITY_AE = 500    limit for one calling AE title
+//   template = /etc/dicom-wl/template.dcm
+//   retention = purge                keep | purge | archive | hide
+//   retention_minutes = 1440
+//   archive_folder = /var/lib/dicom-wl/archive/
+//
+// SIGTERM and SIGINT stop all listeners, which close their ports once their open associations have finished (bounded by
+// the association timeouts), then save and exit.
+// SIGHUP reloads the configuration: worklists are added and removed; template, retention, item layout and the network
+// and query settings are applied in place without dropping associations (a new port is taken over by a new listener).
+// Worklists whose storage or CPU affinity changed are drained and reopened. Pool sizes and CPU affinity of the pools
+// take effect after a restart.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <ctime>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+#include "CDICOMWorklistSCP.h"
+
+namespace
+{
+    // Settings of one [worklist <name>] section
+    struct WorklistConfig
+    {
+        std::string name_;
+        DICOMWorklistSCP::Options options_;
+        DICOMWorklistSCP::Settings settings_;
+        std::string templateFile_;
+        DICOMWorklistSCP::RetentionPolicy retention_ = DICOMWorklistSCP::RetentionPolicy::Keep;
+        int retentionMinutes_ = 24 * 60;
+        std::string archiveFolder_;
+    };
+
+    // Settings of the whole configuration file
+    struct DaemonConfig
+    {
+        int workers_ = 2;
+        int ioThreads_ = 4;
+        std::vector<int> cpuAffinity_;
+        int flushInterval_ = 60;
+        std::string metricsFile_;
+        int metricsInterval_ = 15;
+        std::vector<WorklistConfig> worklists_;
+    };
+
+    // Writes a line with a local timestamp to stdout.
+    void log(const std::string& message)
+    {
+        auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+        std::cout << stamp << " " << message << std::endl;
+    }
+
+    // Removes leading and trailing white space.
+    std::string trim(const std::string& text)
+    {
+        size_t first = text.find_first_not_of(" \t\r\n");
+        if (first == std::string::npos) return "";
+        size_t last = text.find_last_not_of(" \t\r\n");
+        return text.substr(first, last - first + 1);
+    }
+
+    // Parses a non-negative integer that must fit into 'maximum'.
+    bool parseNumber(const std::string& text, int maximum, int& value)
+    {
+        if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != std::string::npos) return false;
+        value = std::stoi(text);
+        return value <= maximum;
+    }
+
+    // Parses a CPU list such as "0,2,4-7".
+    bool parseCpuList(const std::string& text, std::vector<int>& cpus)
+    {
+        cpus.clear();
+        std::stringstream entries(text);
+        std::string entry;
+        while (std::getline(entries, entry, ','))
+        {
+            entry = trim(entry);
+            size_t dash = entry.find('-');
+            int first = 0, last = 0;
+            if (dash == std::string::npos)
+            {
+                if (!parseNumber(entry, 4095, first)) return false;
+                last = first;
+            }
+            else if (!parseNumber(trim(entry.substr(0, dash)), 4095, first) || !parseNumber(trim(entry.substr(dash + 1)), 4095, last) || last < first)
+            {
+                return false;
+            }
+
+            for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+        return true;
+    }
+
+    // Applies one key of the [daemon] section.
+    bool setDaemonKey(DaemonConfig& config, const std::string& key, const std::string& value)
+    {
+        if (key == "workers") return parseNumber(value, 256, config.workers_) && config.workers_ > 0;
+        if (key == "io_threads") return parseNumber(value, 256, config.ioThreads_) && config.ioThreads_ > 0;
+        if (key == "cpu_affinity") return parseCpuList(value, config.cpuAffinity_);
+        if (key == "flush_interval") return parseNumber(value, 86400, config.flushInterval_);
+        if (key == "metrics_file") { config.metricsFile_ = value; return true; }
+        if (key == "metrics_interval") return parseNumber(value, 86400, config.metricsInterval_) && config.metricsInterval_ > 0;
+        return false;
+    }
+
+    // Applies one key of a [worklist <name>] section.
+    bool setWorklistKey(WorklistConfig& worklist, const std::string& key, const std::string& value)
+    {
+        using RetentionPolicy = DICOMWorklistSCP::RetentionPolicy;
+        DICOMWorklistSCP::Options& options = worklist.options_;
+        DICOMWorklistSCP::Settings& settings = worklist.settings_;
+        int number = 0;
+
+        if (key == "data_folder") { options.dataFolder_ = value; return !value.empty(); }
+        if (key == "file_prefix") { options.filePrefix_ = value; return !value.empty(); }
+        if (key == "ae_title") { options.aeTitle_ = settings.aeTitle_ = value; return !value.empty() && value.size() <= 16; }
+        if (key == "template") { worklist.templateFile_ = value; return true; }
+        if (key == "archive_folder") { worklist.archiveFolder_ = value; return true; }
+        if (key == "retention_minutes") return parseNumber(value, 100000000, worklist.retentionMinutes_) && worklist.retentionMinutes_ > 0;
+        if (key == "port")
+        {
+            if (!parseNumber(value, 65535, number) || number == 0) return false;
+            options.port_ = settings.port_ = static_cast<Uint16>(number);
+            return true;
+        }
+        if (key == "max_pdu")
+        {
+            if (!parseNumber(value, 131072, number) || number < 4096) return false;
+            settings.maxReceivePDULength_ = static_cast<Uint32>(number);
+            return true;
+        }
+        if (key == "connection_timeout" || key == "acse_timeout" || key == "dimse_timeout")
+        {
+            if (!parseNumber(value, 3600, number)) return false;
+            Uint32& timeout = key == "connection_timeout" ? settings.connectionTimeout_
+                : key == "acse_timeout" ? settings.acseTimeout_ : settings.dimseTimeout_;
+            timeout = static_cast<Uint32>(number);
+            return true;
+        }
+        if (key == "max_matches") return parseNumber(value, 1000000, settings.maxMatches_);
+        if (key.compare(0, 12, "max_matches.") == 0)
+        {
+            std::string aeTitle = key.substr(12);
+            if (aeTitle.empty() || aeTitle.size() > 16 || !parseNumber(value, 1000000, number)) return false;
+            settings.maxMatchesByAE_[aeTitle] = number;
+            return true;
+        }
+        if (key == "persist_mode")
+        {
+            if (value == "full") options.persistMode_ = DICOMWorklistSCP::PersistMode::Full;
+            else if (value == "delta") options.persistMode_ = DICOMWorklistSCP::PersistMode::Delta;
+            else return false;
+            return true;
+        }
+        if (key == "compact_items")
+        {
+            if (value == "yes") options.compactItems_ = true;
+            else if (value == "no") options.compactItems_ = false;
+            else return false;
+            return true;
+        }
+        if (key == "retention")
+        {
+            if (value == "keep") worklist.retention_ = RetentionPolicy::Keep;
+            else if (value == "purge") worklist.retention_ = RetentionPolicy::Purge;
+            else if (value == "archive") worklist.retention_ = RetentionPolicy::Archive;
+            else if (value == "hide") worklist.retention_ = RetentionPolicy::Hide;
+            else return false;
+            return true;
+        }
+        return false;
+    }
+
+    // Reads the configuration file. On failure, 'error' names the offending line.
+    bool loadConfig(const std::string& path, DaemonConfig& config, std::string& error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        config = DaemonConfig();
+        WorklistConfig* worklist = nullptr;
+        bool daemonSection = false;
+        std::string line;
+        for (int number = 1; std::getline(file, line); number++)
+        {
+            line = trim(line);
+            if (line.empty() || line[0] == '#' || line[0] == ';') continue;
+
+            if (line.front() == '[' && line.back() == ']')
+            {
+                std::string section = trim(line.substr(1, line.size() - 2));
+                daemonSection = section == "daemon";
+                worklist = nullptr;
+                if (!daemonSection)
+                {
+                    if (section.compare(0, 9, "worklist ") != 0 || trim(section.substr(9)).empty())
+                    {
+                        error = path + ":" + std::to_string(number) + ": unknown section " + section;
+                        return false;
+                    }
+                    config.worklists_.emplace_back();
+                    worklist = &config.worklists_.back();
+                    worklist->name_ = trim(section.substr(9));
+                    worklist->options_.cpuAffinity_ = config.cpuAffinity_;
+                }
+                continue;
+            }
+
+            size_t separator = line.find('=');
+            std::string key = separator == std::string::npos ? line : trim(line.substr(0, separator));
+            std::string value = separator == std::string::npos ? "" : trim(line.substr(separator + 1));
+            bool valid = separator != std::string::npos
+                && (daemonSection ? setDaemonKey(config, key, value) : worklist && setWorklistKey(*worklist, key, value));
+            if (!valid)
+            {
+                error = path + ":" + std::to_string(number) + ": invalid setting " + line;
+                return false;
+            }
+        }
+
+        std::map<std::string, int> names;
+        for (auto& entry : config.worklists_)
+        {
+            if (names[entry.name_]++)
+            {
+                error = "worklist " + entry.name_ + " is defined twice";
+                return false;
+            }
+            if (entry.retention_ == DICOMWorklistSCP::RetentionPolicy::Archive && entry.archiveFolder_.empty())
+            {
+                error = "worklist " + entry.name_ + " needs an archive_folder for retention = archive";
+                return false;
+            }
+            entry.options_.cpuAffinity_ = config.cpuAffinity_;
+        }
+        return true;
+    }
+
+    // Whether two option sets describe the same storage and threads, so an instance can stay open across a reload.
+    // Port, AE title and item layout are runtime settings and do not count.
+    bool sameInstance(const DICOMWorklistSCP::Options& a, const DICOMWorklistSCP::Options& b)
+    {
+        return a.dataFolder_ == b.dataFolder_ && a.filePrefix_ == b.filePrefix_ && a.persistMode_ == b.persistMode_
+            && a.cpuAffinity_ == b.cpuAffinity_;
+    }
+
+    // Applies the settings that can change on a running instance: network and query settings, template file, retention
+    // and item layout.
+    void applySettings(DICOMWorklistSCP& scp, const WorklistConfig& worklist)
+    {
+        if (!scp.setSettings(worklist.settings_))
+        {
+            log("[" + worklist.name_ + "] Cannot apply network settings, port " + std::to_string(worklist.settings_.port_)
+                + " may be in use; keeping port " + std::to_string(scp.getSettings()->port_));
+        }
+        if (!scp.setTemplateFile(worklist.templateFile_) && !worklist.templateFile_.empty())
+        {
+            log("[" + worklist.name_ + "] Cannot use template " + worklist.templateFile_);
+        }
+        if (!scp.setRetentionPolicy(worklist.retention_, worklist.retentionMinutes_, worklist.archiveFolder_))
+        {
+            log("[" + worklist.name_ + "] Cannot apply retention policy");
+        }
+        scp.setCompactItems(worklist.options_.compactItems_);
+    }
+
+    // Opens a worklist in the registry, applies its settings and starts listening.
+    bool openWorklist(DICOMWorklistRegistry& registry, const WorklistConfig& worklist)
+    {
+        DICOMWorklistSCP* scp = registry.open(worklist.name_, worklist.options_);
+        if (!scp)
+        {
+            log("[" + worklist.name_ + "] Cannot open: name, data folder or port already in use");
+            return false;
+        }
+
+        applySettings(*scp, worklist);
+        if (!scp->start())
+        {
+            log("[" + worklist.name_ + "] Cannot listen on port " + std::to_string(worklist.options_.port_));
+            return false;
+        }
+
+        DICOMWorklistSCP::StatusInfo status;
+        scp->getStatus(status);
+        log("[" + worklist.name_ + "] Listening on port " + std::to_string(worklist.options_.port_) + " as "
+            + worklist.options_.aeTitle_ + " with " + std::to_string(status.datasetCount_) + " items");
+        return true;
+    }
+
+    // Stops the instances together; each stop() returns once its open associations have finished and its port is closed.
+    void stopAll(const std::vector<DICOMWorklistSCP*>& instances)
+    {
+        std::vector<std::thread> stopping;
+        for (DICOMWorklistSCP* scp : instances)
+        {
+            stopping.emplace_back([scp]() { scp->stop(); });
+        }
+        for (auto& thread : stopping)
+        {
+            thread.join();
+        }
+    }
+
+    // Stops a worklist, which lets its open associations finish and releases its port, saves it and removes it
+    // from the registry.
+    void closeWorklist(DICOMWorklistRegistry& registry, const std::string& name)
+    {
+        DICOMWorklistSCP* scp = registry.find(name);
+        if (!scp) return;
+
+        scp->stop();
+        scp->saveDirtyDatasets();
+        registry.close(name);
+        log("[" + name + "] Closed");
+    }
+
+    // Writes the status counters of all worklists to the metrics file in Prometheus text format.
+    // The file is replaced atomically, so scrapers never read a partial update.
+    void writeMetrics(DICOMWorklistRegistry& registry, const DaemonConfig& config)
+    {
+        if (config.metricsFile_.empty()) return;
+
+        std::ostringstream ss;
+        ss << "# TYPE dicomwl_running gauge\n# TYPE dicomwl_requests_total counter\n"
+            << "# TYPE dicomwl_associations_active gauge\n# TYPE dicomwl_associations_total counter\n"
+            << "# TYPE dicomwl_errors_total counter\n# TYPE dicomwl_datasets gauge\n# TYPE dicomwl_generation counter\n";
+        for (const auto& worklist : config.worklists_)
+        {
+            DICOMWorklistSCP* scp = registry.find(worklist.name_);
+            DICOMWorklistSCP::StatusInfo status;
+            if (!scp || !scp->getStatus(status)) continue;
+
+            std::string label = "{worklist=\"" + worklist.name_ + "\"} ";
+            ss << "dicomwl_running" << label << (status.running_ ? 1 : 0) << "\n"
+                << "dicomwl_requests_total" << label << status.requestCount_ << "\n"
+                << "dicomwl_associations_active" << label << status.activeAssociations_ << "\n"
+                << "dicomwl_associations_total" << label << status.totalAssociations_ << "\n"
+                << "dicomwl_errors_total" << label << status.errorCount_ << "\n"
+                << "dicomwl_datasets" << label << status.datasetCount_ << "\n"
+                << "dicomwl_generation" << label << status.generation_ << "\n";
+        }
+
+        std::string temp = config.metricsFile_ + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::trunc);
+            file << ss.str();
+            if (!file) return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp, config.metricsFile_, ec);
+    }
+
+    // Re-reads the configuration file and brings the registry in line with it (see the file header).
+    // A file that fails to parse leaves everything unchanged.
+    void reload(const std::string& path, DaemonConfig& config, DICOMWorklistRegistry& registry)
+    {
+        DaemonConfig next;
+        std::string error;
+        if (!loadConfig(path, next, error))
+        {
+            log("Reload failed, keeping the current configuration: " + error);
+            return;
+        }
+
+        if (next.workers_ != config.workers_ || next.ioThreads_ != config.ioThreads_ || next.cpuAffinity_ != config.cpuAffinity_)
+        {
+            log("Pool sizes and CPU affinity take effect after a restart");
+        }
+
+        std::map<std::string, const WorklistConfig*> current;
+        for (const auto& worklist : config.worklists_) current[worklist.name_] = &worklist;
+
+        for (const auto& worklist : config.worklists_)
+        {
+            bool kept = false;
+            for (const auto& entry : next.worklists_) kept = kept || entry.name_ == worklist.name_;
+            if (!kept) closeWorklist(registry, worklist.name_);
+        }
+
+        for (const auto& worklist : next.worklists_)
+        {
+            auto it = current.find(worklist.name_);
+            DICOMWorklistSCP* scp = registry.find(worklist.name_);
+            if (it != current.end() && scp && sameInstance(it->second->options_, worklist.options_))
+            {
+                applySettings(*scp, worklist);
+                continue;
+            }
+
+            closeWorklist(registry, worklist.name_);
+            openWorklist(registry, worklist);
+        }
+
+        next.workers_ = config.workers_;
+        next.ioThreads_ = config.ioThreads_;
+        next.cpuAffinity_ = config.cpuAffinity_;
+        config = std::move(next);
+        log("Configuration reloaded");
+    }
+
+#ifdef _WIN32
+    std::atomic<int> pendingSignal{ 0 };
+
+    void onSignal(int signal)
+    {
+        pendingSignal = signal;
+    }
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    std::string configPath = argc > 1 ? argv[1] : "dicom-wld.conf";
+
+    // Signals are handled synchronously by the main thread; all threads started later inherit the blocked mask
+#ifdef _WIN32
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+#else
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+#endif
+
+    DaemonConfig config;
+    std::string error;
+    if (!loadConfig(configPath, config, error))
+    {
+        log("Invalid configuration: " + error);
+        return 1;
+    }
+    if (config.worklists_.empty())
+    {
+        log("No [worklist <name>] section in " + configPath);
+        return 1;
+    }
+
+    DICOMWorklistRegistry registry(config.workers_, config.ioThreads_, config.cpuAffinity_);
+    int opened = 0;
+    for (const auto& worklist : config.worklists_)
+    {
+        if (openWorklist(registry, worklist)) opened++;
+    }
+    if (opened == 0)
+    {
+        log("No worklist could be started");
+        return 1;
+    }
+
+    auto lastFlush = std::chrono::steady_clock::now();
+    auto lastMetrics = std::chrono::steady_clock::time_point();
+    while (true)
+    {
+        int signal = 0;
+#ifdef _WIN32
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        signal = pendingSignal.exchange(0);
+#else
+        timespec timeout = { 1, 0 };
+        signal = sigtimedwait(&signals, nullptr, &timeout);
+        if (signal < 0) signal = 0;
+#endif
+
+        if (signal == SIGTERM || signal == SIGINT)
+        {
+            break;
+        }
+#ifndef _WIN32
+        if (signal == SIGHUP)
+        {
+            reload(configPath, config, registry);
+            lastMetrics = std::chrono::steady_clock::time_point();
+        }
+#endif
+
+        auto now = std::chrono::steady_clock::now();
+        if (config.flushInterval_ > 0 && now - lastFlush >= std::chrono::seconds(config.flushInterval_))
+        {
+            if (!registry.saveAll()) log("Saving dirty datasets failed for at least one worklist");
+            lastFlush = now;
+        }
+        if (now - lastMetrics >= std::chrono::seconds(config.metricsInterval_))
+        {
+            writeMetrics(registry, config);
+            lastMetrics = now;
+        }
+    }
+
+    log("Shutting down: draining open associations");
+    std::vector<DICOMWorklistSCP*> instances;
+    for (const auto& worklist : config.worklists_)
+    {
+        DICOMWorklistSCP* scp = registry.find(worklist.name_);
+        if (scp) instances.push_back(scp);
+    }
+    stopAll(instances);
+
+    bool saved = registry.saveAll();
+    writeMetrics(registry, config);
+    log(saved ? "Shutdown complete" : "Shutdown complete, but saving failed for at least one worklist");
+    return saved ? 0 : 1;
+}
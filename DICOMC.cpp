@@ -1,5 +1,5 @@
-#include <windows.h>
 #include "stdio.h"
+#include "string.h"
 #define _EXPORTS_DICOM_
 #include "DICOMC.h"
 #include "CDICOMWorklistSCP.h"
@@ -13,6 +13,85 @@ LPVOID _DICOMC_API_ DICOMWLSPCreate()
     return new DICOMWorklistSCP();
 }
 
+// 
+// DICOMWLSPCreateEx
+// 
+static BOOL DICOMWLSPCopyOptions(const DICOMWLSPOPTIONS* a_Options, DICOMWorklistSCP::Options& options)
+{
+    if (!a_Options || a_Options->Size < sizeof(DICOMWLSPOPTIONS)) return FALSE;
+    if (a_Options->PersistMode < 0 || a_Options->PersistMode > 1 || a_Options->Port < 0 || a_Options->Port > 65535) return FALSE;
+    if (a_Options->DataFolder) options.dataFolder_ = a_Options->DataFolder;
+    if (a_Options->FilePrefix) options.filePrefix_ = a_Options->FilePrefix;
+    options.persistMode_ = static_cast<DICOMWorklistSCP::PersistMode>(a_Options->PersistMode);
+    if (a_Options->Port) options.port_ = static_cast<Uint16>(a_Options->Port);
+    if (a_Options->AETitle) options.aeTitle_ = a_Options->AETitle;
+    return TRUE;
+}
+
+LPVOID _DICOMC_API_ DICOMWLSPCreateEx(const DICOMWLSPOPTIONS* a_Options)
+{
+    DICOMWorklistSCP::Options options;
+    if (!DICOMWLSPCopyOptions(a_Options, options)) return NULL;
+    return new DICOMWorklistSCP(options);
+}
+
+// 
+// DICOMWLSPRegistryCreate
+// 
+LPVOID _DICOMC_API_ DICOMWLSPRegistryCreate(INT a_WorkerThreads, INT a_IoThreads)
+{
+    return new DICOMWorklistRegistry(a_WorkerThreads, a_IoThreads);
+}
+
+// 
+// DICOMWLSPRegistryDestroy
+// 
+BOOL _DICOMC_API_ DICOMWLSPRegistryDestroy(LPVOID a_Registry)
+{
+    delete static_cast<DICOMWorklistRegistry*>(a_Registry);
+    return TRUE;
+}
+
+// 
+// DICOMWLSPRegistryOpen
+// 
+LPVOID _DICOMC_API_ DICOMWLSPRegistryOpen(LPVOID a_Registry, LPCSTR a_Name, const DICOMWLSPOPTIONS* a_Options)
+{
+    auto registry = static_cast<DICOMWorklistRegistry*>(a_Registry);
+    DICOMWorklistSCP::Options options;
+    if (!a_Name || !DICOMWLSPCopyOptions(a_Options, options)) return NULL;
+    return registry->open(a_Name, options);
+}
+
+// 
+// DICOMWLSPRegistryFind
+// 
+LPVOID _DICOMC_API_ DICOMWLSPRegistryFind(LPVOID a_Registry, LPCSTR a_Name)
+{
+    auto registry = static_cast<const DICOMWorklistRegistry*>(a_Registry);
+    if (!a_Name) return NULL;
+    return registry->find(a_Name);
+}
+
+// 
+// DICOMWLSPRegistryClose
+// 
+BOOL _DICOMC_API_ DICOMWLSPRegistryClose(LPVOID a_Registry, LPCSTR a_Name)
+{
+    auto registry = static_cast<DICOMWorklistRegistry*>(a_Registry);
+    if (!a_Name) return FALSE;
+    return registry->close(a_Name);
+}
+
+// 
+// DICOMWLSPRegistrySaveAll
+// 
+BOOL _DICOMC_API_ DICOMWLSPRegistrySaveAll(LPVOID a_Registry)
+{
+    auto registry = static_cast<DICOMWorklistRegistry*>(a_Registry);
+    return registry->saveAll();
+}
+
 // 
 // DICOMWLSPSetTemplateFile
 // 
@@ -22,6 +101,66 @@ BOOL _DICOMC_API_ DICOMWLSPSetTemplateFile(LPVOID a_Obj, LPCSTR a_FileName)
     return obj->setTemplateFile(a_FileName);
 }
 
+// 
+// DICOMWLSPGetSettings
+// 
+BOOL _DICOMC_API_ DICOMWLSPGetSettings(PVOID a_Obj, PDICOMWLSPSETTINGS a_Settings)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    if (!a_Settings || a_Settings->Size < sizeof(DICOMWLSPSETTINGS)) return FALSE;
+    auto settings = obj->getSettings();
+    a_Settings->Port = settings->port_;
+    snprintf(a_Settings->AETitle, sizeof(a_Settings->AETitle), "%s", settings->aeTitle_.c_str());
+    a_Settings->MaxPDULength = static_cast<INT>(settings->maxReceivePDULength_);
+    a_Settings->ConnectionTimeout = static_cast<INT>(settings->connectionTimeout_);
+    a_Settings->AcseTimeout = static_cast<INT>(settings->acseTimeout_);
+    a_Settings->DimseTimeout = static_cast<INT>(settings->dimseTimeout_);
+    a_Settings->MaxMatches = settings->maxMatches_;
+    return TRUE;
+}
+
+// 
+// DICOMWLSPSetSettings
+// 
+BOOL _DICOMC_API_ DICOMWLSPSetSettings(PVOID a_Obj, const DICOMWLSPSETTINGS* a_Settings)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    if (!a_Settings || a_Settings->Size < sizeof(DICOMWLSPSETTINGS)) return FALSE;
+    if (a_Settings->Port <= 0 || a_Settings->Port > 65535 || a_Settings->MaxPDULength <= 0) return FALSE;
+    if (a_Settings->ConnectionTimeout < 0 || a_Settings->AcseTimeout < 0 || a_Settings->DimseTimeout < 0) return FALSE;
+
+    return obj->updateSettings([a_Settings](DICOMWorklistSCP::Settings& settings)
+    {
+        settings.port_ = static_cast<Uint16>(a_Settings->Port);
+        settings.aeTitle_.assign(a_Settings->AETitle, strnlen(a_Settings->AETitle, sizeof(a_Settings->AETitle)));
+        settings.maxReceivePDULength_ = static_cast<Uint32>(a_Settings->MaxPDULength);
+        settings.connectionTimeout_ = static_cast<Uint32>(a_Settings->ConnectionTimeout);
+        settings.acseTimeout_ = static_cast<Uint32>(a_Settings->AcseTimeout);
+        settings.dimseTimeout_ = static_cast<Uint32>(a_Settings->DimseTimeout);
+        settings.maxMatches_ = a_Settings->MaxMatches;
+    });
+}
+
+// 
+// DICOMWLSPSetAEMaxMatches
+// 
+BOOL _DICOMC_API_ DICOMWLSPSetAEMaxMatches(PVOID a_Obj, LPCSTR a_AETitle, INT a_MaxMatches)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    if (!a_AETitle) return FALSE;
+    return obj->updateSettings([a_AETitle, a_MaxMatches](DICOMWorklistSCP::Settings& settings)
+    {
+        if (a_MaxMatches < 0)
+        {
+            settings.maxMatchesByAE_.erase(a_AETitle);
+        }
+        else
+        {
+            settings.maxMatchesByAE_[a_AETitle] = a_MaxMatches;
+        }
+    });
+}
+
 // 
 // DICOMWLSPClear
 // 
@@ -34,19 +173,38 @@ BOOL _DICOMC_API_ DICOMWLSPClear(PVOID a_Obj)
 // 
 // DICOMWLSPAddDataset
 // 
-BOOL _DICOMC_API_ DICOMWLSPAddDataset(PVOID a_Obj, PINT a_INDEX)
+BOOL _DICOMC_API_ DICOMWLSPAddDataset(PVOID a_Obj, PUINT64 a_HANDLE)
 {
     auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
-    return obj->addDataset(a_INDEX);
+    DICOMWorklistSCP::Handle handle = 0;
+    if (!a_HANDLE || !obj->addDataset(&handle)) return FALSE;
+    *a_HANDLE = handle;
+    return TRUE;
+}
+
+// 
+// DICOMWLSPAddDatasets
+// 
+BOOL _DICOMC_API_ DICOMWLSPAddDatasets(PVOID a_Obj, INT a_Count, PUINT64 a_Handles)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    if (!a_Handles || a_Count <= 0) return FALSE;
+    std::vector<DICOMWorklistSCP::Handle> handles(a_Count);
+    if (!obj->addDatasets(a_Count, handles.data())) return FALSE;
+    for (INT i = 0; i < a_Count; i++)
+    {
+        a_Handles[i] = handles[i];
+    }
+    return TRUE;
 }
 
 // 
 // DICOMWLSPDelDataset
 // 
-BOOL _DICOMC_API_ DICOMWLSPDelDataset(PVOID a_Obj, INT a_INDEX)
+BOOL _DICOMC_API_ DICOMWLSPDelDataset(PVOID a_Obj, UINT64 a_HANDLE)
 {
     auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
-    return obj->deleteDataset(a_INDEX);
+    return obj->deleteDataset(a_HANDLE);
 }
 
 // 
@@ -61,11 +219,388 @@ BOOL _DICOMC_API_ DICOMWLSPCntDataset(PVOID a_Obj, PINT a_Count)
 // 
 // DICOMWLSPGetDataset
 // 
-LPVOID _DICOMC_API_ DICOMWLSPGetDataset(LPVOID a_Obj, INT a_Index)
+LPVOID _DICOMC_API_ DICOMWLSPGetDataset(LPVOID a_Obj, UINT64 a_Handle)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->pinDataset(a_Handle);
+}
+
+// 
+// DICOMWLSPReleaseDataset
+// 
+BOOL _DICOMC_API_ DICOMWLSPReleaseDataset(PVOID a_Obj, UINT64 a_HANDLE)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->releaseDataset(a_HANDLE);
+}
+
+// 
+// DICOMWLSPBeginEdit
+// 
+LPVOID _DICOMC_API_ DICOMWLSPBeginEdit(PVOID a_Obj, UINT64 a_HANDLE)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->beginEdit(a_HANDLE).release();
+}
+
+// 
+// DICOMWLSPEditDataset
+// 
+LPVOID _DICOMC_API_ DICOMWLSPEditDataset(LPVOID a_Session)
+{
+    auto session = static_cast<DICOMWorklistSCP::EditSession*>(a_Session);
+    return session ? &session->dataset_ : nullptr;
+}
+
+// 
+// DICOMWLSPCommitEdit
+// 
+BOOL _DICOMC_API_ DICOMWLSPCommitEdit(PVOID a_Obj, LPVOID a_Session)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    auto session = static_cast<DICOMWorklistSCP::EditSession*>(a_Session);
+    return obj->commitEdit(std::unique_ptr<DICOMWorklistSCP::EditSession>(session));
+}
+
+// 
+// DICOMWLSPCancelEdit
+// 
+BOOL _DICOMC_API_ DICOMWLSPCancelEdit(PVOID a_Obj, LPVOID a_Session)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    auto session = static_cast<DICOMWorklistSCP::EditSession*>(a_Session);
+    obj->cancelEdit(std::unique_ptr<DICOMWorklistSCP::EditSession>(session));
+    return TRUE;
+}
+
+// 
+// DICOMWLSPGetGeneration
+// 
+BOOL _DICOMC_API_ DICOMWLSPGetGeneration(PVOID a_Obj, PUINT64 a_Generation)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    Uint64 generation = 0;
+    if (!a_Generation || !obj->getGeneration(&generation)) return FALSE;
+    *a_Generation = generation;
+    return TRUE;
+}
+
+// 
+// DICOMWLSPGetChanges
+// 
+BOOL _DICOMC_API_ DICOMWLSPGetChanges(PVOID a_Obj, UINT64 a_Since, PDICOMWLSPCHANGE a_Changes, INT a_Capacity, PINT a_Count, PUINT64 a_Generation, PBOOL a_Resync)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    if (!a_Changes || a_Capacity <= 0 || !a_Count || !a_Generation || !a_Resync) return FALSE;
+    std::vector<DICOMWorklistSCP::ChangeEvent> events(a_Capacity);
+    int count = 0;
+    Uint64 generation = 0;
+    bool resync = false;
+    if (!obj->getChanges(a_Since, events.data(), a_Capacity, &count, &generation, &resync)) return FALSE;
+    for (int i = 0; i < count; i++)
+    {
+        a_Changes[i].Generation = events[i].generation_;
+        a_Changes[i].Handle = events[i].handle_;
+        a_Changes[i].Kind = static_cast<INT>(events[i].kind_);
+    }
+    *a_Count = count;
+    *a_Generation = generation;
+    *a_Resync = resync ? TRUE : FALSE;
+    return TRUE;
+}
+
+// 
+// DICOMWLSPWaitForChanges
+// 
+BOOL _DICOMC_API_ DICOMWLSPWaitForChanges(PVOID a_Obj, UINT64 a_Since, INT a_TimeoutMs, PUINT64 a_Generation)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    Uint64 generation = 0;
+    BOOL result = obj->waitForChanges(a_Since, a_TimeoutMs, &generation);
+    if (a_Generation) *a_Generation = generation;
+    return result;
+}
+
+// 
+// DICOMWLSPBeginBatch
+// 
+LPVOID _DICOMC_API_ DICOMWLSPBeginBatch(PVOID a_Obj)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->beginBatch().release();
+}
+
+// 
+// DICOMWLSPBatchAdd
+// 
+BOOL _DICOMC_API_ DICOMWLSPBatchAdd(PVOID a_Obj, LPVOID a_Batch, INT a_Count)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    auto batch = static_cast<DICOMWorklistSCP::Batch*>(a_Batch);
+    return batch && obj->batchAddDatasets(*batch, a_Count);
+}
+
+// 
+// DICOMWLSPBatchDelete
+// 
+BOOL _DICOMC_API_ DICOMWLSPBatchDelete(PVOID a_Obj, LPVOID a_Batch, UINT64 a_HANDLE)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    auto batch = static_cast<DICOMWorklistSCP::Batch*>(a_Batch);
+    return batch && obj->batchDeleteDataset(*batch, a_HANDLE);
+}
+
+// 
+// DICOMWLSPBatchEdit
+// 
+LPVOID _DICOMC_API_ DICOMWLSPBatchEdit(PVOID a_Obj, LPVOID a_Batch, UINT64 a_HANDLE)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    auto batch = static_cast<DICOMWorklistSCP::Batch*>(a_Batch);
+    if (!batch) return nullptr;
+    auto session = obj->batchEditDataset(*batch, a_HANDLE);
+    return session ? &session->dataset_ : nullptr;
+}
+
+// 
+// DICOMWLSPCommitBatch
+// 
+BOOL _DICOMC_API_ DICOMWLSPCommitBatch(PVOID a_Obj, LPVOID a_Batch, PUINT64 a_Handles)
+{
+    return DICOMWLSPCommitBatchEx(a_Obj, a_Batch, a_Handles) == 0;
+}
+
+// 
+// DICOMWLSPCommitBatchEx
+// 
+INT _DICOMC_API_ DICOMWLSPCommitBatchEx(PVOID a_Obj, LPVOID a_Batch, PUINT64 a_Handles)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    auto batch = static_cast<DICOMWorklistSCP::Batch*>(a_Batch);
+    std::vector<DICOMWorklistSCP::Handle> added;
+    auto result = obj->commitBatch(std::unique_ptr<DICOMWorklistSCP::Batch>(batch), &added);
+    for (size_t i = 0; a_Handles && i < added.size(); i++)
+    {
+        a_Handles[i] = added[i];
+    }
+    return static_cast<INT>(result);
+}
+
+// 
+// DICOMWLSPRollbackBatch
+// 
+BOOL _DICOMC_API_ DICOMWLSPRollbackBatch(PVOID a_Obj, LPVOID a_Batch)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    auto batch = static_cast<DICOMWorklistSCP::Batch*>(a_Batch);
+    obj->rollbackBatch(std::unique_ptr<DICOMWorklistSCP::Batch>(batch));
+    return TRUE;
+}
+
+// 
+// DICOMWLSPGetString
+// 
+BOOL _DICOMC_API_ DICOMWLSPGetString(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, LPSTR a_Buffer, INT a_Size, PINT a_Length)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    if (a_Size < 0) return FALSE;
+    size_t length = 0;
+    BOOL result = obj->getString(a_HANDLE, a_Path, a_Buffer, static_cast<size_t>(a_Size), &length);
+    if (a_Length) *a_Length = static_cast<INT>(length);
+    return result;
+}
+
+// 
+// DICOMWLSPSetString
+// 
+BOOL _DICOMC_API_ DICOMWLSPSetString(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, LPCSTR a_Value)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->setString(a_HANDLE, a_Path, a_Value);
+}
+
+// 
+// DICOMWLSPGetInt
+// 
+BOOL _DICOMC_API_ DICOMWLSPGetInt(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, PINT a_Value)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    Sint32 value = 0;
+    if (!a_Value || !obj->getInt(a_HANDLE, a_Path, &value)) return FALSE;
+    *a_Value = value;
+    return TRUE;
+}
+
+// 
+// DICOMWLSPSetInt
+// 
+BOOL _DICOMC_API_ DICOMWLSPSetInt(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, INT a_Value)
 {
     auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
-    auto dataset = obj->getDataset(a_Index);
-    return dataset.get();
+    return obj->setInt(a_HANDLE, a_Path, a_Value);
+}
+
+// 
+// DICOMWLSPGetDate
+// 
+BOOL _DICOMC_API_ DICOMWLSPGetDate(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, PINT a_Year, PINT a_Month, PINT a_Day)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    return obj->getDate(a_HANDLE, a_Path, a_Year, a_Month, a_Day);
+}
+
+// 
+// DICOMWLSPSetDate
+// 
+BOOL _DICOMC_API_ DICOMWLSPSetDate(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, INT a_Year, INT a_Month, INT a_Day)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->setDate(a_HANDLE, a_Path, a_Year, a_Month, a_Day);
+}
+
+// 
+// DICOMWLSPGetItemCount
+// 
+BOOL _DICOMC_API_ DICOMWLSPGetItemCount(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, PINT a_Count)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    return obj->getItemCount(a_HANDLE, a_Path, a_Count);
+}
+
+// 
+// DICOMWLSPAddItem
+// 
+BOOL _DICOMC_API_ DICOMWLSPAddItem(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, PINT a_Index)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->addItem(a_HANDLE, a_Path, a_Index);
+}
+
+// 
+// DICOMWLSPDelItem
+// 
+BOOL _DICOMC_API_ DICOMWLSPDelItem(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, INT a_Index)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->deleteItem(a_HANDLE, a_Path, a_Index);
+}
+
+// 
+// DICOMWLSPEnumDatasets
+// 
+BOOL _DICOMC_API_ DICOMWLSPEnumDatasets(PVOID a_Obj, const LPCSTR* a_Paths, INT a_PathCount, DICOMWLSPENUMPROC a_Proc, LPVOID a_Context, PINT a_Count)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    if (!a_Proc) return FALSE;
+    int visited = 0;
+    BOOL result = obj->enumerateDatasets(a_Paths, a_PathCount, [&](DICOMWorklistSCP::Handle handle, const char* const* values)
+    {
+        return a_Proc(handle, a_PathCount, values, a_Context) != FALSE;
+    }, &visited);
+    if (a_Count) *a_Count = visited;
+    return result;
+}
+
+// 
+// DICOMWLSPListDatasets
+// 
+BOOL _DICOMC_API_ DICOMWLSPListDatasets(PVOID a_Obj, PUINT64 a_Handles, INT a_Capacity, PINT a_Count, const LPCSTR* a_Paths, INT a_PathCount, LPSTR a_Values, INT a_ValueWidth, PUINT64 a_Generation)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    if (a_Capacity < 0 || a_ValueWidth < 0 || (a_Capacity > 0 && !a_Handles)) return FALSE;
+    std::vector<DICOMWorklistSCP::Handle> handles(a_Capacity);
+    int count = 0;
+    Uint64 generation = 0;
+    if (!obj->listDatasets(handles.data(), a_Capacity, &count, a_Paths, a_PathCount, a_Values, static_cast<size_t>(a_ValueWidth), &generation)) return FALSE;
+    for (INT i = 0; i < a_Capacity && i < count; i++)
+    {
+        a_Handles[i] = handles[i];
+    }
+    if (a_Count) *a_Count = count;
+    if (a_Generation) *a_Generation = generation;
+    return TRUE;
+}
+
+// 
+// DICOMWLSPFind
+// 
+BOOL _DICOMC_API_ DICOMWLSPFind(PVOID a_Obj, LPVOID a_Query, const LPCSTR* a_Paths, INT a_PathCount, DICOMWLSPENUMPROC a_Proc, LPVOID a_Context, PINT a_Count)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    auto query = static_cast<DcmDataset*>(a_Query);
+    if (!query || !a_Proc) return FALSE;
+    int matches = 0;
+    BOOL result = obj->findDatasets(*query, a_Paths, a_PathCount, [&](DICOMWorklistSCP::Handle handle, const char* const* values)
+    {
+        return a_Proc(handle, a_PathCount, values, a_Context) != FALSE;
+    }, &matches);
+    if (a_Count) *a_Count = matches;
+    return result;
+}
+
+// 
+// DICOMWLSPFindByKeys
+// 
+BOOL _DICOMC_API_ DICOMWLSPFindByKeys(PVOID a_Obj, const LPCSTR* a_Keys, const LPCSTR* a_Values, INT a_KeyCount, const LPCSTR* a_Paths, INT a_PathCount, DICOMWLSPENUMPROC a_Proc, LPVOID a_Context, PINT a_Count)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    if (!a_Proc) return FALSE;
+    int matches = 0;
+    BOOL result = obj->findDatasets(a_Keys, a_Values, a_KeyCount, a_Paths, a_PathCount, [&](DICOMWorklistSCP::Handle handle, const char* const* values)
+    {
+        return a_Proc(handle, a_PathCount, values, a_Context) != FALSE;
+    }, &matches);
+    if (a_Count) *a_Count = matches;
+    return result;
+}
+
+// 
+// DICOMWLSPBeginRead
+// 
+LPVOID _DICOMC_API_ DICOMWLSPBeginRead(PVOID a_Obj)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    return obj->beginRead().release();
+}
+
+// 
+// DICOMWLSPReadCount
+// 
+INT _DICOMC_API_ DICOMWLSPReadCount(LPVOID a_Guard)
+{
+    auto guard = static_cast<const DICOMWorklistSCP::ReadGuard*>(a_Guard);
+    return guard ? guard->count() : 0;
+}
+
+// 
+// DICOMWLSPReadHandle
+// 
+UINT64 _DICOMC_API_ DICOMWLSPReadHandle(LPVOID a_Guard, INT a_Index)
+{
+    auto guard = static_cast<const DICOMWorklistSCP::ReadGuard*>(a_Guard);
+    return guard ? guard->handle(a_Index) : 0;
+}
+
+// 
+// DICOMWLSPReadValue
+// 
+LPCSTR _DICOMC_API_ DICOMWLSPReadValue(LPVOID a_Guard, INT a_Index, LPCSTR a_Path, PINT a_Length)
+{
+    auto guard = static_cast<const DICOMWorklistSCP::ReadGuard*>(a_Guard);
+    if (!guard) return NULL;
+    size_t length = 0;
+    const char* value = guard->value(a_Index, a_Path, &length);
+    if (a_Length) *a_Length = value ? static_cast<INT>(length) : 0;
+    return value;
+}
+
+// 
+// DICOMWLSPEndRead
+// 
+BOOL _DICOMC_API_ DICOMWLSPEndRead(LPVOID a_Guard)
+{
+    delete static_cast<DICOMWorklistSCP::ReadGuard*>(a_Guard);
+    return TRUE;
 }
 
 // 
@@ -96,22 +631,69 @@ BOOL _DICOMC_API_ DICOMWLSPStatus(PVOID a_Obj, LPVOID a_Status)
     return obj->getStatus(*statusStr);
 }
 
+// 
+// DICOMWLSPGetStatusInfo
+// 
+static void DICOMWLSPCopyStatus(const DICOMWorklistSCP::StatusInfo& info, PDICOMWLSPSTATUS a_Status)
+{
+    a_Status->Running = info.running_ ? TRUE : FALSE;
+    a_Status->Requests = info.requestCount_;
+    a_Status->ActiveAssociations = info.activeAssociations_;
+    a_Status->TotalAssociations = info.totalAssociations_;
+    a_Status->Errors = info.errorCount_;
+    a_Status->LastError = static_cast<INT>(info.lastError_);
+    a_Status->Datasets = info.datasetCount_;
+    a_Status->Generation = info.generation_;
+    a_Status->LoadDone = info.loadDone_;
+    a_Status->LoadTotal = info.loadTotal_;
+    a_Status->FlushDone = info.flushDone_;
+    a_Status->FlushTotal = info.flushTotal_;
+    a_Status->State = info.state_;
+}
+
+BOOL _DICOMC_API_ DICOMWLSPGetStatusInfo(PVOID a_Obj, PDICOMWLSPSTATUS a_Status)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    if (!a_Status || a_Status->Size < sizeof(DICOMWLSPSTATUS)) return FALSE;
+    DICOMWorklistSCP::StatusInfo info;
+    if (!obj->getStatus(info)) return FALSE;
+    DICOMWLSPCopyStatus(info, a_Status);
+    return TRUE;
+}
+
+// 
+// DICOMWLSPWaitForStatus
+// 
+BOOL _DICOMC_API_ DICOMWLSPWaitForStatus(PVOID a_Obj, PDICOMWLSPSTATUS a_Status, INT a_TimeoutMs, INT a_Counter, UINT64 a_Threshold)
+{
+    auto obj = static_cast<const DICOMWorklistSCP*>(a_Obj);
+    if (!a_Status || a_Status->Size < sizeof(DICOMWLSPSTATUS)) return FALSE;
+    if (a_Counter < 0 || a_Counter > static_cast<INT>(DICOMWorklistSCP::StatusCounter::Generation)) return FALSE;
+    DICOMWorklistSCP::StatusInfo info = {};
+    info.running_ = a_Status->Running != FALSE;
+    info.state_ = a_Status->State;
+    info.errorCount_ = a_Status->Errors;
+    BOOL result = obj->waitForStatus(info, a_TimeoutMs, static_cast<DICOMWorklistSCP::StatusCounter>(a_Counter), a_Threshold);
+    DICOMWLSPCopyStatus(info, a_Status);
+    return result;
+}
+
 // 
 // DICOMWLSPMarkDirty
 // 
-BOOL _DICOMC_API_ DICOMWLSPMarkDirty(PVOID a_Obj, INT a_INDEX)
+BOOL _DICOMC_API_ DICOMWLSPMarkDirty(PVOID a_Obj, UINT64 a_HANDLE)
 {
     auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
-    return obj->markDatasetDirty(a_INDEX);
+    return obj->markDatasetDirty(a_HANDLE);
 }
 
 // 
 // DICOMWLSPFlushDataset
 // 
-BOOL _DICOMC_API_ DICOMWLSPFlushDataset(PVOID a_Obj, INT a_INDEX)
+BOOL _DICOMC_API_ DICOMWLSPFlushDataset(PVOID a_Obj, UINT64 a_HANDLE)
 {
     auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
-    return obj->saveDataset(a_INDEX);
+    return obj->saveDataset(a_HANDLE);
 }
 
 // 
@@ -130,4 +712,50 @@ BOOL _DICOMC_API_ DICOMWLSPFlushDirty(PVOID a_Obj)
 {
     auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
     return obj->saveDirtyDatasets();
+}
+
+// 
+// DICOMWLSPSetDeltaPersistence
+// 
+BOOL _DICOMC_API_ DICOMWLSPSetDeltaPersistence(PVOID a_Obj, BOOL a_Enable)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->setPersistMode(a_Enable ? DICOMWorklistSCP::PersistMode::Delta : DICOMWorklistSCP::PersistMode::Full);
+}
+
+// 
+// DICOMWLSPCompact
+// 
+BOOL _DICOMC_API_ DICOMWLSPCompact(PVOID a_Obj)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->compactDatasets();
+}
+
+// 
+// DICOMWLSPSetCompactItems
+// 
+BOOL _DICOMC_API_ DICOMWLSPSetCompactItems(PVOID a_Obj, BOOL a_Enable)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->setCompactItems(a_Enable != FALSE);
+}
+
+// 
+// DICOMWLSPSetRetention
+// 
+BOOL _DICOMC_API_ DICOMWLSPSetRetention(PVOID a_Obj, INT a_Policy, INT a_Minutes, LPCSTR a_ArchiveFolder)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    if (a_Policy < 0 || a_Policy > static_cast<INT>(DICOMWorklistSCP::RetentionPolicy::Hide)) return FALSE;
+    return obj->setRetentionPolicy(static_cast<DICOMWorklistSCP::RetentionPolicy>(a_Policy), a_Minutes, a_ArchiveFolder ? a_ArchiveFolder : "");
+}
+
+// 
+// DICOMWLSPExpire
+// 
+BOOL _DICOMC_API_ DICOMWLSPExpire(PVOID a_Obj, PINT a_Count)
+{
+    auto obj = static_cast<DICOMWorklistSCP*>(a_Obj);
+    return obj->expireDatasets(a_Count);
 }
\ No newline at end of file
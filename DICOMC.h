@@ -1,34 +1,188 @@
 #ifndef _DICOMC_
 #define _DICOMC_
 
+// Windows builds take the types from windows.h and export through __declspec.
+// Other platforms get the same type names as portable typedefs, and the library is built with hidden
+// visibility, so only the functions marked _DICOMC_API_ are exported from the shared object.
+#ifdef _WIN32
+#include <windows.h>
+
 #ifdef _EXPORTS_DICOM_
 #define _DICOMC_API_ __declspec(dllexport)
 #else
 #define _DICOMC_API_ __declspec(dllimport)
 #endif
+#else
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int BOOL;
+typedef int INT;
+typedef unsigned int UINT;
+typedef uint64_t UINT64;
+typedef BOOL* PBOOL;
+typedef INT* PINT;
+typedef UINT64* PUINT64;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef char* LPSTR;
+typedef const char* LPCSTR;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+#define CALLBACK
+
+#if defined(_EXPORTS_DICOM_) && (defined(__GNUC__) || defined(__clang__))
+#define _DICOMC_API_ __attribute__((visibility("default")))
+#else
+#define _DICOMC_API_
+#endif
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+	// Callback of DICOMWLSPEnumDatasets: a_Values holds a_ValueCount attribute values of the item ("" if missing), valid during the call.
+	// Return FALSE to stop the enumeration. Runs under the list lock; must not call back into the DLL.
+	typedef BOOL (CALLBACK* DICOMWLSPENUMPROC)(UINT64 a_HANDLE, INT a_ValueCount, const LPCSTR* a_Values, LPVOID a_Context);
+
+	// Change event of DICOMWLSPGetChanges. Kind: 0 added, 1 removed, 2 modified, 3 flushed, 4 cleared (Handle = 0)
+	typedef struct _DICOMWLSPCHANGE
+	{
+		UINT64 Generation;
+		UINT64 Handle;
+		INT Kind;
+	} DICOMWLSPCHANGE, *PDICOMWLSPCHANGE;
+
+	// Status of DICOMWLSPGetStatusInfo. The caller sets Size to sizeof(DICOMWLSPSTATUS) before the call.
+	// LastError: 0 none, 1 load, 2 quarantine, 3 rename, 4 remove, 5 save, 6 delta log, 7 archive, 8 configuration
+	typedef struct _DICOMWLSPSTATUS
+	{
+		UINT Size;
+		BOOL Running;
+		UINT64 Requests;
+		INT ActiveAssociations;
+		UINT64 TotalAssociations;
+		UINT64 Errors;
+		INT LastError;
+		INT Datasets;
+		UINT64 Generation;
+		INT LoadDone;
+		INT LoadTotal;
+		INT FlushDone;
+		INT FlushTotal;
+		LPCSTR State;		// "Idle", "Listening"; static string, valid for the lifetime of the DLL
+	} DICOMWLSPSTATUS, *PDICOMWLSPSTATUS;
 	
+	// Options of DICOMWLSPCreateEx and DICOMWLSPRegistryOpen. The caller sets Size to sizeof(DICOMWLSPOPTIONS); NULL/0 fields keep the defaults.
+	typedef struct _DICOMWLSPOPTIONS
+	{
+		UINT Size;
+		LPCSTR DataFolder;	// "./worklist/"
+		LPCSTR FilePrefix;	// "dataset_", only files starting with it are loaded
+		INT PersistMode;	// 0 full files, 1 files plus delta log
+		INT Port;			// 104
+		LPCSTR AETitle;		// "WORKLIST_SCP"
+	} DICOMWLSPOPTIONS, *PDICOMWLSPOPTIONS;
+
+	// Runtime settings of DICOMWLSPGetSettings and DICOMWLSPSetSettings. The caller sets Size to sizeof(DICOMWLSPSETTINGS).
+	// Changes apply to associations requested afterwards; a port change is handed over to a new listener without a gap.
+	typedef struct _DICOMWLSPSETTINGS
+	{
+		UINT Size;
+		INT Port;				// 104
+		char AETitle[17];		// "WORKLIST_SCP"
+		INT MaxPDULength;		// 16384
+		INT ConnectionTimeout;	// seconds, 30
+		INT AcseTimeout;		// seconds, 30
+		INT DimseTimeout;		// seconds, 30
+		INT MaxMatches;			// C-FIND responses per query, 0 = unlimited
+	} DICOMWLSPSETTINGS, *PDICOMWLSPSETTINGS;
+
 	LPVOID _DICOMC_API_ DICOMWLSPCreate();
+	LPVOID _DICOMC_API_ DICOMWLSPCreateEx(const DICOMWLSPOPTIONS* a_Options);	// instance with its own data folder, file prefix, storage and port
+
+	// Registry of named instances sharing one worker pool (expiry) and one I/O pool (bulk saves); instances are owned by the registry
+	LPVOID _DICOMC_API_ DICOMWLSPRegistryCreate(INT a_WorkerThreads, INT a_IoThreads);
+	BOOL _DICOMC_API_ DICOMWLSPRegistryDestroy(LPVOID a_Registry);                   // destroys all instances of the registry
+	LPVOID _DICOMC_API_ DICOMWLSPRegistryOpen(LPVOID a_Registry, LPCSTR a_Name, const DICOMWLSPOPTIONS* a_Options); // NULL if name, folder/prefix or port is taken
+	LPVOID _DICOMC_API_ DICOMWLSPRegistryFind(LPVOID a_Registry, LPCSTR a_Name);
+	BOOL _DICOMC_API_ DICOMWLSPRegistryClose(LPVOID a_Registry, LPCSTR a_Name);     // destroys the instance, its pointer becomes invalid
+	BOOL _DICOMC_API_ DICOMWLSPRegistrySaveAll(LPVOID a_Registry);                 // save dirty datasets of all instances in parallel
 	BOOL _DICOMC_API_ DICOMWLSPSetTemplateFile(LPVOID a_Obj, LPCSTR a_FileName);	// Load template file to initialize new elements
+	BOOL _DICOMC_API_ DICOMWLSPGetSettings(PVOID a_Obj, PDICOMWLSPSETTINGS a_Settings);       // current runtime settings, no locking
+	BOOL _DICOMC_API_ DICOMWLSPSetSettings(PVOID a_Obj, const DICOMWLSPSETTINGS* a_Settings); // replace runtime settings while running, per-AE limits are kept
+	BOOL _DICOMC_API_ DICOMWLSPSetAEMaxMatches(PVOID a_Obj, LPCSTR a_AETitle, INT a_MaxMatches); // C-FIND response limit for one calling AE title, a_MaxMatches < 0 removes it
 
 	BOOL _DICOMC_API_ DICOMWLSPClear(PVOID a_Obj);									// Clear list
-	BOOL _DICOMC_API_ DICOMWLSPAddDataset(PVOID a_Obj, PINT a_INDEX);				// add new item to list
-	BOOL _DICOMC_API_ DICOMWLSPDelDataset(PVOID a_Obj, INT a_INDEX);                // remove item from list
+	BOOL _DICOMC_API_ DICOMWLSPAddDataset(PVOID a_Obj, PUINT64 a_HANDLE);				// add new item to list, a_HANDLE receives its handle
+	BOOL _DICOMC_API_ DICOMWLSPAddDatasets(PVOID a_Obj, INT a_Count, PUINT64 a_Handles); // add a_Count new items, a_Handles receives their handles
+	BOOL _DICOMC_API_ DICOMWLSPDelDataset(PVOID a_Obj, UINT64 a_HANDLE);             // remove item from list, its handle becomes invalid
 	BOOL _DICOMC_API_ DICOMWLSPCntDataset(PVOID a_Obj, PINT a_Count);                 
-	LPVOID _DICOMC_API_ DICOMWLSPGetDataset(LPVOID a_Obj, INT a_Index);				// a_Index = element in listm, returns dataset instance
+	LPVOID _DICOMC_API_ DICOMWLSPGetDataset(LPVOID a_Obj, UINT64 a_Handle);			// a_Handle = element in list, returns dataset instance (NULL for stale handles), valid until DICOMWLSPReleaseDataset or deletion
+	BOOL _DICOMC_API_ DICOMWLSPReleaseDataset(PVOID a_Obj, UINT64 a_HANDLE);         // give back the dataset instance of DICOMWLSPGetDataset, lets a compact item be packed again
+	LPVOID _DICOMC_API_ DICOMWLSPBeginEdit(PVOID a_Obj, UINT64 a_HANDLE);            // open tracked edit session, returns session handle
+	LPVOID _DICOMC_API_ DICOMWLSPEditDataset(LPVOID a_Session);                      // dataset instance of an edit session, valid until commit/cancel
+	BOOL _DICOMC_API_ DICOMWLSPCommitEdit(PVOID a_Obj, LPVOID a_Session);            // apply changed elements, mark dirty, release session
+	BOOL _DICOMC_API_ DICOMWLSPCancelEdit(PVOID a_Obj, LPVOID a_Session);            // discard changes, release session
+	BOOL _DICOMC_API_ DICOMWLSPGetGeneration(PVOID a_Obj, PUINT64 a_Generation);     // change counter of the list
+	BOOL _DICOMC_API_ DICOMWLSPGetChanges(PVOID a_Obj, UINT64 a_Since, PDICOMWLSPCHANGE a_Changes, INT a_Capacity, PINT a_Count, PUINT64 a_Generation, PBOOL a_Resync); // events after generation a_Since, a_Generation = next a_Since, a_Resync = TRUE: reload whole list
+	BOOL _DICOMC_API_ DICOMWLSPWaitForChanges(PVOID a_Obj, UINT64 a_Since, INT a_TimeoutMs, PUINT64 a_Generation); // block until generation != a_Since (TRUE) or timeout (FALSE), a_TimeoutMs < 0 = infinite
+	LPVOID _DICOMC_API_ DICOMWLSPBeginBatch(PVOID a_Obj);                             // open batch, returns batch handle
+	BOOL _DICOMC_API_ DICOMWLSPBatchAdd(PVOID a_Obj, LPVOID a_Batch, INT a_Count);   // add a_Count new items on commit
+	BOOL _DICOMC_API_ DICOMWLSPBatchDelete(PVOID a_Obj, LPVOID a_Batch, UINT64 a_HANDLE); // remove item on commit
+	LPVOID _DICOMC_API_ DICOMWLSPBatchEdit(PVOID a_Obj, LPVOID a_Batch, UINT64 a_HANDLE); // dataset instance to edit within the batch, valid until commit/rollback
+	BOOL _DICOMC_API_ DICOMWLSPCommitBatch(PVOID a_Obj, LPVOID a_Batch, PUINT64 a_Handles); // apply batch atomically, a_Handles receives handles of added items, releases batch; FALSE if rejected or not saved
+	INT _DICOMC_API_ DICOMWLSPCommitBatchEx(PVOID a_Obj, LPVOID a_Batch, PUINT64 a_Handles); // like CommitBatch: 0 committed, 1 rejected (nothing applied), 2 applied but not saved (a_Handles filled)
+	BOOL _DICOMC_API_ DICOMWLSPRollbackBatch(PVOID a_Obj, LPVOID a_Batch);            // discard batch, releases batch
+
+	// Attribute access by tag path, e.g. "0010,0020" or "0040,0100[0].0040,0002" (hex group,element; [n] = sequence item, default 0).
+	// Setters apply the change under the list lock, create missing sequences/items, update indexes and mark the item dirty.
+	BOOL _DICOMC_API_ DICOMWLSPGetString(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, LPSTR a_Buffer, INT a_Size, PINT a_Length); // copy value into a_Buffer, a_Length receives required length (may be NULL)
+	BOOL _DICOMC_API_ DICOMWLSPSetString(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, LPCSTR a_Value);     // multiple values separated by '\\'
+	BOOL _DICOMC_API_ DICOMWLSPGetInt(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, PINT a_Value);          // VR IS, SL, SS, UL, US
+	BOOL _DICOMC_API_ DICOMWLSPSetInt(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, INT a_Value);
+	BOOL _DICOMC_API_ DICOMWLSPGetDate(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, PINT a_Year, PINT a_Month, PINT a_Day); // VR DA
+	BOOL _DICOMC_API_ DICOMWLSPSetDate(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, INT a_Year, INT a_Month, INT a_Day);
+	BOOL _DICOMC_API_ DICOMWLSPGetItemCount(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, PINT a_Count);    // number of items of a sequence, 0 if missing
+	BOOL _DICOMC_API_ DICOMWLSPAddItem(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, PINT a_Index);         // append empty item to a sequence, a_Index receives its number (may be NULL)
+	BOOL _DICOMC_API_ DICOMWLSPDelItem(PVOID a_Obj, UINT64 a_HANDLE, LPCSTR a_Path, INT a_Index);          // remove item a_Index from a sequence
+
+	// Enumeration of all items in one pass, a_Paths selects a_PathCount attribute values per item (tag paths as above, may be NULL/0)
+	BOOL _DICOMC_API_ DICOMWLSPEnumDatasets(PVOID a_Obj, const LPCSTR* a_Paths, INT a_PathCount, DICOMWLSPENUMPROC a_Proc, LPVOID a_Context, PINT a_Count); // a_Count receives number of visited items (may be NULL)
+	BOOL _DICOMC_API_ DICOMWLSPListDatasets(PVOID a_Obj, PUINT64 a_Handles, INT a_Capacity, PINT a_Count, const LPCSTR* a_Paths, INT a_PathCount, LPSTR a_Values, INT a_ValueWidth, PUINT64 a_Generation); // copy up to a_Capacity handles and a_PathCount values of a_ValueWidth chars each, a_Count receives total count, a_Generation may be NULL
+
+	// Queries with C-FIND matching (wildcards, date ranges, sequence keys), matches are passed to a_Proc like in DICOMWLSPEnumDatasets
+	BOOL _DICOMC_API_ DICOMWLSPFind(PVOID a_Obj, LPVOID a_Query, const LPCSTR* a_Paths, INT a_PathCount, DICOMWLSPENUMPROC a_Proc, LPVOID a_Context, PINT a_Count); // a_Query = query dataset instance
+	BOOL _DICOMC_API_ DICOMWLSPFindByKeys(PVOID a_Obj, const LPCSTR* a_Keys, const LPCSTR* a_Values, INT a_KeyCount, const LPCSTR* a_Paths, INT a_PathCount, DICOMWLSPENUMPROC a_Proc, LPVOID a_Context, PINT a_Count); // a_Keys = tag paths, e.g. "0040,0100.0008,0060" = "CT"
+
+	// Zero-copy reads: a read guard is an immutable view of all items; returned values point into it and stay valid until DICOMWLSPEndRead
+	LPVOID _DICOMC_API_ DICOMWLSPBeginRead(PVOID a_Obj);                             // open read guard, returns guard handle (never blocks writers)
+	INT _DICOMC_API_ DICOMWLSPReadCount(LPVOID a_Guard);                             // number of items in the guard
+	UINT64 _DICOMC_API_ DICOMWLSPReadHandle(LPVOID a_Guard, INT a_Index);            // handle of item a_Index (0 if out of range)
+	LPCSTR _DICOMC_API_ DICOMWLSPReadValue(LPVOID a_Guard, INT a_Index, LPCSTR a_Path, PINT a_Length); // value of item a_Index at tag path, NULL if missing, a_Length may be NULL
+	BOOL _DICOMC_API_ DICOMWLSPEndRead(LPVOID a_Guard);                              // release read guard
 
 	BOOL _DICOMC_API_ DICOMWLSPStart(PVOID a_Obj);
 	BOOL _DICOMC_API_ DICOMWLSPStop(PVOID a_Obj);
-	BOOL _DICOMC_API_ DICOMWLSPStatus(PVOID a_Obj, LPVOID a_Status);				// Providing status information about WL SP - structure need to be defined
+	BOOL _DICOMC_API_ DICOMWLSPStatus(PVOID a_Obj, LPVOID a_Status);				// Providing status information about WL SP as text (a_Status = std::string*)
+	BOOL _DICOMC_API_ DICOMWLSPGetStatusInfo(PVOID a_Obj, PDICOMWLSPSTATUS a_Status);  // Fill status structure from counters, no locking, no allocation
+	BOOL _DICOMC_API_ DICOMWLSPWaitForStatus(PVOID a_Obj, PDICOMWLSPSTATUS a_Status, INT a_TimeoutMs, INT a_Counter, UINT64 a_Threshold); // block until running/state/error count differ from a_Status or counter >= a_Threshold (TRUE) or timeout (FALSE), a_Status is refilled; a_Counter: 0 none, 1 requests, 2 active associations, 3 total associations, 4 errors, 5 datasets, 6 generation
 
-	BOOL _DICOMC_API_ DICOMWLSPMarkDirty(PVOID a_Obj, INT a_INDEX);                   // Mark dataset by index as dirty
-	BOOL _DICOMC_API_ DICOMWLSPFlushDataset(PVOID a_Obj, INT a_INDEX);                // Save dataset by index
+	BOOL _DICOMC_API_ DICOMWLSPMarkDirty(PVOID a_Obj, UINT64 a_HANDLE);               // Mark dataset by handle as dirty
+	BOOL _DICOMC_API_ DICOMWLSPFlushDataset(PVOID a_Obj, UINT64 a_HANDLE);            // Save dataset by handle
 	BOOL _DICOMC_API_ DICOMWLSPFlushAll(PVOID a_Obj);                                 // Save all datasets
 	BOOL _DICOMC_API_ DICOMWLSPFlushDirty(PVOID a_Obj);                               // Save only dirty datasets
+	BOOL _DICOMC_API_ DICOMWLSPSetDeltaPersistence(PVOID a_Obj, BOOL a_Enable);       // Save only changed elements into a delta log
+	BOOL _DICOMC_API_ DICOMWLSPCompact(PVOID a_Obj);                                  // Fold delta log into the dataset files
+	BOOL _DICOMC_API_ DICOMWLSPSetCompactItems(PVOID a_Obj, BOOL a_Enable);           // Keep items as packed buffers instead of dataset trees
+	BOOL _DICOMC_API_ DICOMWLSPSetRetention(PVOID a_Obj, INT a_Policy, INT a_Minutes, LPCSTR a_ArchiveFolder); // Expire past steps: 0 keep, 1 purge, 2 archive, 3 hide
+	BOOL _DICOMC_API_ DICOMWLSPExpire(PVOID a_Obj, PINT a_Count);                     // Expire due datasets now, a_Count may be NULL
 
 
 